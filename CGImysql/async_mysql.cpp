@@ -0,0 +1,349 @@
+#include "async_mysql.h"
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include "../log/log.h"
+#include "circuit_breaker.h"
+#include "../metrics/flight_recorder.h"
+
+#undef LOG_MODULE
+#define LOG_MODULE LOG_MOD_SQL
+
+namespace
+{
+    long long now_ms()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+    }
+
+    // 客户端错误码(2000起)表示连接本身出了问题，需要重连；其余是语句错误
+    bool connection_lost(MYSQL *mysql)
+    {
+        return mysql_errno(mysql) >= 2000;
+    }
+
+    const long long RECONNECT_INTERVAL_MS = 1000;
+}
+
+bool async_mysql::init(std::string url, std::string user, std::string password, std::string db, int port, int connections, int close_log)
+{
+    if (m_started || connections <= 0)
+        return m_started;
+    m_url = url;
+    m_user = user;
+    m_password = password;
+    m_db = db;
+    m_port = port;
+    m_close_log = close_log;
+
+    m_epollfd = epoll_create(8);
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epollfd == -1 || m_wakefd == -1)
+        return false;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_wakefd;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakefd, &ev);
+
+    m_conns.resize(connections);
+    for (int i = 0; i < connections; ++i)
+    {
+        m_conns[i].mysql = NULL;
+        m_conns[i].state = CONN_BROKEN;
+        m_conns[i].fd = -1;
+        m_conns[i].retry_at_ms = 0;
+        m_conns[i].deadline_ms = 0;
+        // 启动时连不上不致命，第一次使用时再重连
+        connect(m_conns[i]);
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, this) != 0)
+        return false;
+    pthread_detach(tid);
+    m_started = true;
+    return true;
+}
+
+void async_mysql::query(const std::string &sql, const std::vector<std::string> &params, callback done)
+{
+    m_lock.lock();
+    if (!m_started || (int)m_pending.size() >= MAX_PENDING)
+    {
+        m_lock.unlock();
+        done(false, rows());
+        return;
+    }
+    request r;
+    r.sql = sql;
+    r.params = params;
+    r.done = std::move(done);
+    r.deadline_ms = now_ms() + DEADLINE_MS;
+    m_pending.push_back(std::move(r));
+    m_lock.unlock();
+
+    uint64_t one = 1;
+    ::write(m_wakefd, &one, sizeof(one));
+}
+
+void *async_mysql::worker(void *arg)
+{
+    async_mysql *db = (async_mysql *)arg;
+    flight_recorder::install_alt_stack();
+    db->run();
+    return db;
+}
+
+bool async_mysql::connect(connection &c)
+{
+    if (c.mysql)
+        mysql_close(c.mysql);
+    c.mysql = mysql_init(NULL);
+    c.fd = -1;
+    if (c.mysql)
+    {
+        // 连接建立是阻塞的，只发生在I/O线程里，限制最长等待
+        unsigned int timeout = 3;
+        mysql_options(c.mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+        if (mysql_real_connect(c.mysql, m_url.c_str(), m_user.c_str(), m_password.c_str(), m_db.c_str(), m_port, NULL, 0))
+        {
+            c.state = CONN_IDLE;
+            return true;
+        }
+        LOG_ERROR("async mysql connect failed: %s", mysql_error(c.mysql));
+        mysql_close(c.mysql);
+        c.mysql = NULL;
+    }
+    c.state = CONN_BROKEN;
+    c.retry_at_ms = now_ms() + RECONNECT_INTERVAL_MS;
+    return false;
+}
+
+void async_mysql::run()
+{
+    struct epoll_event events[16];
+    while (true)
+    {
+        bool busy = false;
+        for (size_t i = 0; i < m_conns.size(); ++i)
+            busy = busy || m_conns[i].state == CONN_QUERY || m_conns[i].state == CONN_RESULT;
+        int n = epoll_wait(m_epollfd, events, 16, busy ? POLL_MS : -1);
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.fd == m_wakefd)
+            {
+                uint64_t count;
+                while (read(m_wakefd, &count, sizeof(count)) > 0)
+                    ;
+            }
+        }
+
+        expire(now_ms());
+
+        // 连接很少，不区分是哪个socket就绪，逐个推进在途查询
+        for (size_t i = 0; i < m_conns.size(); ++i)
+        {
+            if (m_conns[i].state == CONN_QUERY || m_conns[i].state == CONN_RESULT)
+                drive(m_conns[i]);
+        }
+
+        // 先用空闲连接，仍有排队的查询时再尝试重连断开的连接
+        dispatch(CONN_IDLE);
+        dispatch(CONN_BROKEN);
+    }
+}
+
+void async_mysql::dispatch(conn_state state)
+{
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        connection &c = m_conns[i];
+        if (c.state != state)
+            continue;
+        m_lock.lock();
+        if (m_pending.empty())
+        {
+            m_lock.unlock();
+            return;
+        }
+        request r = std::move(m_pending.front());
+        m_pending.pop_front();
+        m_lock.unlock();
+
+        if (c.state == CONN_BROKEN && (now_ms() < c.retry_at_ms || !connect(c)))
+        {
+            // 数据库不可用时立即失败，不让请求排队等待重连
+            circuit_breaker::get_instance(DEP_MYSQL)->record(false);
+            r.done(false, rows());
+            continue;
+        }
+        c.sql = bind_params(c.mysql, r.sql, r.params);
+        c.done = std::move(r.done);
+        c.deadline_ms = r.deadline_ms;
+        c.state = CONN_QUERY;
+        drive(c);
+    }
+}
+
+void async_mysql::drive(connection &c)
+{
+    if (c.state == CONN_QUERY)
+    {
+        net_async_status s = mysql_real_query_nonblocking(c.mysql, c.sql.c_str(), c.sql.size());
+        if (s == NET_ASYNC_NOT_READY)
+        {
+            watch(c);
+            return;
+        }
+        if (s == NET_ASYNC_ERROR)
+        {
+            LOG_ERROR("async query failed: %s", mysql_error(c.mysql));
+            finish(c, false, rows());
+            return;
+        }
+        c.state = CONN_RESULT;
+    }
+    if (c.state == CONN_RESULT)
+    {
+        MYSQL_RES *res = NULL;
+        net_async_status s = mysql_store_result_nonblocking(c.mysql, &res);
+        if (s == NET_ASYNC_NOT_READY)
+        {
+            watch(c);
+            return;
+        }
+        if (s == NET_ASYNC_ERROR)
+        {
+            LOG_ERROR("async store result failed: %s", mysql_error(c.mysql));
+            finish(c, false, rows());
+            return;
+        }
+        rows result;
+        // INSERT 等语句没有结果集
+        if (res)
+        {
+            unsigned int fields = mysql_num_fields(res);
+            while (MYSQL_ROW row = mysql_fetch_row(res))
+            {
+                std::vector<std::string> r(fields);
+                for (unsigned int k = 0; k < fields; ++k)
+                {
+                    if (row[k])
+                        r[k] = row[k];
+                }
+                result.push_back(r);
+            }
+            mysql_free_result(res);
+        }
+        finish(c, true, result);
+    }
+}
+
+void async_mysql::expire(long long now)
+{
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        connection &c = m_conns[i];
+        if ((c.state == CONN_QUERY || c.state == CONN_RESULT) && now >= c.deadline_ms)
+        {
+            LOG_WARN("async query exceeded %d ms, dropping connection", DEADLINE_MS);
+            abort(c);
+        }
+    }
+
+    std::vector<callback> expired;
+    m_lock.lock();
+    // 队列按截止时间排序，从头部取超时的
+    while (!m_pending.empty() && now >= m_pending.front().deadline_ms)
+    {
+        expired.push_back(std::move(m_pending.front().done));
+        m_pending.pop_front();
+    }
+    m_lock.unlock();
+    for (size_t i = 0; i < expired.size(); ++i)
+    {
+        circuit_breaker::get_instance(DEP_MYSQL)->record(false);
+        expired[i](false, rows());
+    }
+}
+
+void async_mysql::abort(connection &c)
+{
+    if (c.fd != -1)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+        c.fd = -1;
+    }
+    mysql_close(c.mysql);
+    c.mysql = NULL;
+    c.state = CONN_BROKEN;
+    c.retry_at_ms = 0;
+    c.sql.clear();
+    callback done = std::move(c.done);
+    c.done = nullptr;
+    circuit_breaker::get_instance(DEP_MYSQL)->record(false);
+    done(false, rows());
+}
+
+void async_mysql::watch(connection &c)
+{
+    if (c.fd != -1)
+        return;
+    // Oracle 客户端库没有公开取socket的函数，直接读连接结构里的fd
+    c.fd = c.mysql->net.fd;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = c.fd;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+void async_mysql::finish(connection &c, bool ok, const rows &result)
+{
+    // 空闲连接不留在epoll上，否则服务端断开时会一直报告可读
+    if (c.fd != -1)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+        c.fd = -1;
+    }
+    c.state = CONN_IDLE;
+    bool lost = !ok && connection_lost(c.mysql);
+    if (lost)
+    {
+        c.state = CONN_BROKEN;
+        c.retry_at_ms = 0;
+    }
+    circuit_breaker::get_instance(DEP_MYSQL)->record(!lost);
+    c.sql.clear();
+    callback done = std::move(c.done);
+    c.done = nullptr;
+    done(ok, result);
+}
+
+std::string async_mysql::bind_params(MYSQL *mysql, const std::string &sql, const std::vector<std::string> &params)
+{
+    std::string out;
+    size_t next = 0;
+    std::vector<char> buf;
+    for (size_t i = 0; i < sql.size(); ++i)
+    {
+        if (sql[i] != '?' || next >= params.size())
+        {
+            out += sql[i];
+            continue;
+        }
+        const std::string &p = params[next++];
+        buf.resize(p.size() * 2 + 1);
+        unsigned long len = mysql_real_escape_string(mysql, &buf[0], p.c_str(), p.size());
+        out += '\'';
+        out.append(&buf[0], len);
+        out += '\'';
+    }
+    return out;
+}
@@ -0,0 +1,101 @@
+#ifndef ASYNC_MYSQL_H
+#define ASYNC_MYSQL_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <functional>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+
+/*
+非阻塞数据库查询
+一个数据库I/O线程持有几条专用连接，用 Oracle MySQL 客户端库(8.0.16 起)的非阻塞接口(mysql_real_query_nonblocking /
+mysql_store_result_nonblocking)发起查询，
+不支持 MariaDB Connector/C(它的非阻塞接口是 mysql_real_query_start/_cont)；等待期间把连接的socket挂在自己的epoll上，结果到达后调用完成回调
+请求协程通过 http_conn::await_callback 等待回调，查库期间不占用工作线程和执行器线程
+SQL 中的 ? 由参数依次替换，参数在I/O线程里用 mysql_real_escape_string 转义后加引号
+每个查询从入队起最多 DEADLINE_MS：排队超时直接失败，执行超时则断开该连接(下次使用时重连)并失败
+连接类错误和超时上报给 MySQL 熔断器，语句错误不上报
+*/
+
+class async_mysql
+{
+public:
+    typedef std::vector<std::vector<std::string> > rows;
+    // ok 为 false 表示连接或查询失败
+    typedef std::function<void(bool ok, const rows &result)> callback;
+
+    static async_mysql *get_instance()
+    {
+        static async_mysql instance;
+        return &instance;
+    }
+
+    static const int MAX_PENDING = 1024; // 排队的查询上限，超出时直接失败
+    static const int POLL_MS = 10;       // 有查询在进行时的轮询间隔，兜底socket可写而不可读的情况
+    static const int DEADLINE_MS = 3000; // 查询从入队到完成的最长时间
+
+    bool init(std::string url, std::string user, std::string password, std::string db, int port, int connections, int close_log);
+    // 完成回调在I/O线程上调用，不能阻塞；未启动或队列已满时在调用线程内以失败回调
+    void query(const std::string &sql, const std::vector<std::string> &params, callback done);
+
+private:
+    struct request
+    {
+        std::string sql;
+        std::vector<std::string> params;
+        callback done;
+        long long deadline_ms;
+    };
+
+    enum conn_state
+    {
+        CONN_IDLE = 0,
+        CONN_QUERY,  // 正在发送查询
+        CONN_RESULT, // 正在接收结果集
+        CONN_BROKEN  // 需要重连
+    };
+
+    struct connection
+    {
+        MYSQL *mysql;
+        conn_state state;
+        int fd;                // 已挂在epoll上的socket，-1表示没有
+        long long retry_at_ms; // 断开后下一次允许重连的时间
+        long long deadline_ms; // 在途查询的截止时间
+        std::string sql;       // 转义替换后的完整SQL，发送期间必须保持有效
+        callback done;
+    };
+
+    async_mysql() : m_epollfd(-1), m_wakefd(-1), m_started(false), m_close_log(0), m_port(0) {}
+    async_mysql(const async_mysql &) = delete;
+    async_mysql &operator=(const async_mysql &) = delete;
+
+    static void *worker(void *arg);
+    void run();
+    bool connect(connection &c);
+    // 推进一条连接上的查询，直到需要等待socket或完成
+    void drive(connection &c);
+    void finish(connection &c, bool ok, const rows &result);
+    void watch(connection &c);
+    // 让超过截止时间的在途查询和排队查询失败
+    void expire(long long now);
+    // 断开连接，在途查询以失败回调
+    void abort(connection &c);
+    // 把排队的查询分配给处于 state 状态的连接
+    void dispatch(conn_state state);
+    std::string bind_params(MYSQL *mysql, const std::string &sql, const std::vector<std::string> &params);
+
+    std::vector<connection> m_conns;
+    std::list<request> m_pending; // 受 m_lock 保护
+    locker m_lock;
+    int m_epollfd;
+    int m_wakefd; // eventfd，新查询入队时唤醒I/O线程
+    bool m_started;
+    int m_close_log;
+    std::string m_url, m_user, m_password, m_db;
+    int m_port;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "circuit_breaker.h"
+#include <string>
+#include <time.h>
+#include "../log/log.h"
+#include "../metrics/registry.h"
+
+#undef LOG_MODULE
+#define LOG_MODULE LOG_MOD_SQL
+
+namespace
+{
+    long long now_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+
+    const char *const DEP_NAMES[DEP_COUNT] = {"mysql"};
+}
+
+circuit_breaker *circuit_breaker::get_instance(dependency dep)
+{
+    static circuit_breaker breakers[DEP_COUNT] = {DEP_MYSQL};
+    return &breakers[dep];
+}
+
+circuit_breaker::circuit_breaker(dependency dep)
+    : m_state(CLOSED), m_failures(0), m_until_ms(0), m_probing(false), m_close_log(0)
+{
+    std::string labels = std::string("dependency=\"") + DEP_NAMES[dep] + "\"";
+    metrics_registry *r = metrics_registry::get_instance();
+    r->add_callback("tws_circuit_state", "Circuit breaker state: 0 closed, 1 open, 2 half-open", "gauge",
+                    [this]() { return (double)current(); }, labels.c_str());
+    m_rejected = r->add_counter("tws_circuit_rejected_total", "Requests failed fast by an open circuit", labels.c_str());
+    m_opened = r->add_counter("tws_circuit_opened_total", "Times a circuit breaker tripped", labels.c_str());
+}
+
+bool circuit_breaker::allow()
+{
+    if (m_state.load(std::memory_order_relaxed) == CLOSED)
+        return true;
+
+    bool ok = false;
+    long long now = now_ms();
+    m_lock.lock();
+    int s = m_state.load(std::memory_order_relaxed);
+    if (s == CLOSED)
+        ok = true;
+    else if (now >= m_until_ms && (s == OPEN || !m_probing || now >= m_until_ms + OPEN_MS))
+    {
+        // 熔断期满(或上一个探测迟迟没有结果)，放行一个探测请求
+        m_state.store(HALF_OPEN, std::memory_order_relaxed);
+        m_probing = true;
+        m_until_ms = now;
+        ok = true;
+    }
+    m_lock.unlock();
+    if (!ok && m_rejected)
+        m_rejected->inc();
+    return ok;
+}
+
+void circuit_breaker::record(bool ok)
+{
+    // 闭合且一直成功时不加锁
+    if (ok && m_state.load(std::memory_order_relaxed) == CLOSED && m_failures.load(std::memory_order_relaxed) == 0)
+        return;
+
+    m_lock.lock();
+    int s = m_state.load(std::memory_order_relaxed);
+    if (ok)
+    {
+        m_failures = 0;
+        if (s != CLOSED)
+        {
+            m_state.store(CLOSED, std::memory_order_relaxed);
+            m_probing = false;
+            LOG_INFO("%s", "circuit closed, dependency recovered");
+        }
+    }
+    else if (s == HALF_OPEN || ++m_failures >= FAILURE_THRESHOLD)
+    {
+        if (s != OPEN)
+            open_locked(now_ms());
+    }
+    m_lock.unlock();
+}
+
+void circuit_breaker::open_locked(long long now)
+{
+    m_state.store(OPEN, std::memory_order_relaxed);
+    m_until_ms = now + OPEN_MS;
+    m_probing = false;
+    m_failures = 0;
+    if (m_opened)
+        m_opened->inc();
+    LOG_WARN("circuit opened for %d ms after repeated failures", OPEN_MS);
+}
@@ -0,0 +1,64 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <atomic>
+#include "../lock/locker.h"
+
+class metric_counter;
+
+/*
+依赖熔断器
+每个外部依赖一个实例。连续失败 FAILURE_THRESHOLD 次后熔断(OPEN)，OPEN_MS 内 allow() 直接返回 false，
+调用方立即以 503 失败，不再排队等待数据库
+熔断期满后进入半开(HALF_OPEN)，只放行一个探测请求：探测成功则恢复(CLOSED)，失败则再熔断一个周期
+探测迟迟没有结果(超过 OPEN_MS)时再放行一个，避免卡在半开状态
+成功/失败由依赖的调用层(异步查询线程、注册写入线程)上报，只统计连接和超时类错误，语句本身的错误(如用户名重复)不算
+闭合状态下 allow() 只做一次原子读
+*/
+
+enum dependency
+{
+    DEP_MYSQL = 0,
+    DEP_COUNT
+};
+
+class circuit_breaker
+{
+public:
+    static circuit_breaker *get_instance(dependency dep);
+
+    static const int FAILURE_THRESHOLD = 5;
+    static const int OPEN_MS = 5000;
+
+    enum state
+    {
+        CLOSED = 0,
+        OPEN,
+        HALF_OPEN
+    };
+
+    // 是否放行一个依赖该服务的请求
+    bool allow();
+    void record(bool ok);
+    state current() const { return (state)m_state.load(std::memory_order_relaxed); }
+    void set_close_log(int close_log) { m_close_log = close_log; }
+
+private:
+    circuit_breaker(dependency dep);
+    circuit_breaker(const circuit_breaker &) = delete;
+    circuit_breaker &operator=(const circuit_breaker &) = delete;
+
+    // 调用方持有 m_lock
+    void open_locked(long long now);
+
+    std::atomic<int> m_state;
+    locker m_lock;
+    std::atomic<int> m_failures; // 连续失败次数，在 m_lock 内修改
+    long long m_until_ms;       // OPEN 的截止时间 / HALF_OPEN 探测放行的时间
+    bool m_probing;             // 半开状态下已放行探测请求
+    metric_counter *m_rejected;
+    metric_counter *m_opened;
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "registration_writer.h"
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include "circuit_breaker.h"
+#include "../metrics/flight_recorder.h"
+
+#undef LOG_MODULE
+#define LOG_MODULE LOG_MOD_SQL
+
+namespace
+{
+    long long now_ms()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+    }
+}
+
+bool registration_writer::init(connection_pool *pool)
+{
+    m_lock.lock();
+    if (m_started)
+    {
+        m_lock.unlock();
+        return true;
+    }
+    m_pool = pool;
+    m_close_log = pool->m_close_log;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, this) == 0)
+    {
+        pthread_detach(tid);
+        m_started = true;
+    }
+    m_lock.unlock();
+    return m_started;
+}
+
+void registration_writer::submit(const std::string &name, const std::string &password, callback done)
+{
+    item it;
+    it.name = name;
+    it.password = password;
+    it.done = std::move(done);
+    it.deadline_ms = now_ms() + DEADLINE_MS;
+
+    m_lock.lock();
+    if (!m_started)
+    {
+        m_lock.unlock();
+        std::vector<item> batch(1, std::move(it));
+        write_batch(batch);
+        return;
+    }
+    m_queue.push_back(std::move(it));
+    size_t size = m_queue.size();
+    m_lock.unlock();
+    // 队列从空变为非空时唤醒写入线程开始计时，攒满一批时提前唤醒
+    if (size == 1 || size >= (size_t)MAX_BATCH)
+        m_cond.signal();
+}
+
+void *registration_writer::worker(void *arg)
+{
+    registration_writer *writer = (registration_writer *)arg;
+    flight_recorder::install_alt_stack();
+    writer->run();
+    return writer;
+}
+
+void registration_writer::run()
+{
+    std::vector<item> batch;
+    std::vector<item> expired;
+    while (true)
+    {
+        m_lock.lock();
+        while (m_queue.empty())
+            m_cond.wait(m_lock.get());
+
+        // 第一个注册到达后再等一个窗口，合并同时到达的注册
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long long ns = (long long)now.tv_usec * 1000 + (long long)BATCH_WINDOW_MS * 1000000;
+        struct timespec deadline;
+        deadline.tv_sec = now.tv_sec + ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+        while (m_queue.size() < (size_t)MAX_BATCH && m_cond.timewait(m_lock.get(), deadline))
+            ;
+
+        size_t n = m_queue.size() < (size_t)MAX_BATCH ? m_queue.size() : (size_t)MAX_BATCH;
+        batch.clear();
+        expired.clear();
+        long long taken_ms = now_ms();
+        for (size_t i = 0; i < n; ++i)
+        {
+            // 排队太久说明数据库跟不上，直接失败
+            if (taken_ms >= m_queue[i].deadline_ms)
+                expired.push_back(std::move(m_queue[i]));
+            else
+                batch.push_back(std::move(m_queue[i]));
+        }
+        m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+        m_lock.unlock();
+
+        if (!expired.empty())
+        {
+            LOG_WARN("%d registrations expired in queue", (int)expired.size());
+            circuit_breaker::get_instance(DEP_MYSQL)->record(false);
+            for (size_t i = 0; i < expired.size(); ++i)
+                expired[i].done(false);
+        }
+        if (!batch.empty())
+            write_batch(batch);
+    }
+}
+
+void registration_writer::write_batch(std::vector<item> &batch)
+{
+    std::vector<char> ok(batch.size(), 0);
+    // 拿不到连接或连接断开算作数据库故障，语句失败(如用户名重复)不算
+    bool lost = true;
+    {
+        MYSQL *conn = NULL;
+        connectionRAII mysqlcon(&conn, m_pool);
+        if (conn)
+        {
+            lost = false;
+            if (insert_rows(conn, batch, 0, batch.size(), &lost))
+                ok.assign(batch.size(), 1);
+            else if (batch.size() > 1 && !lost)
+            {
+                // 逐行插入找出失败的用户，放在一个事务里只提交一次
+                mysql_autocommit(conn, false);
+                for (size_t i = 0; i < batch.size() && !lost; ++i)
+                    ok[i] = insert_rows(conn, batch, i, i + 1, &lost);
+                if (mysql_commit(conn) != 0)
+                {
+                    LOG_ERROR("registration commit failed: %s", mysql_error(conn));
+                    ok.assign(batch.size(), 0);
+                }
+                mysql_autocommit(conn, true);
+            }
+            // 连接已断开，不放回池中，下次借用时新建
+            if (lost)
+                mysqlcon.broken();
+        }
+    }
+    circuit_breaker::get_instance(DEP_MYSQL)->record(!lost);
+    LOG_DEBUG("registration batch of %d written", (int)batch.size());
+    for (size_t i = 0; i < batch.size(); ++i)
+        batch[i].done(ok[i] != 0);
+}
+
+bool registration_writer::insert_rows(MYSQL *conn, const std::vector<item> &batch, size_t begin, size_t end, bool *lost)
+{
+    size_t n = end - begin;
+    std::string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+    for (size_t i = 1; i < n; ++i)
+        sql += ",(?, ?)";
+    MYSQL_STMT *stmt = m_pool->GetStatement(conn, sql);
+    if (!stmt)
+    {
+        *lost = mysql_errno(conn) >= 2000;
+        return false;
+    }
+
+    MYSQL_BIND bind[MAX_BATCH * 2];
+    unsigned long lengths[MAX_BATCH * 2];
+    memset(bind, 0, sizeof(bind));
+    for (size_t i = 0; i < n; ++i)
+    {
+        const item &it = batch[begin + i];
+        const std::string *fields[2] = {&it.name, &it.password};
+        for (int k = 0; k < 2; ++k)
+        {
+            MYSQL_BIND &b = bind[i * 2 + k];
+            lengths[i * 2 + k] = fields[k]->size();
+            b.buffer_type = MYSQL_TYPE_STRING;
+            b.buffer = (void *)fields[k]->data();
+            b.buffer_length = fields[k]->size();
+            b.length = &lengths[i * 2 + k];
+        }
+    }
+    if (mysql_stmt_bind_param(stmt, bind) || mysql_stmt_execute(stmt) != 0)
+    {
+        LOG_WARN("registration insert of %d rows failed: %s", (int)n, mysql_stmt_error(stmt));
+        // 客户端错误码(2000起)表示连接本身出了问题
+        *lost = mysql_stmt_errno(stmt) >= 2000;
+        return false;
+    }
+    return true;
+}
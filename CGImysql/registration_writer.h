@@ -0,0 +1,68 @@
+#ifndef REGISTRATION_WRITER_H
+#define REGISTRATION_WRITER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mysql/mysql.h>
+#include "sql_connection_pool.h"
+#include "../lock/locker.h"
+
+/*
+注册写入线程
+注册请求只把用户名密码放入队列，由一个后台线程批量写库：第一个请求到达后最多再等 BATCH_WINDOW_MS，
+把期间到达的注册(最多 MAX_BATCH 个)合成一条多行 INSERT 预处理语句，一次往返写入
+多行插入失败时(如某个用户名在库中已存在)改为在一个事务里逐行插入，分别得出每个用户的结果
+在队列里等待超过 DEADLINE_MS 的注册直接失败，数据库变慢时不让请求无限排队
+拿不到连接、连接断开和排队超时上报给 MySQL 熔断器
+完成回调在写入线程上调用，不能阻塞
+*/
+
+class registration_writer
+{
+public:
+    typedef std::function<void(bool)> callback;
+
+    static registration_writer *get_instance()
+    {
+        static registration_writer instance;
+        return &instance;
+    }
+
+    static const int MAX_BATCH = 32;
+    static const int BATCH_WINDOW_MS = 5;
+    static const int DEADLINE_MS = 3000;
+
+    // 启动写入线程，重复调用无效
+    bool init(connection_pool *pool);
+    // done(是否写入成功)；未启动时在调用线程内直接写入
+    void submit(const std::string &name, const std::string &password, callback done);
+
+private:
+    struct item
+    {
+        std::string name;
+        std::string password;
+        callback done;
+        long long deadline_ms;
+    };
+
+    registration_writer() : m_pool(connection_pool::GetInstance()), m_started(false), m_close_log(0) {}
+    registration_writer(const registration_writer &) = delete;
+    registration_writer &operator=(const registration_writer &) = delete;
+
+    static void *worker(void *arg);
+    void run();
+    void write_batch(std::vector<item> &batch);
+    // 一条语句插入 [begin, end) 的所有用户；连接断开时置 *lost
+    bool insert_rows(MYSQL *conn, const std::vector<item> &batch, size_t begin, size_t end, bool *lost);
+
+    connection_pool *m_pool;
+    bool m_started;
+    int m_close_log;
+    std::vector<item> m_queue; // 受 m_lock 保护
+    locker m_lock;
+    cond m_cond;
+};
+
+#endif
@@ -4,16 +4,46 @@
 #include <string.h>
 #include <stdlib.h>
 #include <list>
+#include <vector>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include <iostream>
 #include "sql_connection_pool.h"
+#include "../metrics/flight_recorder.h"
+#include "../metrics/registry.h"
+
+#undef LOG_MODULE
+#define LOG_MODULE LOG_MOD_SQL
 
 using namespace std;
 
+namespace
+{
+	long long now_us()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec * 1000000LL + tv.tv_usec;
+	}
+}
+
 connection_pool::connection_pool()
 {
+	m_MaxConn = 0;
+	m_MinConn = 0;
 	m_CurConn = 0;
-	m_FreeConn = 0;
+	m_TotalConn = 0;
+	m_Waiting = 0;
+	m_Borrows = 0;
+	m_WaitUs = 0;
+	m_MaxWaitUs = 0;
+	m_Timeouts = 0;
+	m_Failures = 0;
+	m_Reconnects = 0;
+	m_started = false;
+	m_Port = 0;
+	m_close_log = 0;
 }
 
 connection_pool *connection_pool::GetInstance()
@@ -23,7 +53,7 @@ connection_pool *connection_pool::GetInstance()
 }
 
 //构造初始化
-void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log)
+void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log, int MinConn)
 {
 	//初始化数据库信息
 	m_url = url;
@@ -32,73 +62,253 @@ void connection_pool::init(string url, string User, string PassWord, string DBNa
 	m_PassWord = PassWord;
 	m_DatabaseName = DBName;
 	m_close_log = close_log;
-	// 创建MaxConn调数据库连接
-	for (int i = 0; i < MaxConn; i++)
-	{
-		MYSQL *con = NULL;
-		con = mysql_init(con);
 
-		if (con == NULL)
-		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
-		}
-		con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
+	lock.lock();
+	m_MaxConn = MaxConn > 0 ? MaxConn : 1;
+	if (MinConn < 0)
+		MinConn = m_MaxConn / 4 > 1 ? m_MaxConn / 4 : 1;
+	m_MinConn = MinConn < m_MaxConn ? MinConn : m_MaxConn;
+	bool start = !m_started;
+	m_started = true;
+	lock.unlock();
 
-		if (con == NULL)
-		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
-		}
-		//更新连接池和空闲连接数量
-		connList.push_back(con);
-		++m_FreeConn;
+	// 先建立 MinConn 条连接，数据库暂时连不上时不退出，由维护线程和后续借用继续重试
+	Maintain();
+	if (GetFreeConn() < m_MinConn)
+		LOG_ERROR("mysql pool started with %d of %d connections", GetFreeConn(), m_MinConn);
+
+	if (start)
+	{
+		RegisterMetrics();
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, maintainer, this) == 0)
+			pthread_detach(tid);
+	}
+}
+
+void *connection_pool::maintainer(void *arg)
+{
+	connection_pool *pool = (connection_pool *)arg;
+	flight_recorder::install_alt_stack();
+	while (true)
+	{
+		sleep(MAINTAIN_INTERVAL_S);
+		pool->Maintain();
 	}
-	// 将信号量初始化为最大连接次数
-	reserve = sem(m_FreeConn);
+	return pool;
+}
 
-	m_MaxConn = m_FreeConn;
+MYSQL *connection_pool::Connect()
+{
+	MYSQL *con = mysql_init(NULL);
+	if (con)
+	{
+		// 借用线程会等待建立连接，限制最长时间
+		unsigned int timeout = 3;
+		mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+		if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(), m_Port, NULL, 0))
+			return con;
+		LOG_ERROR("mysql connect failed: %s", mysql_error(con));
+		mysql_close(con);
+	}
+	else
+		LOG_ERROR("MySQL Error");
+	flight_recorder::get_instance()->record(FR_ERROR, -1, 0, 0, "mysql connect failed");
+	lock.lock();
+	++m_Failures;
+	lock.unlock();
+	return NULL;
 }
 
+void connection_pool::Close(MYSQL *con)
+{
+	map<string, MYSQL_STMT *> stmts;
+	lock.lock();
+	map<MYSQL *, map<string, MYSQL_STMT *> >::iterator c = m_statements.find(con);
+	if (c != m_statements.end())
+	{
+		stmts.swap(c->second);
+		m_statements.erase(c);
+	}
+	lock.unlock();
+	for (map<string, MYSQL_STMT *>::iterator it = stmts.begin(); it != stmts.end(); ++it)
+		mysql_stmt_close(it->second);
+	mysql_close(con);
+}
 
-//当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+//当有请求时，从数据库连接池中返回一个可用连接，没有空闲连接且未达上限时新建一条
 MYSQL *connection_pool::GetConnection()
 {
-	MYSQL *con = NULL;
+	long long start = now_us();
+	long long end = start + BORROW_TIMEOUT_MS * 1000LL;
+	struct timespec deadline;
+	deadline.tv_sec = end / 1000000;
+	deadline.tv_nsec = end % 1000000 * 1000;
 
-	if (0 == connList.size())
-		return NULL;
-	// 取出连接，信号量原子减1，为0则等待
-	reserve.wait();
-	
 	lock.lock();
-
-	con = connList.front();
-	connList.pop_front();
-	// 这里的两个变量，没有用到
-	--m_FreeConn;
+	while (connList.empty() && m_TotalConn >= m_MaxConn)
+	{
+		++m_Waiting;
+		bool signaled = m_released.timewait(lock.get(), deadline);
+		--m_Waiting;
+		if (!signaled && connList.empty() && m_TotalConn >= m_MaxConn)
+		{
+			++m_Timeouts;
+			lock.unlock();
+			LOG_WARN("mysql pool exhausted, no connection within %d ms", BORROW_TIMEOUT_MS);
+			return NULL;
+		}
+	}
+	// 取最近归还的连接，较早的连接留在头部，空闲久了由 Maintain 关闭
+	idle_conn idle = {NULL, 0};
+	if (!connList.empty())
+	{
+		idle = connList.back();
+		connList.pop_back();
+	}
+	else
+		++m_TotalConn; // 先占住名额，在锁外建立连接
 	++m_CurConn;
+	lock.unlock();
+
+	MYSQL *con = idle.conn;
+	bool replaced = false;
+	if (con && start / 1000 - idle.last_used_ms >= PING_AFTER_MS && mysql_ping(con) != 0)
+	{
+		// 服务端会关闭空闲过久的连接，重启数据库后旧连接也全部失效
+		LOG_WARN("mysql connection lost: %s, reconnecting", mysql_error(con));
+		Close(con);
+		con = NULL;
+		replaced = true;
+		lock.lock();
+		++m_Failures;
+		lock.unlock();
+	}
+	if (!con)
+		con = Connect();
 
+	long long waited = now_us() - start;
+	lock.lock();
+	if (!con)
+	{
+		--m_CurConn;
+		--m_TotalConn;
+		lock.unlock();
+		// 名额空出，唤醒一个等待者自己去建立连接
+		m_released.signal();
+		return NULL;
+	}
+	if (replaced)
+		++m_Reconnects;
+	++m_Borrows;
+	m_WaitUs += waited;
+	if (waited > m_MaxWaitUs)
+		m_MaxWaitUs = waited;
 	lock.unlock();
 	return con;
 }
 
 //释放当前使用的连接
-bool connection_pool::ReleaseConnection(MYSQL *con)
+bool connection_pool::ReleaseConnection(MYSQL *con, bool broken)
 {
 	if (NULL == con)
 		return false;
 
+	// 连续使用的连接不会空闲到 PING_AFTER_MS，断开后只能在这里发现，否则会被反复借出
+	if (broken || mysql_errno(con) >= 2000)
+	{
+		LOG_WARN("mysql connection returned broken: %s", mysql_error(con));
+		Discard(con);
+		return true;
+	}
+
+	idle_conn idle = {con, now_us() / 1000};
 	lock.lock();
+	connList.push_back(idle);
+	--m_CurConn;
+	lock.unlock();
+	m_released.signal();
+	return true;
+}
 
-	connList.push_back(con);
-	++m_FreeConn;
+void connection_pool::Discard(MYSQL *con)
+{
+	Close(con);
+	lock.lock();
 	--m_CurConn;
+	--m_TotalConn;
+	++m_Failures;
+	lock.unlock();
+	// 名额空出，等待者可以新建连接
+	m_released.signal();
+}
 
+void connection_pool::Maintain()
+{
+	long long now = now_us() / 1000;
+	vector<MYSQL *> expired;
+	lock.lock();
+	// 头部是最早归还的连接，空闲时间从头到尾递减
+	while (!connList.empty() && m_TotalConn > m_MinConn && now - connList.front().last_used_ms >= IDLE_TIMEOUT_MS)
+	{
+		expired.push_back(connList.front().conn);
+		connList.pop_front();
+		--m_TotalConn;
+	}
+	int missing = m_MinConn - m_TotalConn;
+	if (missing > 0)
+		m_TotalConn += missing;
 	lock.unlock();
-	// 释放连接原子加1
-	reserve.post();
-	return true;
+
+	for (size_t i = 0; i < expired.size(); ++i)
+		Close(expired[i]);
+	if (!expired.empty())
+		LOG_INFO("mysql pool closed %d idle connections", (int)expired.size());
+
+	for (int i = 0; i < missing; ++i)
+	{
+		MYSQL *con = Connect();
+		if (!con)
+		{
+			// 数据库不可用，剩下的名额还回去，下一轮再试
+			lock.lock();
+			m_TotalConn -= missing - i;
+			lock.unlock();
+			m_released.broadcast();
+			break;
+		}
+		idle_conn idle = {con, now_us() / 1000};
+		lock.lock();
+		connList.push_back(idle);
+		lock.unlock();
+		m_released.signal();
+	}
+}
+
+MYSQL_STMT *connection_pool::GetStatement(MYSQL *conn, const string &sql)
+{
+	lock.lock();
+	map<string, MYSQL_STMT *> &stmts = m_statements[conn];
+	map<string, MYSQL_STMT *>::iterator it = stmts.find(sql);
+	MYSQL_STMT *stmt = it == stmts.end() ? NULL : it->second;
+	lock.unlock();
+	if (stmt)
+		return stmt;
+
+	// prepare 需要一次往返，不在锁内进行；conn 由调用方独占，不会有别的线程同时为它准备语句
+	stmt = mysql_stmt_init(conn);
+	if (!stmt)
+		return NULL;
+	if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()) != 0)
+	{
+		LOG_ERROR("prepare statement failed: %s", mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+	lock.lock();
+	m_statements[conn][sql] = stmt;
+	lock.unlock();
+	return stmt;
 }
 
 //销毁数据库连接池
@@ -106,17 +316,21 @@ void connection_pool::DestroyPool()
 {
 
 	lock.lock();
+	for (map<MYSQL *, map<string, MYSQL_STMT *> >::iterator c = m_statements.begin(); c != m_statements.end(); ++c)
+	{
+		for (map<string, MYSQL_STMT *>::iterator it = c->second.begin(); it != c->second.end(); ++it)
+			mysql_stmt_close(it->second);
+	}
+	m_statements.clear();
 	if (connList.size() > 0)
 	{
 		//通过迭代器遍历，关闭数据库连接
-		list<MYSQL *>::iterator it;
+		list<idle_conn>::iterator it;
 		for (it = connList.begin(); it != connList.end(); ++it)
 		{
-			MYSQL *con = *it;
-			mysql_close(con);
+			mysql_close(it->conn);
 		}
-		m_CurConn = 0;
-		m_FreeConn = 0;
+		m_TotalConn -= connList.size();
 		connList.clear();
 	}
 
@@ -126,7 +340,51 @@ void connection_pool::DestroyPool()
 //当前空闲的连接数
 int connection_pool::GetFreeConn()
 {
-	return this->m_FreeConn;
+	lock.lock();
+	int n = connList.size();
+	lock.unlock();
+	return n;
+}
+
+connection_pool::stats connection_pool::GetStats()
+{
+	stats s;
+	lock.lock();
+	s.total = m_TotalConn;
+	s.in_use = m_CurConn;
+	s.idle = connList.size();
+	s.waiting = m_Waiting;
+	s.borrows = m_Borrows;
+	s.wait_us = m_WaitUs;
+	s.max_wait_us = m_MaxWaitUs;
+	s.timeouts = m_Timeouts;
+	s.failures = m_Failures;
+	s.reconnects = m_Reconnects;
+	lock.unlock();
+	return s;
+}
+
+void connection_pool::RegisterMetrics()
+{
+	metrics_registry *r = metrics_registry::get_instance();
+	r->add_callback("tws_db_pool_connections", "MySQL pool connections by state", "gauge",
+					[this]() { return (double)GetStats().idle; }, "state=\"idle\"");
+	r->add_callback("tws_db_pool_connections", "MySQL pool connections by state", "gauge",
+					[this]() { return (double)GetStats().in_use; }, "state=\"in_use\"");
+	r->add_callback("tws_db_pool_waiting", "Threads waiting for a MySQL connection", "gauge",
+					[this]() { return (double)GetStats().waiting; });
+	r->add_callback("tws_db_pool_borrows_total", "MySQL connections handed out", "counter",
+					[this]() { return (double)GetStats().borrows; });
+	r->add_callback("tws_db_pool_wait_seconds_total", "Time spent waiting for MySQL connections", "counter",
+					[this]() { return GetStats().wait_us / 1e6; });
+	r->add_callback("tws_db_pool_max_wait_seconds", "Longest single wait for a MySQL connection", "gauge",
+					[this]() { return GetStats().max_wait_us / 1e6; });
+	r->add_callback("tws_db_pool_timeouts_total", "Borrows that gave up waiting for a connection", "counter",
+					[this]() { return (double)GetStats().timeouts; });
+	r->add_callback("tws_db_pool_failures_total", "Failed connects and pings", "counter",
+					[this]() { return (double)GetStats().failures; });
+	r->add_callback("tws_db_pool_reconnects_total", "Dead connections replaced on borrow", "counter",
+					[this]() { return (double)GetStats().reconnects; });
 }
 
 connection_pool::~connection_pool()
@@ -136,11 +394,12 @@ connection_pool::~connection_pool()
 
 connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool){
 	*SQL = connPool->GetConnection();
-	
+
 	conRAII = *SQL;
 	poolRAII = connPool;
+	brokenRAII = false;
 }
 
 connectionRAII::~connectionRAII(){
-	poolRAII->ReleaseConnection(conRAII);
-}
\ No newline at end of file
+	poolRAII->ReleaseConnection(conRAII, brokenRAII);
+}
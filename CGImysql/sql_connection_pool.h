@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <list>
+#include <map>
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
@@ -13,33 +14,95 @@
 
 using namespace std;
 
+/*
+弹性数据库连接池
+启动时只建立 MinConn 条连接，不够用时按需增长到 MaxConn
+后台维护线程每 MAINTAIN_INTERVAL_S 秒调用一次 Maintain()：关闭空闲超过 IDLE_TIMEOUT_MS 的多余连接，连接数不足 MinConn 时补齐
+借出前若连接已空闲超过 PING_AFTER_MS 先 ping 一次，失效的连接关闭后重新建立
+连接全部借出时最多等待 BORROW_TIMEOUT_MS，超时或数据库连不上时 GetConnection 返回 NULL，调用方按失败处理
+数据库短暂不可用只会让相关请求变慢或失败，不会让进程退出或永久卡住
+*/
+
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 //获取数据库连接
-	bool ReleaseConnection(MYSQL *conn); //释放连接
-	int GetFreeConn();					 //获取连接
+	static const int BORROW_TIMEOUT_MS = 2000;
+	static const int PING_AFTER_MS = 30000;
+	static const int IDLE_TIMEOUT_MS = 60000;
+	static const int MAINTAIN_INTERVAL_S = 5;
+
+	// 池的运行统计，供监控输出
+	struct stats
+	{
+		int total;				//已建立的连接数(含借出的)
+		int in_use;				//借出中的连接数
+		int idle;				//空闲连接数
+		int waiting;			//正在等待连接的线程数
+		long long borrows;		//成功借出次数
+		long long wait_us;		//借出时累计等待时间
+		long long max_wait_us;	//单次借出的最长等待时间
+		long long timeouts;		//等待超时次数
+		long long failures;		//建立连接或ping失败次数
+		long long reconnects;	//替换失效连接的次数
+	};
+
+	MYSQL *GetConnection();				 //获取数据库连接，失败返回NULL
+	// 释放连接；broken 为 true 或连接上最近的错误是客户端错误(2000起，连接已断开)时关闭它，不放回池中
+	bool ReleaseConnection(MYSQL *conn, bool broken = false);
+	int GetFreeConn();					 //获取空闲连接数
 	void DestroyPool();					 //销毁所有连接
+	// 关闭空闲过久的多余连接并补齐到 MinConn，由维护线程周期调用
+	void Maintain();
+	stats GetStats();
+	// conn 上 sql 对应的预处理语句，第一次使用时 prepare 并缓存，连接销毁时一并关闭；失败返回NULL
+	// 调用方必须持有(已借出) conn
+	MYSQL_STMT *GetStatement(MYSQL *conn, const string &sql);
 
 	//单例模式
 	static connection_pool *GetInstance();
 
-	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log); 
+	// MinConn 小于0时取 MaxConn 的四分之一(至少1条)
+	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log, int MinConn = -1);
 
 private:
 	connection_pool();
 	~connection_pool();
 
+	struct idle_conn
+	{
+		MYSQL *conn;
+		long long last_used_ms;
+	};
+
+	static void *maintainer(void *arg);
+	void RegisterMetrics();
+	// 建立一条新连接，失败计入 m_Failures 并返回NULL；在锁外调用
+	MYSQL *Connect();
+	// 关闭连接并丢弃其上的预处理语句，调用方不持有 lock
+	void Close(MYSQL *conn);
+	// 关闭一条借出中的失效连接并空出名额
+	void Discard(MYSQL *conn);
+
 	int m_MaxConn;  //最大连接数
+	int m_MinConn;  //最少保持的连接数
 	int m_CurConn;  //当前已使用的连接数
-	int m_FreeConn; //当前空闲的连接数
+	int m_TotalConn; //已建立及正在建立的连接数
+	int m_Waiting;  //等待连接的线程数
 	locker lock;
-	list<MYSQL *> connList; //连接池
-	sem reserve;
+	cond m_released;		  //有连接归还或名额空出
+	list<idle_conn> connList; //空闲连接，尾部是最近归还的
+	map<MYSQL *, map<string, MYSQL_STMT *> > m_statements; //每个连接上已准备好的语句，受lock保护
+	long long m_Borrows;
+	long long m_WaitUs;
+	long long m_MaxWaitUs;
+	long long m_Timeouts;
+	long long m_Failures;
+	long long m_Reconnects;
+	bool m_started; //维护线程和监控指标只在第一次 init 时启动
 
 public:
 	string m_url;			 //主机地址
-	string m_Port;		 //数据库端口号
+	int m_Port;				 //数据库端口号
 	string m_User;		 //登陆数据库用户名
 	string m_PassWord;	 //登陆数据库密码
 	string m_DatabaseName; //使用数据库名
@@ -51,9 +114,12 @@ class connectionRAII{
 public:
 	connectionRAII(MYSQL **con, connection_pool *connPool);
 	~connectionRAII();
-	
+	// 使用中发现连接已断开，析构时关闭而不是放回池中
+	void broken() { brokenRAII = true; }
+
 private:
 	MYSQL *conRAII;
+	bool brokenRAII;
 	connection_pool *poolRAII;
 };
 
@@ -1,5 +1,6 @@
 #include "DataManager.h"
 #include "../Util/StorageConfig.hpp"
+#include "../threadpool/task_executor.h"
 #include <json/json.h>
 #include <cstring>
 
@@ -41,6 +42,7 @@ namespace storage
         }
 
         need_persist_ = false;
+        persist_pending_ = false;
         InitLoad();
         need_persist_ = true;
     }
@@ -149,6 +151,29 @@ namespace storage
         return true;
     }
 
+    // 后台持久化
+    // Storage() 在执行时才取快照，所以排队期间的修改会被同一次写入带上
+    bool DataManager::StorageAsync()
+    {
+        bool expected = false;
+        if (!persist_pending_.compare_exchange_strong(expected, true))
+        {
+            return true;
+        }
+        bool posted = task_executor::get_instance()->post([this]()
+        {
+            persist_pending_ = false;
+            Storage();
+        });
+        if (!posted)
+        {
+            // 执行器未启动或队列已满，退化为同步写
+            persist_pending_ = false;
+            return Storage();
+        }
+        return true;
+    }
+
     // 插入数据
     bool DataManager::Insert(const StorageInfo &info)
     {
@@ -158,7 +183,7 @@ namespace storage
         table_[info.url_] = info;
         pthread_rwlock_unlock(&rwlock_);
 
-        if (need_persist_ && !Storage())
+        if (need_persist_ && !StorageAsync())
         {
             return false;
         }
@@ -172,7 +197,7 @@ namespace storage
         table_[info.url_] = info;
         pthread_rwlock_unlock(&rwlock_);
 
-        if (!Storage())
+        if (!StorageAsync())
         {
             return false;
         }
@@ -7,6 +7,7 @@
 #include <mutex>
 #include <vector>
 #include <ctime>
+#include <atomic>
 
 // 前向声明
 namespace Json {
@@ -39,6 +40,7 @@ namespace storage
         pthread_rwlock_t rwlock_;
         std::unordered_map<std::string, StorageInfo> table_;
         bool need_persist_;
+        std::atomic<bool> persist_pending_; // 已有一次后台持久化在排队
 
         static DataManager *instance_;
         static std::mutex instance_mutex_;
@@ -58,6 +60,8 @@ namespace storage
         // 数据操作方法
         bool InitLoad();
         bool Storage();
+        // 把持久化交给后台执行器，排队中的多次修改只落盘一次
+        bool StorageAsync();
         bool Insert(const StorageInfo &info);
         bool Update(const StorageInfo &info);
         bool GetOneByURL(const std::string &key, StorageInfo *info);
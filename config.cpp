@@ -4,7 +4,7 @@ Config::Config(){
     //端口号,默认9006
     PORT = 9006;
 
-    //日志写入方式，默认同步
+    //日志写入方式，默认同步，1异步，2异步二进制
     LOGWrite = 0;
 
     //触发组合模式,默认listenfd LT + connfd LT
@@ -28,13 +28,16 @@ Config::Config(){
     //关闭日志,默认不关闭
     close_log = 0;
 
+    //日志级别,默认0(debug)，运行中可通过/admin/log调整
+    log_level = 0;
+
     //并发模型,默认是proactor
     actor_model = 0;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:v:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -79,6 +82,11 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'v':
+        {
+            log_level = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
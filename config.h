@@ -40,6 +40,9 @@ public:
     //是否关闭日志
     int close_log;
 
+    //运行期最低日志级别
+    int log_level;
+
     //并发模型选择
     int actor_model;
 };
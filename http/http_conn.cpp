@@ -2,6 +2,9 @@
 #include <mysql/mysql.h>
 #include <fstream>
 
+#undef LOG_MODULE
+#define LOG_MODULE LOG_MOD_HTTP
+
 // 定义http响应的一些状态信息
 const char *ok_200_title = "OK";
 const char *error_400_title = "Bad Request";
@@ -10,27 +13,42 @@ const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_405_title = "Method Not Allowed";
+const char *error_405_form = "The request method is not supported for this resource.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The service is temporarily unavailable, please try again later.\n";
+// 会话Cookie名
+const char *SESSION_COOKIE = "tws_session";
+// 登录时缓存未命中而去查库的速率上限(次/秒)和突发量
+const int LOGIN_MISS_RATE = 100;
+const int LOGIN_MISS_BURST = 200;
 
 
-locker m_lock;
-map<string, string> users;
-
 void http_conn::initmysql_result(connection_pool *connPool)
 {
     // 先从连接池中取一个连接
     MYSQL *mysql = NULL;
     connectionRAII mysqlcon(&mysql, connPool);
+    // 数据库暂时不可用时缓存为空，登录未命中时再查库
+    if (!mysql)
+    {
+        LOG_ERROR("%s", "user table not loaded: no mysql connection");
+        return;
+    }
 
     // 在user表中检索username，passwd数据，浏览器端输入
     if (mysql_query(mysql, "SELECT username,passwd FROM user"))
     {
         LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        return;
     }
 
     // 从表中检索完整的结果集
     MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+        return;
 
     // 返回结果集中的列数
     int num_fields = mysql_num_fields(result);
@@ -38,13 +56,14 @@ void http_conn::initmysql_result(connection_pool *connPool)
     // 返回所有字段结构的数组
     MYSQL_FIELD *fields = mysql_fetch_fields(result);
 
-    // 从结果集中获取下一行，将对应的用户名和密码，存入map中
+    // 从结果集中获取下一行，将对应的用户名和密码，存入缓存中
     while (MYSQL_ROW row = mysql_fetch_row(result))
     {
         string temp1(row[0]);
         string temp2(row[1]);
-        users[temp1] = temp2;
+        user_cache::get_instance()->load(temp1, temp2);
     }
+    mysql_free_result(result);
 }
 
 // 对文件描述符设置非阻塞
@@ -96,6 +115,9 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
 
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
+int http_conn::m_resumefd = -1;
+locker http_conn::m_resume_lock;
+std::list<http_conn::resume_entry> http_conn::m_resume_list;
 
 // 关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -103,8 +125,10 @@ void http_conn::close_conn(bool real_close)
     if (real_close && (m_sockfd != -1))
     {
         printf("close %d\n", m_sockfd);
+        flight_recorder::get_instance()->record(FR_CONN_CLOSE, m_sockfd);
+        // 先注销再关fd，关闭后fd可能立刻被新连接复用；与定时器关闭重复时只计一次
+        conn_registry::get_instance()->on_close(m_sockfd, m_reg_gen);
         removefd(m_epollfd, m_sockfd);
-        ServerMetrics::get_instance().decrement_active_connections(); // 减少活跃连接数
         m_sockfd = -1;
         m_user_count--;
     }
@@ -116,6 +140,10 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 {
     m_sockfd = sockfd;
     m_address = addr;
+    // 新连接使用新的代数，旧连接遗留的协程恢复会被丢弃
+    m_conn_gen++;
+    m_resume_handle = nullptr;
+    m_reg_gen = conn_registry::get_instance()->generation(sockfd);
 
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
@@ -136,13 +164,13 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 // check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
     m_url = 0;
+    m_query = 0;
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
@@ -154,6 +182,14 @@ void http_conn::init()
     m_state = 0;
     timer_flag = 0;
     improv = 0;
+    m_enqueue_us = 0;
+    m_request_id = 0;
+    m_trace_id = 0;
+    m_trace_start_us = 0;
+    m_write_start_us = 0;
+    m_route = ROUTE_STATIC;
+    m_headers.clear();
+    m_set_cookie.clear();
     server_port_ = storage::Config::GetInstance()->GetServerPort();
     server_ip_ = storage::Config::GetInstance()->GetServerIp();
     download_prefix_ = storage::Config::GetInstance()->GetDownloadPrefix();
@@ -214,6 +250,8 @@ bool http_conn::read_once()
     {
         return false;
     }
+    begin_request();
+    trace_span span(m_trace_id, "read");
     int bytes_read = 0;
 
     // LT读取数据
@@ -228,6 +266,8 @@ bool http_conn::read_once()
             return false;
         }
 
+        conn_registry::get_instance()->add_bytes_in(m_sockfd, bytes_read);
+        conn_registry::get_instance()->set_state(m_sockfd, CONN_READING);
         return true;
     }
     // ET读数据
@@ -247,7 +287,9 @@ bool http_conn::read_once()
                 return false;
             }
             m_read_idx += bytes_read;
+            conn_registry::get_instance()->add_bytes_in(m_sockfd, bytes_read);
         }
+        conn_registry::get_instance()->set_state(m_sockfd, CONN_READING);
         return true;
     }
 }
@@ -308,11 +350,12 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if (strlen(m_url) == 1)
         strcat(m_url, "judge.html");
 
-    // 去掉 URL 中的查询参数部分
+    // 去掉 URL 中的查询参数部分，保留给需要参数的接口
     char *query_pos = strchr(m_url, '?');
     if (query_pos)
     {
         *query_pos = '\0';
+        m_query = query_pos + 1;
     }
     // 请求行处理完毕，将主状态机转移处理请求头
     m_check_state = CHECK_STATE_HEADER;
@@ -387,7 +430,7 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     }
     else
     {
-        LOG_INFO("oop! unknown header format: %s", text);
+        LOG_INFO_RL(10, 50, "oop! unknown header format: %s", text);
     }
 
     return NO_REQUEST;
@@ -492,7 +535,7 @@ http_conn::HTTP_CODE http_conn::process_read()
     {
         text = get_line();
         m_start_line = m_checked_idx;
-        LOG_INFO("%s", text);
+        LOG_INFO_RL(10, 50, "%s", text);
         // printf("got 1 http line: %s\n", text);
         // 主状态机的三种状态转移逻辑
         switch (m_check_state)
@@ -511,10 +554,10 @@ http_conn::HTTP_CODE http_conn::process_read()
             ret = parse_headers(text);
             if (ret == BAD_REQUEST)
                 return BAD_REQUEST;
-            // 完整解析GET请求后，跳转到报文响应函数
+            // 完整解析GET请求后，交给process_coro调用do_request
             else if (ret == GET_REQUEST)
             {
-                return do_request();
+                return GET_REQUEST;
             }
             break;
         }
@@ -523,7 +566,7 @@ http_conn::HTTP_CODE http_conn::process_read()
             // 解析消息体
             ret = parse_content(text);
             if (ret == GET_REQUEST)
-                return do_request();
+                return GET_REQUEST;
             // ⚠️ 关键修改：对于大文件，继续读取数据
             if (ret == NO_REQUEST && m_method == POST)
             {
@@ -539,7 +582,7 @@ http_conn::HTTP_CODE http_conn::process_read()
     }
     return NO_REQUEST;
 }
-http_conn::HTTP_CODE http_conn::do_request()
+co_task<http_conn::HTTP_CODE> http_conn::do_request()
 {
     // "doc_root"：网站根目录，文件夹内存放请求的资源和跳转的html文件
     // 将初始化的m_real_file赋值为网站根目录
@@ -558,6 +601,10 @@ http_conn::HTTP_CODE http_conn::do_request()
     m_is_api_response = false;
     m_api_response_content.clear();
     m_api_content_type.clear();
+
+    // 管理接口可以改日志级别、导出调用栈，只接受本机访问
+    if (strncmp(m_url, "/admin/", 7) == 0 && m_address.sin_addr.s_addr != htonl(INADDR_LOOPBACK))
+        co_return FORBIDDEN_REQUEST;
     
     // 优先处理API请求：/monitor
     if (strcmp(m_url, "/monitor") == 0) // 当请求路径是 /monitor 时
@@ -565,7 +612,7 @@ http_conn::HTTP_CODE http_conn::do_request()
         m_is_api_response = true;                                         // 标记为API响应
         m_api_response_content = ServerMetrics::get_instance().to_json(); // 获取JSON数据
         m_api_content_type = "application/json";                          // 设置Content-Type
-        return FILE_REQUEST;                                              // 返回 FILE_REQUEST，表示内容已在 m_api_response_content 中准备好
+        co_return FILE_REQUEST;                                              // 返回 FILE_REQUEST，表示内容已在 m_api_response_content 中准备好
     }
     
     // 添加文件列表API接口：/api/files
@@ -599,9 +646,145 @@ http_conn::HTTP_CODE http_conn::do_request()
         m_is_api_response = true;
         m_api_response_content = json_response;
         m_api_content_type = "application/json";
-        return FILE_REQUEST;
+        co_return FILE_REQUEST;
     }
     
+    // 当前会话：/api/session 返回登录的用户名，未登录时 user 为 null
+    else if (strcmp(m_url, "/api/session") == 0)
+    {
+        std::string user;
+        Json::Value root;
+        root["user"] = session_user(&user) ? Json::Value(user) : Json::Value();
+        storage::JsonUtil::Serialize(root, &m_api_response_content);
+        m_is_api_response = true;
+        m_api_content_type = "application/json";
+        co_return FILE_REQUEST;
+    }
+
+    // 注销：/api/logout 删除会话并让浏览器丢弃Cookie
+    // 只接受POST：SameSite=Lax 的Cookie会随跨站的GET导航发送，GET注销可以被其他网站触发
+    else if (strcmp(m_url, "/api/logout") == 0)
+    {
+        if (m_method != POST)
+            co_return METHOD_NOT_ALLOWED;
+        std::string token = cookie(SESSION_COOKIE);
+        if (!token.empty())
+            session_store::get_instance()->destroy(token);
+        m_set_cookie = std::string(SESSION_COOKIE) + "=; Path=/; Max-Age=0; HttpOnly; SameSite=Lax";
+        m_is_api_response = true;
+        m_api_response_content = "{\"logged_out\":true}";
+        m_api_content_type = "application/json";
+        co_return FILE_REQUEST;
+    }
+
+    // 运行期调整日志级别：/admin/log 查看，/admin/log/<模块|all>/<级别> 设置
+    else if (strncmp(m_url, "/admin/log", 10) == 0 && (m_url[10] == '\0' || m_url[10] == '/'))
+    {
+        if (m_url[10] == '/')
+        {
+            std::string arg = m_url + 11;
+            size_t slash = arg.find('/');
+            if (slash == std::string::npos ||
+                !Log::get_instance()->set_level(arg.substr(0, slash).c_str(), arg.substr(slash + 1).c_str()))
+                co_return BAD_REQUEST;
+        }
+        m_is_api_response = true;
+        m_api_response_content = Log::get_instance()->levels_to_json();
+        m_api_content_type = "application/json";
+        co_return FILE_REQUEST;
+    }
+
+    // 最近的结构化事件：/admin/flight
+    else if (strcmp(m_url, "/admin/flight") == 0)
+    {
+        m_is_api_response = true;
+        m_api_response_content = flight_recorder::get_instance()->to_json();
+        m_api_content_type = "application/json";
+        co_return FILE_REQUEST;
+    }
+
+    // 指标历史：/monitor/history?res=1s|10s|1m&format=json|bin
+    else if (strcmp(m_url, "/monitor/history") == 0)
+    {
+        std::string res = query_param("res");
+        int tier = metrics_history::parse_resolution(res.empty() ? NULL : res.c_str());
+        m_is_api_response = true;
+        if (tier < 0)
+        {
+            m_api_response_content = "{\"error\":\"res must be 1s, 10s or 1m\"}";
+            m_api_content_type = "application/json";
+        }
+        else if (query_param("format") == "bin")
+        {
+            m_api_response_content = metrics_history::get_instance()->to_binary(tier);
+            m_api_content_type = "application/octet-stream";
+        }
+        else
+        {
+            m_api_response_content = metrics_history::get_instance()->to_json(tier);
+            m_api_content_type = "application/json";
+        }
+        co_return FILE_REQUEST;
+    }
+
+    // 采样请求的处理片段：/admin/trace，?sample=N 调整采样率(每N个请求追踪一个，0关闭)
+    else if (strcmp(m_url, "/admin/trace") == 0)
+    {
+        m_is_api_response = true;
+        m_api_content_type = "application/json";
+        std::string sample = query_param("sample");
+        if (!sample.empty())
+        {
+            tracer::get_instance()->set_sample_every(atoi(sample.c_str()));
+            m_api_response_content = "{\"sample_every\":" + std::to_string(tracer::get_instance()->sample_every()) + "}";
+        }
+        else
+            m_api_response_content = tracer::get_instance()->to_chrome_json();
+        co_return FILE_REQUEST;
+    }
+
+    // 锁竞争统计：/admin/locks，?reset=1 清零；需 make LOCK_PROFILE=1 编译
+    else if (strcmp(m_url, "/admin/locks") == 0)
+    {
+        m_is_api_response = true;
+        m_api_content_type = "application/json";
+        if (query_param("reset") == "1")
+        {
+            lock_profiler::reset();
+            m_api_response_content = "{\"reset\":true}";
+        }
+        else
+            m_api_response_content = lock_profiler::to_json();
+        co_return FILE_REQUEST;
+    }
+
+    // CPU剖析：/admin/profile?seconds=N&hz=H，在独立线程上采样，不占用工作线程和后台执行器，输出需用 profsym 符号化
+    else if (strcmp(m_url, "/admin/profile") == 0)
+    {
+        std::string sec = query_param("seconds");
+        std::string freq = query_param("hz");
+        int seconds = sec.empty() ? 10 : atoi(sec.c_str());
+        int hz = freq.empty() ? 99 : atoi(freq.c_str());
+        m_is_api_response = true;
+        m_api_content_type = "text/plain";
+        m_api_response_content = co_await await_callback<std::string>([seconds, hz](callback_awaiter<std::string>::completion done)
+        {
+            cpu_profiler::get_instance()->profile_async(seconds, hz, std::move(done));
+        });
+        if (m_api_response_content.empty())
+            m_api_response_content = "profiler busy\n";
+        co_return FILE_REQUEST;
+    }
+
+    // Prometheus 抓取接口：/metrics
+    else if (strcmp(m_url, "/metrics") == 0)
+    {
+        m_is_api_response = true;
+        m_api_response_content = metrics_registry::get_instance()->scrape();
+        m_api_content_type = "text/plain; version=0.0.4";
+        co_return FILE_REQUEST;
+    }
+
     // 处理静态文件请求：/monitor.html
     else if (strcmp(m_url, "/monitor.html") == 0)
     {
@@ -613,13 +796,13 @@ http_conn::HTTP_CODE http_conn::do_request()
     // 处理下载请求
     if (std::string(m_url).find("/download/") != std::string::npos)
     {
-        return Download();
+        co_return co_await Download();
     }
 
     // 处理上传请求 (POST方法)
     if (m_method == POST && strcmp(m_url, "/upload") == 0)
     {
-        return Upload();
+        co_return co_await Upload();
     }
 
     // 处理cgi
@@ -635,66 +818,18 @@ http_conn::HTTP_CODE http_conn::do_request()
         strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
         free(m_url_real);
 
-        // 将用户名和密码提取出来
-        // user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
+        // 将用户名和密码提取出来，正文格式不对时直接拒绝
+        std::string name, password;
+        if (!parse_user_password(name, password))
+            co_return BAD_REQUEST;
 
+        HTTP_CODE cgi_ret = NO_REQUEST;
         if (*(p + 1) == '3')
-        {
-            // 如果是注册，先检测数据库中是否有重名的
-            // 没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        // 如果是登录，直接判断
-        // 若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
+            cgi_ret = co_await process_registration(name, password);
         else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-            {
-                sockaddr_in *peer_addr = get_address();
-                std::string client_ip = inet_ntoa(peer_addr->sin_addr);
-                int client_port = ntohs(peer_addr->sin_port);
-                LOG_INFO("User %s logged in from %s:%d", name, inet_ntoa(peer_addr->sin_addr), ntohs(peer_addr->sin_port));
-                // 构建重定向 URL
-                std::string welcome_url = "/welcome.html?ip=" + client_ip + "&port=" + std::to_string(client_port);
-                m_redirect_url = welcome_url; // 保存重定向的 URL
-
-                // 返回 302 重定向响应
-                return REDIRECT_REQUEST;
-            }
-            else
-                strcpy(m_url, "/logError.html");
-        }
+            cgi_ret = co_await process_login(name, password);
+        if (cgi_ret != NO_REQUEST)
+            co_return cgi_ret;
     }
     
     // 如果请求资源为/0,表示跳转注册界面
@@ -756,26 +891,127 @@ http_conn::HTTP_CODE http_conn::do_request()
     // 如果是API响应，到这里就可以直接返回了，跳过文件处理部分
     if (m_is_api_response)
     {
-        return FILE_REQUEST;
+        co_return FILE_REQUEST;
     }
     
     // 通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体中
     // 失败返回NO_RESOURCE状态，表示资源不存在
     if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_RESOURCE;
+        co_return NO_RESOURCE;
     // 判断文件的权限，是否可读，不可读则返回FORBIDDEN_REQUEST状态
     if (!(m_file_stat.st_mode & S_IROTH))
-        return FORBIDDEN_REQUEST;
+        co_return FORBIDDEN_REQUEST;
     // 判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误
     if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
+        co_return BAD_REQUEST;
 
     int fd = open(m_real_file, O_RDONLY);
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
-    return FILE_REQUEST;
+    co_return FILE_REQUEST;
+}
+
+// 从POST正文中提取用户名和密码
+// user=123&password=123
+bool http_conn::parse_user_password(std::string &name, std::string &password)
+{
+    // 正文可能为空或被篡改，取子串前先校验格式
+    size_t amp = m_string.find('&');
+    if (m_string.compare(0, 5, "user=") != 0 || amp == std::string::npos ||
+        m_string.compare(amp, 10, "&password=") != 0)
+        return false;
+    name = m_string.substr(5, amp - 5);
+    password = m_string.substr(amp + 10);
+    return true;
+}
+
+// 注册：先检测是否有重名的，没有重名的再插入数据库
+// 数据库插入在后台执行器中进行，期间释放工作线程
+co_task<http_conn::HTTP_CODE> http_conn::process_registration(std::string name, std::string password)
+{
+    // 用户名已存在或正在被其他请求注册
+    if (!user_cache::get_instance()->begin_register(name))
+    {
+        strcpy(m_url, "/registerError.html");
+        co_return NO_REQUEST;
+    }
+    // 数据库熔断中，立即失败，不进入写入队列
+    if (!circuit_breaker::get_instance(DEP_MYSQL)->allow())
+    {
+        user_cache::get_instance()->end_register(name, password, false);
+        co_return SERVICE_UNAVAILABLE;
+    }
+
+    // 交给注册写入线程与同时到达的注册合并写库，等待期间不占用任何线程
+    bool ok = co_await await_callback<bool>([name, password](callback_awaiter<bool>::completion done)
+    {
+        registration_writer::get_instance()->submit(name, password, [name, password, done](bool ok)
+        {
+            // 在这里结束登记，连接在等待期间关闭、协程不再恢复时也不会遗留"注册中"状态
+            user_cache::get_instance()->end_register(name, password, ok);
+            done(ok);
+        });
+    });
+
+    if (ok)
+        strcpy(m_url, "/log.html");
+    else
+        strcpy(m_url, "/registerError.html");
+    co_return NO_REQUEST;
 }
 
+// 登录：若浏览器端输入的用户名和密码在表中可以查找到，重定向到欢迎页
+co_task<http_conn::HTTP_CODE> http_conn::process_login(std::string name, std::string password)
+{
+    user_cache *cache = user_cache::get_instance();
+    bool ok = cache->check(name, password);
+    if (!ok && !cache->contains(name) && !cache->known_missing(name))
+    {
+        // 只有要查库时才受熔断影响，数据库故障期间缓存中的用户照常登录
+        if (!circuit_breaker::get_instance(DEP_MYSQL)->allow())
+            co_return SERVICE_UNAVAILABLE;
+        // 随机用户名每次都不同，负缓存挡不住，查库次数另外限速
+        static log_rate_limiter miss_limiter(LOGIN_MISS_RATE, LOGIN_MISS_BURST);
+        long long suppressed = 0;
+        if (!miss_limiter.allow(&suppressed))
+        {
+            LOG_WARN_RL(1, 1, "%s", "login lookups rate limited");
+            co_return SERVICE_UNAVAILABLE;
+        }
+        // 缓存里没有这个用户(例如由其他实例直接写入了数据库)，异步查库，期间不占用任何线程
+        ok = co_await await_callback<bool>([name, password](callback_awaiter<bool>::completion done)
+        {
+            std::vector<std::string> params(1, name);
+            async_mysql::get_instance()->query("SELECT passwd FROM user WHERE username = ?", params,
+                                               [name, password, done](bool ok, const async_mysql::rows &result)
+            {
+                if (ok && !result.empty())
+                    user_cache::get_instance()->load(name, result[0][0]);
+                else if (ok)
+                    user_cache::get_instance()->mark_missing(name);
+                done(ok && !result.empty() && result[0][0] == password);
+            });
+        });
+    }
+    if (ok)
+    {
+        sockaddr_in *peer_addr = get_address();
+        std::string client_ip = inet_ntoa(peer_addr->sin_addr);
+        int client_port = ntohs(peer_addr->sin_port);
+        LOG_INFO("User %s logged in from %s:%d", name.c_str(), client_ip.c_str(), client_port);
+        // 之后的请求凭Cookie查一次会话表即可确认身份，不再核对密码
+        m_set_cookie = std::string(SESSION_COOKIE) + "=" + session_store::get_instance()->create(name) +
+                       "; Path=/; Max-Age=" + std::to_string(session_store::TTL_S) + "; HttpOnly; SameSite=Lax";
+        // 构建重定向 URL
+        std::string welcome_url = "/welcome.html?ip=" + client_ip + "&port=" + std::to_string(client_port);
+        m_redirect_url = welcome_url; // 保存重定向的 URL
+
+        // 返回 302 重定向响应
+        co_return REDIRECT_REQUEST;
+    }
+    strcpy(m_url, "/logError.html");
+    co_return NO_REQUEST;
+}
 
 void http_conn::unmap()
 {
@@ -784,10 +1020,26 @@ void http_conn::unmap()
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    // 下载时解压出的临时文件交给后台删除，文件名按请求唯一，不会删到别的请求正在用的文件
+    // 仍然防御性地检查一次，登记过的正式文件不删
+    if (!m_temp_file_path.empty())
+    {
+        std::string path = m_temp_file_path;
+        m_temp_file_path.clear();
+        auto cleanup = [path]()
+        {
+            storage::StorageInfo info;
+            if (!storage::DataManager::GetInstance()->GetOneByStoragePath(path, &info))
+                remove(path.c_str());
+        };
+        if (!task_executor::get_instance()->post(cleanup))
+            cleanup();
+    }
 }
 bool http_conn::write()
 {
     int temp = 0;
+    trace_span span(m_trace_id, "write");
 
     if (bytes_to_send == 0)
     {
@@ -830,21 +1082,25 @@ bool http_conn::write()
                 modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
                 return true;
             }
+            flight_recorder::get_instance()->record(FR_ERROR, m_sockfd, errno, bytes_have_send, "writev failed");
             unmap();
             return false;
         }
 
         bytes_have_send += temp;
         bytes_to_send -= temp;
+        conn_registry::get_instance()->add_bytes_out(m_sockfd, temp);
 
         // 先判断是否全部发送完，再处理分块
         if (bytes_to_send <= 0)
         {
+            record_response_sent();
             unmap();
             modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
 
             if (m_linger)
             {
+                conn_registry::get_instance()->set_state(m_sockfd, CONN_IDLE);
                 init();
                 return true;
             }
@@ -877,6 +1133,102 @@ bool http_conn::write()
         }
     }
 }
+int http_conn::route_of() const
+{
+    if (!m_url)
+        return ROUTE_STATIC;
+    if (strncmp(m_url, "/monitor", 8) == 0 && strcmp(m_url, "/monitor.html") != 0)
+        return ROUTE_MONITOR;
+    if (strcmp(m_url, "/metrics") == 0 || strncmp(m_url, "/admin/", 7) == 0)
+        return ROUTE_MONITOR;
+    if (strcmp(m_url, "/api/files") == 0)
+        return ROUTE_FILES;
+    if (strstr(m_url, "/download/"))
+        return ROUTE_DOWNLOAD;
+    if (m_method == POST && strcmp(m_url, "/upload") == 0)
+        return ROUTE_UPLOAD;
+    if (m_method == POST && (m_url[1] == '2' || m_url[1] == '3'))
+        return ROUTE_AUTH;
+    if (strcmp(m_url, "/api/session") == 0 || strcmp(m_url, "/api/logout") == 0)
+        return ROUTE_AUTH;
+    return ROUTE_STATIC;
+}
+
+void http_conn::begin_request()
+{
+    if (m_request_id != 0)
+        return;
+    tracer *t = tracer::get_instance();
+    m_request_id = t->next_request_id();
+    if (t->sample())
+    {
+        m_trace_id = m_request_id;
+        m_trace_start_us = latency_stats::now_us();
+    }
+}
+
+std::string http_conn::cookie(const char *name)
+{
+    std::unordered_map<std::string, std::string>::iterator it = m_headers.find("Cookie");
+    if (it == m_headers.end())
+        return "";
+    // name1=value1; name2=value2
+    const std::string &s = it->second;
+    size_t name_len = strlen(name);
+    size_t pos = 0;
+    while (pos < s.size())
+    {
+        while (pos < s.size() && s[pos] == ' ')
+            ++pos;
+        size_t end = s.find(';', pos);
+        if (end == std::string::npos)
+            end = s.size();
+        if (end - pos > name_len && s.compare(pos, name_len, name) == 0 && s[pos + name_len] == '=')
+            return s.substr(pos + name_len + 1, end - pos - name_len - 1);
+        pos = end + 1;
+    }
+    return "";
+}
+
+bool http_conn::session_user(std::string *user)
+{
+    std::string token = cookie(SESSION_COOKIE);
+    return !token.empty() && session_store::get_instance()->validate(token, user);
+}
+
+std::string http_conn::query_param(const char *key) const
+{
+    if (!m_query)
+        return "";
+    size_t key_len = strlen(key);
+    const char *p = m_query;
+    while (*p)
+    {
+        const char *end = strchr(p, '&');
+        if (!end)
+            end = p + strlen(p);
+        if ((size_t)(end - p) > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=')
+            return std::string(p + key_len + 1, end);
+        p = *end ? end + 1 : end;
+    }
+    return "";
+}
+
+void http_conn::record_response_sent()
+{
+    if (m_write_start_us == 0)
+        return;
+    long long now = latency_stats::now_us();
+    if (m_trace_id)
+    {
+        tracer::get_instance()->record(m_trace_id, "send_response", m_write_start_us, now);
+        tracer::get_instance()->record(m_trace_id, "request", m_trace_start_us, now);
+    }
+    latency_stats::get_instance()->record_stage(STAGE_WRITE, now - m_write_start_us);
+    latency_stats::get_instance()->record_route(m_route, now - m_req_start_us);
+    m_write_start_us = 0;
+}
+
 bool http_conn::add_response(const char *format, ...)
 {
     // 如果写入内容超过m_write_buf大小则报错
@@ -899,7 +1251,7 @@ bool http_conn::add_response(const char *format, ...)
     // 情况可变参列表
     va_end(arg_list);
 
-    LOG_INFO("request:%s", m_write_buf);
+    LOG_INFO_RL(10, 50, "request:%s", m_write_buf);
     return true;
 }
 // 添加状态行
@@ -910,7 +1262,7 @@ bool http_conn::add_status_line(int status, const char *title)
 // 添加消息报头，具体的添加文本长度、连接状态和空行
 bool http_conn::add_headers(int content_len)
 {
-    return add_content_length(content_len) && add_linger() &&
+    return add_content_length(content_len) && add_linger() && add_set_cookie() &&
            add_blank_line();
 }
 // 添加Content-Length，表示响应报文的长度
@@ -933,6 +1285,13 @@ bool http_conn::add_linger()
 {
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+// 登录、注销时下发会话Cookie
+bool http_conn::add_set_cookie()
+{
+    if (m_set_cookie.empty())
+        return true;
+    return add_response("Set-Cookie: %s\r\n", m_set_cookie.c_str());
+}
 // 添加空行
 bool http_conn::add_blank_line()
 {
@@ -953,6 +1312,20 @@ bool http_conn::process_write(HTTP_CODE ret)
         if (!add_content(error_500_form))
             return false;
         break;
+    case SERVICE_UNAVAILABLE:
+        add_status_line(503, error_503_title);
+        add_response("Retry-After: %d\r\n", circuit_breaker::OPEN_MS / 1000);
+        add_headers(strlen(error_503_form));
+        if (!add_content(error_503_form))
+            return false;
+        break;
+    case METHOD_NOT_ALLOWED:
+        add_status_line(405, error_405_title);
+        add_response("Allow: POST\r\n");
+        add_headers(strlen(error_405_form));
+        if (!add_content(error_405_form))
+            return false;
+        break;
     case BAD_REQUEST:
         add_status_line(404, error_404_title);
         add_headers(strlen(error_404_form));
@@ -1062,6 +1435,7 @@ bool http_conn::process_write(HTTP_CODE ret)
         add_status_line(302, "Found"); // 设置 302 状态码
         add_content_length(0);         // 重定向通常没有正文内容
         add_linger();
+        add_set_cookie();
         add_response("Location: %s\r\n", m_redirect_url.c_str()); // Location 头
         add_blank_line();                                         // 空行
         m_iv[0].iov_base = m_write_buf;
@@ -1080,16 +1454,50 @@ bool http_conn::process_write(HTTP_CODE ret)
 }
 void http_conn::process()
 {
+    // 没有阻塞操作时协程会一直执行到结束，与同步处理完全一致
+    process_coro();
+}
+
+co_detached http_conn::process_coro()
+{
+    m_coro_root = co_await co_self{};
+    long long parse_start = latency_stats::now_us();
     // NO_REQUEST，表示请求不完整，需要继续接收请求数据
     HTTP_CODE read_ret = process_read();
     if (read_ret == NO_REQUEST)
     {
         // 注册并监听读事件
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        return;
+        co_return;
+    }
+    m_req_start_us = latency_stats::now_us();
+    m_route = route_of();
+    conn_registry::get_instance()->add_request(m_sockfd);
+    conn_registry::get_instance()->set_state(m_sockfd, CONN_PROCESSING);
+    latency_stats::get_instance()->record_stage(STAGE_PARSE, m_req_start_us - parse_start);
+    tracer::get_instance()->record(m_trace_id, "parse", parse_start, m_req_start_us);
+    flight_recorder::get_instance()->record(FR_REQUEST_START, m_sockfd, m_request_id, 0, m_url ? m_url : "");
+    // 报文完整，生成响应，期间可能挂起
+    if (read_ret == GET_REQUEST)
+    {
+        read_ret = co_await do_request();
+        long long handled = latency_stats::now_us();
+        latency_stats::get_instance()->record_stage(STAGE_HANDLER, handled - m_req_start_us);
+        tracer::get_instance()->record(m_trace_id, "do_request", m_req_start_us, handled);
     }
     // 调用process_write完成报文相应
-    bool write_ret = process_write(read_ret);
+    bool write_ret;
+    {
+        trace_span span(m_trace_id, "process_write");
+        write_ret = process_write(read_ret);
+    }
+    if (write_ret)
+    {
+        ServerMetrics::get_instance().record_response_bytes(bytes_to_send);
+        conn_registry::get_instance()->set_state(m_sockfd, CONN_WRITING);
+    }
+    m_write_start_us = latency_stats::now_us();
+    flight_recorder::get_instance()->record(FR_REQUEST_END, m_sockfd, read_ret, m_write_start_us - m_req_start_us);
     if (!write_ret)
     {
         close_conn();
@@ -1098,6 +1506,38 @@ void http_conn::process()
     modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
 }
 
+void http_conn::post_resume(const resume_entry &entry)
+{
+    m_resume_lock.lock();
+    m_resume_list.push_back(entry);
+    m_resume_lock.unlock();
+
+    uint64_t one = 1;
+    ::write(m_resumefd, &one, sizeof(one));
+}
+
+void http_conn::take_resumes(std::list<resume_entry> &entries)
+{
+    m_resume_lock.lock();
+    entries.splice(entries.end(), m_resume_list);
+    m_resume_lock.unlock();
+}
+
+bool http_conn::accept_resume(unsigned gen, std::coroutine_handle<> handle)
+{
+    if (gen != m_conn_gen || m_sockfd == -1)
+        return false;
+    m_resume_handle = handle;
+    return true;
+}
+
+void http_conn::resume()
+{
+    std::coroutine_handle<> handle = m_resume_handle;
+    m_resume_handle = nullptr;
+    handle.resume();
+}
+
 // 辅助函数，根据文件扩展名获取 Content-Type
 const char *http_conn::get_file_content_type(const char *file_path)
 {
@@ -1127,7 +1567,7 @@ const char *http_conn::get_file_content_type(const char *file_path)
     return "application/octet-stream"; // 默认二进制流
 }
 
-http_conn::HTTP_CODE http_conn::Download()
+co_task<http_conn::HTTP_CODE> http_conn::Download()
 {
     // 1. 获取客户端请求的资源路径
     std::string resource_path = m_url;
@@ -1135,9 +1575,14 @@ http_conn::HTTP_CODE http_conn::Download()
 
     // 2. 根据资源路径，获取StorageInfo
     storage::StorageInfo info;
-    if (!storage::DataManager::GetInstance()->GetOneByURL(resource_path, &info))
+    bool found;
     {
-        return NO_RESOURCE;
+        trace_span span(m_trace_id, "data_manager_lookup");
+        found = storage::DataManager::GetInstance()->GetOneByURL(resource_path, &info);
+    }
+    if (!found)
+    {
+        co_return NO_RESOURCE;
     }
 
     std::string download_path = info.storage_path_;
@@ -1145,40 +1590,52 @@ http_conn::HTTP_CODE http_conn::Download()
     // 3. 如果是压缩文件，需要解压缩
     if (info.storage_path_.find(storage::Config::GetInstance()->GetDeepStorageDir()) != std::string::npos)
     {
-        storage::FileUtil fu(info.storage_path_);
-        download_path = storage::Config::GetInstance()->GetLowStorageDir() +
+        // 每个请求解压到自己的临时文件(fd+连接代数)，并发下载同一文件时互不覆盖，
+        // 也不会被另一个请求结束时的后台删除删掉
+        download_path = storage::Config::GetInstance()->GetLowStorageDir() + ".dl-" +
+                        std::to_string(m_sockfd) + "-" + std::to_string(m_conn_gen) + "-" +
                         std::string(download_path.begin() + download_path.find_last_of('/') + 1, download_path.end());
 
-        // 创建临时目录
-        storage::FileUtil dirCreate(storage::Config::GetInstance()->GetLowStorageDir());
-        dirCreate.CreateDirectory();
-
-        // 解压缩文件
-        if (!fu.UnCompress(download_path))
+        // 创建临时目录并解压缩文件，放到后台执行
+        std::string packed_path = info.storage_path_;
+        uint64_t trace_id = m_trace_id;
+        bool unpacked = co_await offload([packed_path, download_path, trace_id]()
         {
-            return INTERNAL_ERROR;
+            trace_span span(trace_id, "decompress");
+            storage::FileUtil dirCreate(storage::Config::GetInstance()->GetLowStorageDir());
+            dirCreate.CreateDirectory();
+            storage::FileUtil fu(packed_path);
+            std::string target = download_path;
+            return fu.UnCompress(target);
+        });
+        // 解压失败也可能留下半个文件，响应发送完后在 unmap() 中一并删除
+        m_temp_file_path = download_path;
+        if (!unpacked)
+        {
+            co_return INTERNAL_ERROR;
         }
     }
 
     // 4. 检查文件是否存在
+    trace_span map_span(m_trace_id, "open_mmap");
     storage::FileUtil fu(download_path);
     if (!fu.Exists())
     {
-        return NO_RESOURCE;
+        co_return NO_RESOURCE;
     }
 
     // 5. 打开文件
     int fd = open(download_path.c_str(), O_RDONLY);
     if (fd == -1)
     {
-        return INTERNAL_ERROR;
+        co_return INTERNAL_ERROR;
     }
 
     // 6. 获取文件信息
     if (fstat(fd, &m_file_stat) < 0)
     {
         close(fd);
-        return INTERNAL_ERROR;
+        co_return INTERNAL_ERROR;
     }
 
     // 7. 映射文件到内存
@@ -1187,22 +1644,16 @@ http_conn::HTTP_CODE http_conn::Download()
 
     if (m_file_address == MAP_FAILED)
     {
-        return INTERNAL_ERROR;
+        co_return INTERNAL_ERROR;
     }
 
     // 8. 设置响应参数
     m_is_api_response = false;
     m_etag = GetETag(info);
 
-    // 9. 如果是临时解压缩的文件，标记为需要删除
-    if (download_path != info.storage_path_)
-    {
-        // 可以在响应完成后删除临时文件
-        // 这里先记录路径，在 unmap() 中处理
-        m_temp_file_path = download_path;
-    }
+    // 9. 临时解压缩的文件已在第3步记录，响应完成后在 unmap() 中删除
 
-    return FILE_REQUEST;
+    co_return FILE_REQUEST;
 }
 
 std::string http_conn::GetETag(const storage::StorageInfo &info)
@@ -1217,20 +1668,20 @@ std::string http_conn::GetETag(const storage::StorageInfo &info)
     return etag;
 }
 
-http_conn::HTTP_CODE http_conn::Upload()
+co_task<http_conn::HTTP_CODE> http_conn::Upload()
 {
     printf("m_method: %d, m_url: %s\n", m_method, m_url);
     printf("m_upload_filename: %s, m_upload_storage_type: %s\n", m_upload_filename.c_str(), m_upload_storage_type.c_str());
     // 1. 检查是否有文件名和存储类型
     if (m_upload_filename.empty() || m_upload_storage_type.empty())
     {
-        return BAD_REQUEST;
+        co_return BAD_REQUEST;
     }
 
     // 2. 检查请求体是否存在
     if (m_string.empty() || m_content_length == 0)
     {
-        return BAD_REQUEST;
+        co_return BAD_REQUEST;
     }
 
     // 3. 确定存储路径
@@ -1245,52 +1696,62 @@ http_conn::HTTP_CODE http_conn::Upload()
     }
     else
     {
-        return BAD_REQUEST;
+        co_return BAD_REQUEST;
     }
 
     printf("Storage path: %s\n", storage_path.c_str());
 
-    // 4. 创建存储目录
-    storage::FileUtil dirCreate(storage_path);
-    if (!dirCreate.CreateDirectory())
+    // 4~7 的磁盘写入、压缩和登记都放到后台执行，请求体移交给后台任务
+    std::shared_ptr<std::string> body = std::make_shared<std::string>(std::move(m_string));
+    std::string filename = m_upload_filename;
+    std::string storage_type = m_upload_storage_type;
+    long content_length = m_content_length;
+    uint64_t trace_id = m_trace_id;
+    HTTP_CODE ret = co_await offload([storage_path, filename, storage_type, body, content_length, trace_id]() mutable -> HTTP_CODE
     {
-        printf("Failed to create storage directory: %s\n", storage_path.c_str());
-        return INTERNAL_ERROR;
-    }
+        trace_span span(trace_id, "upload_store");
+        // 4. 创建存储目录
+        storage::FileUtil dirCreate(storage_path);
+        if (!dirCreate.CreateDirectory())
+        {
+            printf("Failed to create storage directory: %s\n", storage_path.c_str());
+            return INTERNAL_ERROR;
+        }
 
-    // 5. 完整的文件路径
-    storage_path += m_upload_filename;
+        // 5. 完整的文件路径
+        storage_path += filename;
 
-    // 6. 根据存储类型处理文件
-    storage::FileUtil fu(storage_path);
-    bool success = false;
+        // 6. 根据存储类型处理文件
+        storage::FileUtil fu(storage_path);
+        bool success = false;
 
-    if (m_upload_storage_type == "low")
-    {
-        // 普通存储：直接写入文件
-        success = fu.SetContent(m_string.c_str(), m_content_length);
-    }
-    else if (m_upload_storage_type == "deep")
-    {
-        // 压缩存储：压缩后写入
-        success = fu.Compress(m_string, storage::Config::GetInstance()->GetBundleFormat());
-    }
-    printf("File upload success: %d\n", success);
-    if (!success)
-    {
-        return INTERNAL_ERROR;
-    }
+        if (storage_type == "low")
+        {
+            // 普通存储：直接写入文件
+            success = fu.SetContent(body->c_str(), content_length);
+        }
+        else if (storage_type == "deep")
+        {
+            // 压缩存储：压缩后写入
+            success = fu.Compress(*body, storage::Config::GetInstance()->GetBundleFormat());
+        }
+        printf("File upload success: %d\n", success);
+        if (!success)
+        {
+            return INTERNAL_ERROR;
+        }
 
-    // 7. 添加到数据管理模块
-    storage::StorageInfo info;
-    info.NewStorageInfo(storage_path);
-    
-    if (!storage::DataManager::GetInstance()->Insert(info))
-    {
-        // 如果数据库插入失败，删除已创建的文件
-        remove(storage_path.c_str());
-        return INTERNAL_ERROR;
-    }
+        // 7. 添加到数据管理模块
+        storage::StorageInfo info;
+        info.NewStorageInfo(storage_path);
 
-    return FILE_REQUEST;
-}
+        if (!storage::DataManager::GetInstance()->Insert(info))
+        {
+            // 如果数据库插入失败，删除已创建的文件
+            remove(storage_path.c_str());
+            return INTERNAL_ERROR;
+        }
+        return FILE_REQUEST;
+    });
+    co_return ret;
+}
\ No newline at end of file
@@ -21,15 +21,30 @@
 #include <sys/uio.h>
 #include <map>
 #include <unordered_map>
+#include <list>
 #include <evhttp.h>
 #include "../Util/base64.h" // 来自 cpp-base64 库
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/registration_writer.h"
+#include "../CGImysql/async_mysql.h"
+#include "../CGImysql/circuit_breaker.h"
+#include "user_cache.h"
+#include "session_store.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
 #include "../metrics/metrics.h"
+#include "../metrics/flight_recorder.h"
+#include "../metrics/latency.h"
+#include "../metrics/connections.h"
+#include "../metrics/history.h"
+#include "../metrics/trace.h"
+#include "../metrics/profiler.h"
+#include "../lock/lock_profiler.h"
 #include "../Util/StorageConfig.hpp"
 #include "../Storage/DataManager.h"
+#include "../threadpool/task_executor.h"
+#include "../threadpool/coroutine.h"
 
 class http_conn
 {
@@ -74,6 +89,8 @@ public:
         CLOSED_CONNECTION,
         REDIRECT_REQUEST,
          REQUEST_ENTITY_TOO_LARGE, // 413 请求实体过大
+        SERVICE_UNAVAILABLE,      // 503 依赖的服务熔断中
+        METHOD_NOT_ALLOWED,       // 405 接口只接受POST
     };
     // 从状态机状态
     enum LINE_STATUS
@@ -84,7 +101,7 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_conn_gen(0) {}
     ~http_conn() {}
 
 public:
@@ -105,10 +122,66 @@ public:
     void initmysql_result(connection_pool *connPool);
     int timer_flag;
     int improv;
+    long long m_enqueue_us; // 进入线程池队列的时间，用于统计排队耗时
+    uint64_t m_request_id;  // 当前请求的ID，0表示还未开始
+    uint64_t m_trace_id;    // 被采样追踪时等于m_request_id，否则为0
+    // 请求的第一个事件(入队或读取)时分配请求ID并决定是否采样，重复调用无副作用
+    void begin_request();
+
+    // 协程挂起/恢复
+    // 挂起的请求在阻塞操作完成后进入恢复队列，并通过 m_resumefd(eventfd) 通知事件循环
+    struct resume_entry
+    {
+        http_conn *conn;
+        unsigned gen;
+        std::coroutine_handle<> handle; // 需要恢复的(最内层)协程
+        std::coroutine_handle<> root;   // 顶层process_coro协程，丢弃时销毁它
+    };
+    // 由执行器线程调用，登记一个待恢复的协程
+    static void post_resume(const resume_entry &entry);
+    // 由事件循环调用，取出全部待恢复的协程
+    static void take_resumes(std::list<resume_entry> &entries);
+    // 事件循环确认连接仍是挂起时的那个连接，返回false表示连接已关闭或被复用
+    bool accept_resume(unsigned gen, std::coroutine_handle<> handle);
+    bool resumable() const { return (bool)m_resume_handle; }
+    // 工作线程恢复挂起的请求
+    void resume();
 
 private:
     void init();
-    // 从m_read_buf读取，并处理请求报文
+    // 请求处理协程，阻塞操作会挂起它并释放当前线程
+    co_detached process_coro();
+    // 把阻塞操作交给后台执行器，完成后由事件循环调度回线程池继续执行
+    template <typename F>
+    offload_awaiter<F> offload(F fn)
+    {
+        resume_entry entry = make_resume_entry();
+        return offload_awaiter<F>(std::move(fn), [entry](std::coroutine_handle<> h) mutable
+                                  {
+                                      entry.handle = h;
+                                      http_conn::post_resume(entry);
+                                  });
+    }
+    // 等待以回调通知完成的操作，完成后同样由事件循环调度回线程池继续执行
+    template <typename T>
+    callback_awaiter<T> await_callback(typename callback_awaiter<T>::starter start)
+    {
+        resume_entry entry = make_resume_entry();
+        return callback_awaiter<T>(std::move(start), [entry](std::coroutine_handle<> h) mutable
+                                   {
+                                       entry.handle = h;
+                                       http_conn::post_resume(entry);
+                                   });
+    }
+    resume_entry make_resume_entry() const
+    {
+        resume_entry entry;
+        entry.conn = const_cast<http_conn *>(this);
+        entry.gen = m_conn_gen;
+        entry.root = m_coro_root;
+        return entry;
+    }
+    // 从m_read_buf读取，并处理请求报文，报文完整时返回GET_REQUEST
     HTTP_CODE process_read();
     // 向m_write_buf写入响应报文数据
     bool process_write(HTTP_CODE ret);
@@ -121,13 +194,23 @@ private:
         // 新增一个专门处理文件上传逻辑的私有方法
     HTTP_CODE handle_file_upload(const char* file_content, size_t content_len);
     // 生成响应报文
-    HTTP_CODE do_request();
+    co_task<HTTP_CODE> do_request();
     // m_start_line是已经解析的字符
     // get_line用于将指针向后偏移，指向未处理的字符
     char *get_line() { return m_read_buf + m_start_line; };
     // 从状态机读取一行，分析是请求报文的哪一部分
     LINE_STATUS parse_line();
     void unmap();
+    // 按URL划分路由分类，用于延迟统计
+    int route_of() const;
+    // 取查询参数 key 的值，不做URL解码，不存在时返回空串
+    std::string query_param(const char *key) const;
+    // 取请求 Cookie 中 name 的值，不存在时返回空串
+    std::string cookie(const char *name);
+    // 请求带有效会话时返回 true，user 为登录的用户名
+    bool session_user(std::string *user);
+    // 响应全部写出后记录写阶段和路由总耗时
+    void record_response_sent();
     // 根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
     bool add_response(const char *format, ...);
     bool add_content(const char *content);
@@ -138,15 +221,27 @@ private:
 
     bool add_content_length(int content_length);
     bool add_linger();
+    bool add_set_cookie();
     bool add_blank_line();
 
 public:
     static int m_epollfd;
     static int m_user_count;
-    MYSQL *mysql;
+    static int m_resumefd;
     int m_state; // 读为0, 写为1
 
 private:
+    static locker m_resume_lock;
+    static std::list<resume_entry> m_resume_list;
+    unsigned m_conn_gen;                     // 连接代数，每次init递增，用于识别过期的恢复
+    unsigned m_reg_gen;                      // 连接登记表中的接入代数，关闭时带上
+    std::coroutine_handle<> m_resume_handle; // 等待工作线程恢复的协程
+    std::coroutine_handle<> m_coro_root;     // 当前请求的顶层协程
+    long long m_req_start_us;                // 请求报文接收完整的时间
+    long long m_write_start_us;              // 响应生成完毕的时间，0表示没有待统计的响应
+    int m_route;                             // 请求所属的路由分类
+    long long m_trace_start_us;              // 被采样请求的开始时间
+
     int m_sockfd;
     sockaddr_in m_address;
     // 存储读取的请求报文数据
@@ -171,8 +266,10 @@ private:
     // 存储读取文件的名称
     char m_real_file[FILENAME_LEN];
     char *m_url;
+    char *m_query; // URL 中 ? 之后的查询参数，没有时为NULL
     std::unordered_map<std::string, std::string> m_headers;
     std::string m_redirect_url; // 重定向URL
+    std::string m_set_cookie;   // 响应的 Set-Cookie 值，为空时不输出
     char *m_version;
     char *m_host;
     long m_content_length;
@@ -225,11 +322,13 @@ public:
 
     HTTP_CODE handle_static_file_request(const std::string &base_path, int len, const char *p);
 
-    void parse_user_password(std::string &name, std::string &password);
-    HTTP_CODE process_registration(const std::string &name, const std::string &password);
-    HTTP_CODE process_login(const std::string &name, const std::string &password);
-    HTTP_CODE Download();
-    HTTP_CODE Upload();
+    // 正文不是 user=...&password=... 格式时返回false
+    bool parse_user_password(std::string &name, std::string &password);
+    // 登录注册和存储处理都是协程，返回NO_REQUEST表示继续按m_url返回页面
+    co_task<HTTP_CODE> process_registration(std::string name, std::string password);
+    co_task<HTTP_CODE> process_login(std::string name, std::string password);
+    co_task<HTTP_CODE> Download();
+    co_task<HTTP_CODE> Upload();
     std::string GetETag(const storage::StorageInfo &info);
 };
 
@@ -0,0 +1,261 @@
+#include "session_store.h"
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+
+namespace
+{
+    long long now_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+
+    void random_bytes(void *buf, size_t len)
+    {
+        char *p = (char *)buf;
+        while (len > 0)
+        {
+            ssize_t n = getrandom(p, len, 0);
+            if (n <= 0)
+                continue;
+            p += n;
+            len -= n;
+        }
+    }
+
+    inline uint64_t rotl(uint64_t x, int b)
+    {
+        return (x << b) | (x >> (64 - b));
+    }
+
+#define SIPROUND                                                       \
+    do                                                                 \
+    {                                                                  \
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);      \
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;                         \
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;                         \
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);      \
+    } while (0)
+
+    // SipHash-2-4，输入按小端解释
+    uint64_t siphash(const uint64_t key[2], const unsigned char *in, size_t len)
+    {
+        uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+        uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+        uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+        uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+        size_t full = len & ~(size_t)7;
+        for (size_t i = 0; i < full; i += 8)
+        {
+            uint64_t m = 0;
+            for (int k = 7; k >= 0; --k)
+                m = (m << 8) | in[i + k];
+            v3 ^= m;
+            SIPROUND;
+            SIPROUND;
+            v0 ^= m;
+        }
+        uint64_t b = (uint64_t)len << 56;
+        for (size_t k = 0; k < len - full; ++k)
+            b |= (uint64_t)in[full + k] << (8 * k);
+        v3 ^= b;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= b;
+        v2 ^= 0xff;
+        SIPROUND;
+        SIPROUND;
+        SIPROUND;
+        SIPROUND;
+        return v0 ^ v1 ^ v2 ^ v3;
+    }
+#undef SIPROUND
+
+    const size_t ID_LEN = 16;
+    const char HEX[] = "0123456789abcdef";
+
+    void to_hex(const unsigned char *in, size_t len, std::string &out)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            out += HEX[in[i] >> 4];
+            out += HEX[in[i] & 15];
+        }
+    }
+
+    bool from_hex(const char *in, size_t len, unsigned char *out)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            int v = 0;
+            for (int k = 0; k < 2; ++k)
+            {
+                char c = in[i * 2 + k];
+                int d;
+                if (c >= '0' && c <= '9')
+                    d = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    d = c - 'a' + 10;
+                else
+                    return false;
+                v = v * 16 + d;
+            }
+            out[i] = (unsigned char)v;
+        }
+        return true;
+    }
+}
+
+session_store::session_store()
+{
+    random_bytes(m_key, sizeof(m_key));
+    long long tick = now_ms() / TICK_MS;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].tick = tick;
+        m_shards[i].queued = 0;
+    }
+}
+
+uint64_t session_store::sign(const std::string &id) const
+{
+    return siphash(m_key, (const unsigned char *)id.data(), id.size());
+}
+
+bool session_store::parse(const std::string &token, std::string *id) const
+{
+    // 32位十六进制ID + '.' + 16位十六进制签名
+    if (token.size() != ID_LEN * 2 + 1 + 16 || token[ID_LEN * 2] != '.')
+        return false;
+    unsigned char raw[ID_LEN];
+    unsigned char mac[8];
+    if (!from_hex(token.data(), ID_LEN, raw) || !from_hex(token.data() + ID_LEN * 2 + 1, 8, mac))
+        return false;
+    uint64_t got = 0;
+    for (int k = 7; k >= 0; --k)
+        got = (got << 8) | mac[k];
+    id->assign((const char *)raw, ID_LEN);
+    return got == sign(*id);
+}
+
+session_store::shard &session_store::shard_of(const std::string &id)
+{
+    // ID是随机数，直接取首字节
+    return m_shards[(unsigned char)id[0] % SHARDS];
+}
+
+void session_store::advance(shard &s, long long now)
+{
+    long long tick = now / TICK_MS;
+    // 很久没访问过的分片最多转一圈
+    long long from = tick - s.tick > WHEEL_SLOTS ? tick - WHEEL_SLOTS : s.tick;
+    for (long long t = from + 1; t <= tick; ++t)
+    {
+        std::vector<std::string> &slot = s.wheel[t % WHEEL_SLOTS];
+        for (size_t i = 0; i < slot.size(); ++i)
+        {
+            std::unordered_map<std::string, entry>::iterator it = s.sessions.find(slot[i]);
+            if (it != s.sessions.end() && it->second.expire_ms <= now)
+                s.sessions.erase(it);
+        }
+        s.queued -= slot.size();
+        std::vector<std::string>().swap(slot);
+    }
+    if (tick > s.tick)
+        s.tick = tick;
+}
+
+void session_store::evict_one(shard &s)
+{
+    // 从最早到期的格子取一个ID，已注销的ID也在这里顺便丢掉
+    for (long long t = s.tick + 1; t <= s.tick + WHEEL_SLOTS; ++t)
+    {
+        std::vector<std::string> &slot = s.wheel[t % WHEEL_SLOTS];
+        if (slot.empty())
+            continue;
+        s.sessions.erase(slot.back());
+        slot.pop_back();
+        --s.queued;
+        return;
+    }
+}
+
+std::string session_store::create(const std::string &user)
+{
+    unsigned char raw[ID_LEN];
+    random_bytes(raw, ID_LEN);
+    std::string id((const char *)raw, ID_LEN);
+    uint64_t mac = sign(id);
+
+    long long now = now_ms();
+    long long expire = now + TTL_S * 1000LL;
+    shard &s = shard_of(id);
+    s.lock.lock();
+    advance(s, now);
+    // 格子里的ID(含已注销的)也计数，注销再登录不会让时间轮无限增长
+    while (s.sessions.size() >= (size_t)MAX_PER_SHARD || s.queued >= (size_t)MAX_PER_SHARD * 2)
+        evict_one(s);
+    entry &e = s.sessions[id];
+    e.user = user;
+    e.expire_ms = expire;
+    // 挂在到期时间所在格子的下一格，保证清理时已经过期
+    s.wheel[(expire / TICK_MS + 1) % WHEEL_SLOTS].push_back(id);
+    ++s.queued;
+    s.lock.unlock();
+
+    std::string token;
+    token.reserve(ID_LEN * 2 + 1 + 16);
+    to_hex(raw, ID_LEN, token);
+    token += '.';
+    unsigned char m[8];
+    for (int k = 0; k < 8; ++k)
+        m[k] = (unsigned char)(mac >> (8 * k));
+    to_hex(m, 8, token);
+    return token;
+}
+
+bool session_store::validate(const std::string &token, std::string *user)
+{
+    std::string id;
+    if (!parse(token, &id))
+        return false;
+    long long now = now_ms();
+    shard &s = shard_of(id);
+    bool ok = false;
+    s.lock.lock();
+    advance(s, now);
+    std::unordered_map<std::string, entry>::iterator it = s.sessions.find(id);
+    if (it != s.sessions.end() && it->second.expire_ms > now)
+    {
+        ok = true;
+        if (user)
+            *user = it->second.user;
+    }
+    s.lock.unlock();
+    return ok;
+}
+
+void session_store::destroy(const std::string &token)
+{
+    std::string id;
+    if (!parse(token, &id))
+        return;
+    shard &s = shard_of(id);
+    s.lock.lock();
+    s.sessions.erase(id);
+    s.lock.unlock();
+}
+
+size_t session_store::size()
+{
+    size_t n = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        n += m_shards[i].sessions.size();
+        m_shards[i].lock.unlock();
+    }
+    return n;
+}
@@ -0,0 +1,77 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+/*
+登录会话
+登录成功后生成 128 位随机会话ID，Cookie 值为 "ID.签名"(均为十六进制)，签名是用进程启动时随机生成的密钥对ID做的 SipHash-2-4
+校验时先验签名，伪造或篡改的Cookie不查表直接拒绝；签名正确再在ID所在分片的哈希表里查一次，确认会话未过期、未注销
+会话按ID分成 SHARDS 个分片，每个分片一把锁、一张哈希表和一个时间轮：
+时间轮每格 TICK_MS，会话按到期时间挂在对应的格子上，分片被访问时顺带把走过的格子里到期的会话删掉，不需要单独的清理线程
+每个分片最多 MAX_PER_SHARD 个会话，满了先淘汰最早到期的会话，内存有上界
+密钥只在内存中，进程重启后所有会话失效
+*/
+
+class session_store
+{
+public:
+    static session_store *get_instance()
+    {
+        static session_store instance;
+        return &instance;
+    }
+
+    static const int SHARDS = 16;
+    static const int MAX_PER_SHARD = 4096;
+    static const int TTL_S = 1800;      // 会话有效期，从登录时算起
+    static const int TICK_MS = 1000;    // 时间轮一格的时长
+    static const int WHEEL_SLOTS = 2048; // 需覆盖 TTL_S，超出一圈的会话在格子里等下一圈
+
+    // 创建会话，返回Cookie值
+    std::string create(const std::string &user);
+    // Cookie值有效时返回 true，user 为登录的用户名
+    bool validate(const std::string &token, std::string *user);
+    // 注销，Cookie值无效时什么也不做
+    void destroy(const std::string &token);
+    // 所有分片当前的会话数
+    size_t size();
+
+private:
+    struct entry
+    {
+        std::string user;
+        long long expire_ms;
+    };
+
+    struct alignas(64) shard
+    {
+        locker lock;
+        std::unordered_map<std::string, entry> sessions; // 键为16字节的原始会话ID
+        std::vector<std::string> wheel[WHEEL_SLOTS];     // 每格挂着在该格到期的会话ID，可能含已删除的ID
+        size_t queued;                                    // 所有格子里的ID总数
+        long long tick;                                   // 已清理到的格子(绝对编号)
+    };
+
+    session_store();
+    session_store(const session_store &) = delete;
+    session_store &operator=(const session_store &) = delete;
+
+    uint64_t sign(const std::string &id) const;
+    // 解析并验签，成功时 id 为原始会话ID
+    bool parse(const std::string &token, std::string *id) const;
+    shard &shard_of(const std::string &id);
+    // 调用方持有分片锁：清理走过的格子
+    static void advance(shard &s, long long now_ms);
+    // 调用方持有分片锁：淘汰最早到期的一个会话
+    static void evict_one(shard &s);
+
+    uint64_t m_key[2];
+    shard m_shards[SHARDS];
+};
+
+#endif
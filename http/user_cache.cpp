@@ -0,0 +1,185 @@
+#include "user_cache.h"
+#include <functional>
+#include <time.h>
+
+namespace
+{
+    long long now_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+}
+
+user_cache::user_cache()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].current.store(new_table(INITIAL_SLOTS), std::memory_order_relaxed);
+        m_shards[i].count = 0;
+    }
+}
+
+user_cache::~user_cache()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = m_shards[i];
+        table *t = s.current.load(std::memory_order_relaxed);
+        for (size_t k = 0; k <= t->mask; ++k)
+            delete t->slots[k].load(std::memory_order_relaxed);
+        s.retired.push_back(t);
+        for (size_t k = 0; k < s.retired.size(); ++k)
+        {
+            delete[] s.retired[k]->slots;
+            delete s.retired[k];
+        }
+    }
+}
+
+user_cache::table *user_cache::new_table(size_t slots)
+{
+    table *t = new table;
+    t->mask = slots - 1;
+    t->slots = new std::atomic<entry *>[slots];
+    for (size_t i = 0; i < slots; ++i)
+        t->slots[i].store(NULL, std::memory_order_relaxed);
+    return t;
+}
+
+const user_cache::entry *user_cache::find(const shard &s, size_t hash, const std::string &name)
+{
+    const table *t = s.current.load(std::memory_order_acquire);
+    // 低位已用于选分片，槽位用剩下的位
+    for (size_t i = (hash / SHARDS) & t->mask;; i = (i + 1) & t->mask)
+    {
+        const entry *e = t->slots[i].load(std::memory_order_acquire);
+        if (!e)
+            return NULL;
+        if (e->hash == hash && e->name == name)
+            return e;
+    }
+}
+
+void user_cache::insert_locked(shard &s, size_t hash, const std::string &name, const std::string &password)
+{
+    table *t = s.current.load(std::memory_order_relaxed);
+    if ((s.count + 1) * 2 > t->mask + 1)
+    {
+        table *bigger = new_table((t->mask + 1) * 2);
+        for (size_t k = 0; k <= t->mask; ++k)
+        {
+            entry *e = t->slots[k].load(std::memory_order_relaxed);
+            if (!e)
+                continue;
+            size_t i = (e->hash / SHARDS) & bigger->mask;
+            while (bigger->slots[i].load(std::memory_order_relaxed))
+                i = (i + 1) & bigger->mask;
+            bigger->slots[i].store(e, std::memory_order_relaxed);
+        }
+        // 新表内容在发布前写完，读者要么看到完整的旧表，要么看到完整的新表
+        s.current.store(bigger, std::memory_order_release);
+        s.retired.push_back(t);
+        t = bigger;
+    }
+    entry *e = new entry;
+    e->hash = hash;
+    e->name = name;
+    e->password = password;
+    size_t i = (hash / SHARDS) & t->mask;
+    while (t->slots[i].load(std::memory_order_relaxed))
+        i = (i + 1) & t->mask;
+    t->slots[i].store(e, std::memory_order_release);
+    s.count++;
+    s.missing.erase(name);
+}
+
+void user_cache::load(const std::string &name, const std::string &password)
+{
+    size_t hash = std::hash<std::string>()(name);
+    shard &s = shard_of(hash);
+    s.lock.lock();
+    if (!find(s, hash, name))
+        insert_locked(s, hash, name, password);
+    s.lock.unlock();
+}
+
+bool user_cache::contains(const std::string &name) const
+{
+    size_t hash = std::hash<std::string>()(name);
+    return find(shard_of(hash), hash, name) != NULL;
+}
+
+bool user_cache::check(const std::string &name, const std::string &password) const
+{
+    size_t hash = std::hash<std::string>()(name);
+    const entry *e = find(shard_of(hash), hash, name);
+    return e && e->password == password;
+}
+
+bool user_cache::begin_register(const std::string &name)
+{
+    size_t hash = std::hash<std::string>()(name);
+    shard &s = shard_of(hash);
+    s.lock.lock();
+    bool ok = !find(s, hash, name) && s.pending.insert(name).second;
+    s.lock.unlock();
+    return ok;
+}
+
+void user_cache::end_register(const std::string &name, const std::string &password, bool ok)
+{
+    size_t hash = std::hash<std::string>()(name);
+    shard &s = shard_of(hash);
+    s.lock.lock();
+    s.pending.erase(name);
+    if (ok && !find(s, hash, name))
+        insert_locked(s, hash, name, password);
+    s.lock.unlock();
+}
+
+void user_cache::mark_missing(const std::string &name)
+{
+    size_t hash = std::hash<std::string>()(name);
+    shard &s = shard_of(hash);
+    long long now = now_ms();
+    s.lock.lock();
+    if (!find(s, hash, name))
+    {
+        if (s.missing.size() >= (size_t)MAX_MISSING_PER_SHARD)
+        {
+            for (std::unordered_map<std::string, long long>::iterator it = s.missing.begin(); it != s.missing.end();)
+            {
+                if (it->second <= now)
+                    it = s.missing.erase(it);
+                else
+                    ++it;
+            }
+            // 全都没过期时随便淘汰一个，内存有上界
+            if (s.missing.size() >= (size_t)MAX_MISSING_PER_SHARD)
+                s.missing.erase(s.missing.begin());
+        }
+        s.missing[name] = now + MISSING_TTL_MS;
+    }
+    s.lock.unlock();
+}
+
+bool user_cache::known_missing(const std::string &name)
+{
+    size_t hash = std::hash<std::string>()(name);
+    shard &s = shard_of(hash);
+    long long now = now_ms();
+    bool hit = false;
+    s.lock.lock();
+    std::unordered_map<std::string, long long>::iterator it = s.missing.find(name);
+    if (it != s.missing.end())
+    {
+        if (it->second > now)
+            hit = true;
+        else
+            s.missing.erase(it);
+    }
+    s.lock.unlock();
+    return hit;
+}
@@ -0,0 +1,90 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../lock/locker.h"
+
+/*
+用户名密码缓存
+启动时从 user 表载入，注册成功后追加；用户只增不删，按用户名哈希分成若干分片
+每个分片是开放寻址的指针表，读取只做 acquire 原子读，不加锁；写入只锁所在分片
+表扩容时整体复制指针后原子发布新表，旧表保留到进程退出，正在读旧表的线程不受影响(旧表总大小不超过当前表)
+注册时先在分片里登记"注册中"，数据库写入在锁外进行，同名的并发注册只有一个能成功
+登录时查库确认不存在的用户名在分片里记 MISSING_TTL_MS，期间重复登录不再查库；每个分片最多记 MAX_MISSING_PER_SHARD 个
+*/
+
+class user_cache
+{
+public:
+    static user_cache *get_instance()
+    {
+        static user_cache instance;
+        return &instance;
+    }
+
+    static const int SHARDS = 16;
+    static const int INITIAL_SLOTS = 64; // 每个分片的初始容量，装载超过一半时翻倍
+    static const int MISSING_TTL_MS = 10000;
+    static const int MAX_MISSING_PER_SHARD = 1024;
+
+    // 启动时载入，已存在的用户名保留原值
+    void load(const std::string &name, const std::string &password);
+    bool contains(const std::string &name) const;
+    // 用户存在且密码一致
+    bool check(const std::string &name, const std::string &password) const;
+
+    // 用户名已存在或正在被注册时返回 false，成功后必须调用 end_register
+    bool begin_register(const std::string &name);
+    // ok 表示数据库写入成功，此时把用户加入缓存
+    void end_register(const std::string &name, const std::string &password, bool ok);
+
+    // 数据库中不存在该用户名，记一段时间
+    void mark_missing(const std::string &name);
+    // 最近确认过不存在
+    bool known_missing(const std::string &name);
+
+private:
+    struct entry
+    {
+        size_t hash;
+        std::string name;
+        std::string password;
+    };
+
+    struct table
+    {
+        size_t mask;
+        std::atomic<entry *> *slots;
+    };
+
+    struct alignas(64) shard
+    {
+        std::atomic<table *> current;
+        locker lock;                 // 只有写入方使用
+        size_t count;                // 已插入的用户数，受 lock 保护
+        std::vector<table *> retired; // 扩容替换下来的旧表
+        std::set<std::string> pending; // 正在注册的用户名
+        std::unordered_map<std::string, long long> missing; // 不存在的用户名 -> 过期时间(ms)
+    };
+
+    user_cache();
+    ~user_cache();
+    user_cache(const user_cache &) = delete;
+    user_cache &operator=(const user_cache &) = delete;
+
+    static table *new_table(size_t slots);
+    static const entry *find(const shard &s, size_t hash, const std::string &name);
+    // 调用方持有分片锁，且确认用户名不存在
+    static void insert_locked(shard &s, size_t hash, const std::string &name, const std::string &password);
+
+    shard &shard_of(size_t hash) { return m_shards[hash % SHARDS]; }
+    const shard &shard_of(size_t hash) const { return m_shards[hash % SHARDS]; }
+
+    shard m_shards[SHARDS];
+};
+
+#endif
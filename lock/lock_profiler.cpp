@@ -0,0 +1,298 @@
+#include "lock_profiler.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace
+{
+    struct alignas(64) site
+    {
+        std::atomic<int> state; // 0 空闲 1 写入中 2 可用
+        const char *file;
+        int line;
+        int kind;
+        std::atomic<long long> acquisitions;
+        std::atomic<long long> contended;
+        std::atomic<long long> wait_ns;
+        std::atomic<long long> wait_max_ns;
+        std::atomic<long long> hold_ns;
+        std::atomic<long long> hold_max_ns;
+        std::atomic<long long> holds;
+        std::atomic<long long> wait_hist[lock_profiler::WAIT_BUCKETS];
+    };
+
+    // 零初始化的静态存储，不依赖构造顺序(其他全局对象的构造函数里也可能加锁)
+    site g_sites[lock_profiler::MAX_SITES];
+    std::atomic<long long> g_dropped(0);
+
+    // 本线程当前持有的互斥量，用于在解锁时算出持有时长
+    struct held_lock
+    {
+        const void *lock;
+        site *s;
+        long long start_ns;
+    };
+    const int MAX_HELD = 16;
+    thread_local held_lock t_held[MAX_HELD];
+    thread_local int t_held_count = 0;
+
+    void update_max(std::atomic<long long> &target, long long v)
+    {
+        long long cur = target.load(std::memory_order_relaxed);
+        while (v > cur && !target.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+            ;
+    }
+
+    // 同一头文件在不同编译单元里的 __FILE__ 指针可能不同，这里按指针区分，导出时再按内容合并
+    site *find_site(const char *file, int line, int kind)
+    {
+        uint64_t h = ((uint64_t)(uintptr_t)file >> 3) * 0x9E3779B97F4A7C15ULL + (uint64_t)line * 31 + kind;
+        for (int probe = 0; probe < lock_profiler::MAX_SITES; ++probe)
+        {
+            site &s = g_sites[(h + probe) % lock_profiler::MAX_SITES];
+            int state = s.state.load(std::memory_order_acquire);
+            if (state == 0)
+            {
+                if (s.state.compare_exchange_strong(state, 1, std::memory_order_acquire))
+                {
+                    s.file = file;
+                    s.line = line;
+                    s.kind = kind;
+                    s.state.store(2, std::memory_order_release);
+                    return &s;
+                }
+            }
+            // 另一线程正在登记这个格子
+            while (state == 1)
+                state = s.state.load(std::memory_order_acquire);
+            if (s.file == file && s.line == line && s.kind == kind)
+                return &s;
+        }
+        g_dropped.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    int wait_bucket(long long ns)
+    {
+        long long us = ns / 1000;
+        int b = 0;
+        while (us > 1 && b < lock_profiler::WAIT_BUCKETS - 1)
+        {
+            us >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    void record_wait(site *s, bool contended, long long waited_ns)
+    {
+        if (!s)
+            return;
+        s->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        s->wait_hist[wait_bucket(waited_ns)].fetch_add(1, std::memory_order_relaxed);
+        if (!contended)
+            return;
+        s->contended.fetch_add(1, std::memory_order_relaxed);
+        s->wait_ns.fetch_add(waited_ns, std::memory_order_relaxed);
+        update_max(s->wait_max_ns, waited_ns);
+    }
+
+    void record_hold(site *s, long long held_ns)
+    {
+        if (!s)
+            return;
+        s->holds.fetch_add(1, std::memory_order_relaxed);
+        s->hold_ns.fetch_add(held_ns, std::memory_order_relaxed);
+        update_max(s->hold_max_ns, held_ns);
+    }
+
+    const char *kind_name(int kind)
+    {
+        switch (kind)
+        {
+        case lock_profiler::KIND_SEM:
+            return "sem";
+        case lock_profiler::KIND_COND:
+            return "cond";
+        default:
+            return "mutex";
+        }
+    }
+
+    struct site_report
+    {
+        std::string site;
+        int kind;
+        long long acquisitions;
+        long long contended;
+        long long wait_ns;
+        long long wait_max_ns;
+        long long hold_ns;
+        long long hold_max_ns;
+        long long holds;
+        long long wait_hist[lock_profiler::WAIT_BUCKETS];
+    };
+
+    bool by_wait_desc(const site_report &a, const site_report &b)
+    {
+        return a.wait_ns > b.wait_ns;
+    }
+
+    // 直方图分位数，取所在桶的上界(微秒)
+    long long percentile_us(const site_report &r, double q)
+    {
+        long long total = 0;
+        for (int i = 0; i < lock_profiler::WAIT_BUCKETS; ++i)
+            total += r.wait_hist[i];
+        if (total == 0)
+            return 0;
+        long long target = (long long)(total * q);
+        if (target >= total)
+            target = total - 1;
+        long long seen = 0;
+        for (int i = 0; i < lock_profiler::WAIT_BUCKETS; ++i)
+        {
+            seen += r.wait_hist[i];
+            if (seen > target)
+                return 1LL << (i + 1);
+        }
+        return 1LL << lock_profiler::WAIT_BUCKETS;
+    }
+}
+
+bool lock_profiler::enabled()
+{
+#ifdef LOCK_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+long long lock_profiler::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void lock_profiler::acquired(const void *lock, int kind, const char *file, int line, bool contended, long long waited_ns)
+{
+    site *s = find_site(file, line, kind);
+    record_wait(s, contended, waited_ns);
+    if (kind == KIND_MUTEX && t_held_count < MAX_HELD)
+    {
+        held_lock &h = t_held[t_held_count++];
+        h.lock = lock;
+        h.s = s;
+        h.start_ns = now_ns();
+    }
+}
+
+void lock_profiler::released(const void *lock)
+{
+    for (int i = t_held_count - 1; i >= 0; --i)
+    {
+        if (t_held[i].lock != lock)
+            continue;
+        record_hold(t_held[i].s, now_ns() - t_held[i].start_ns);
+        // 解锁顺序不一定与加锁相反，把后面的元素前移
+        for (int k = i; k + 1 < t_held_count; ++k)
+            t_held[k] = t_held[k + 1];
+        --t_held_count;
+        return;
+    }
+}
+
+std::string lock_profiler::to_json()
+{
+    if (!enabled())
+        return "{\"enabled\":false}";
+
+    // 相同 文件:行号 的格子合并
+    std::map<std::pair<std::string, int>, site_report> merged;
+    char buf[512];
+    for (int i = 0; i < MAX_SITES; ++i)
+    {
+        site &s = g_sites[i];
+        if (s.state.load(std::memory_order_acquire) != 2)
+            continue;
+        const char *file = s.file;
+        while (strncmp(file, "./", 2) == 0)
+            file += 2;
+        snprintf(buf, sizeof(buf), "%s:%d", file, s.line);
+        std::pair<std::string, int> key(buf, s.kind);
+        std::map<std::pair<std::string, int>, site_report>::iterator it = merged.find(key);
+        if (it == merged.end())
+        {
+            site_report r;
+            memset(r.wait_hist, 0, sizeof(r.wait_hist));
+            r.site = buf;
+            r.kind = s.kind;
+            r.acquisitions = r.contended = r.wait_ns = r.wait_max_ns = r.hold_ns = r.hold_max_ns = r.holds = 0;
+            it = merged.insert(std::make_pair(key, r)).first;
+        }
+        site_report &r = it->second;
+        r.acquisitions += s.acquisitions.load(std::memory_order_relaxed);
+        r.contended += s.contended.load(std::memory_order_relaxed);
+        r.wait_ns += s.wait_ns.load(std::memory_order_relaxed);
+        r.wait_max_ns = std::max(r.wait_max_ns, s.wait_max_ns.load(std::memory_order_relaxed));
+        r.hold_ns += s.hold_ns.load(std::memory_order_relaxed);
+        r.hold_max_ns = std::max(r.hold_max_ns, s.hold_max_ns.load(std::memory_order_relaxed));
+        r.holds += s.holds.load(std::memory_order_relaxed);
+        for (int b = 0; b < WAIT_BUCKETS; ++b)
+            r.wait_hist[b] += s.wait_hist[b].load(std::memory_order_relaxed);
+    }
+
+    std::vector<site_report> reports;
+    for (std::map<std::pair<std::string, int>, site_report>::const_iterator it = merged.begin(); it != merged.end(); ++it)
+        reports.push_back(it->second);
+    std::sort(reports.begin(), reports.end(), by_wait_desc);
+
+    std::string out;
+    snprintf(buf, sizeof(buf), "{\"enabled\":true,\"dropped\":%lld,\"sites\":[", g_dropped.load(std::memory_order_relaxed));
+    out += buf;
+    for (size_t i = 0; i < reports.size(); ++i)
+    {
+        const site_report &r = reports[i];
+        snprintf(buf, sizeof(buf),
+                 "%s{\"site\":\"%s\",\"kind\":\"%s\",\"acquisitions\":%lld,\"contended\":%lld,\"contention\":%.4f,"
+                 "\"wait_us_total\":%lld,\"wait_us_max\":%lld,\"wait_p50_us\":%lld,\"wait_p99_us\":%lld,"
+                 "\"hold_us_total\":%lld,\"hold_us_max\":%lld,\"hold_us_avg\":%.2f,\"wait_hist\":[",
+                 i ? "," : "", r.site.c_str(), kind_name(r.kind), r.acquisitions, r.contended,
+                 r.acquisitions ? (double)r.contended / r.acquisitions : 0.0,
+                 r.wait_ns / 1000, r.wait_max_ns / 1000, percentile_us(r, 0.5), percentile_us(r, 0.99),
+                 r.hold_ns / 1000, r.hold_max_ns / 1000, r.holds ? r.hold_ns / 1000.0 / r.holds : 0.0);
+        out += buf;
+        for (int b = 0; b < WAIT_BUCKETS; ++b)
+        {
+            snprintf(buf, sizeof(buf), "%s%lld", b ? "," : "", r.wait_hist[b]);
+            out += buf;
+        }
+        out += "]}";
+    }
+    out += "]}";
+    return out;
+}
+
+void lock_profiler::reset()
+{
+    for (int i = 0; i < MAX_SITES; ++i)
+    {
+        site &s = g_sites[i];
+        s.acquisitions.store(0, std::memory_order_relaxed);
+        s.contended.store(0, std::memory_order_relaxed);
+        s.wait_ns.store(0, std::memory_order_relaxed);
+        s.wait_max_ns.store(0, std::memory_order_relaxed);
+        s.hold_ns.store(0, std::memory_order_relaxed);
+        s.hold_max_ns.store(0, std::memory_order_relaxed);
+        s.holds.store(0, std::memory_order_relaxed);
+        for (int b = 0; b < WAIT_BUCKETS; ++b)
+            s.wait_hist[b].store(0, std::memory_order_relaxed);
+    }
+    g_dropped.store(0, std::memory_order_relaxed);
+}
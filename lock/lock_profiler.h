@@ -0,0 +1,46 @@
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include <atomic>
+#include <string>
+
+/*
+锁竞争剖析
+用 make LOCK_PROFILE=1 编译时，locker/sem/cond 的加锁和等待改为调用这里的函数，
+按调用位置(文件:行号，由编译器在调用处填入)统计获取次数、发生竞争的次数、等待耗时直方图和持有时长
+未开启时 locker.h 不调用这里的统计函数，/admin/locks 只返回 enabled:false
+
+竞争的判定：第一次无等待的尝试失败才算竞争并计入等待耗时(包括自旋)，sem 同理
+cond 的等待全部计入，耗时包含等待通知和重新拿到互斥量的时间；等待期间互斥量已释放，不计入持有时长，
+重新加锁按 cond 的调用位置记一次互斥量获取
+持有时长按加锁位置归属，用线程局部的"已持有锁"栈匹配解锁
+*/
+
+class lock_profiler
+{
+public:
+    enum kind
+    {
+        KIND_MUTEX = 0,
+        KIND_SEM,
+        KIND_COND
+    };
+
+    static const int MAX_SITES = 1024;  // 超出的调用位置不再统计
+    static const int WAIT_BUCKETS = 24; // 第i个桶: [2^i, 2^(i+1)) 微秒，第0个桶含 <1us
+
+    static bool enabled();
+
+    static long long now_ns();
+    // 一次获取完成：contended 表示第一次尝试失败，waited_ns 为之后等待的时间；互斥量会记下持有起点
+    static void acquired(const void *lock, int kind, const char *file, int line, bool contended, long long waited_ns);
+    // 互斥量解锁，结算本次持有时长
+    static void released(const void *lock);
+
+    // 按总等待时长降序：{"enabled","sites":[{"site","kind","acquisitions","contended",...}]}
+    static std::string to_json();
+    // 清零所有计数，调用位置保留
+    static void reset();
+};
+
+#endif
@@ -2,116 +2,312 @@
 #define LOCKER_H
 
 #include <exception>
+#include <atomic>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#ifdef LOCK_PROFILE
+#include "lock_profiler.h"
+#endif
+
+// make LOCK_PROFILE=1 时加锁与等待经过 lock_profiler，按调用位置统计竞争，默认参数由编译器填入调用处的文件和行号
+
+/*
+互斥锁、信号量和条件变量直接建立在 futex 上
+无竞争时只有一次原子操作，不进入内核；拿不到时先有限次自旋，自旋上限按最近成功时用掉的自旋次数自适应调整，
+仍拿不到才 futex 睡眠，唤醒时只唤醒一个等待者
+*/
+
+namespace lock_detail
+{
+    // 自旋上限，超过后进入内核睡眠
+    const int MAX_SPIN = 100;
+
+    inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+
+    // *addr 仍等于 val 时睡眠；abstime 为 CLOCK_REALTIME 绝对时间，NULL 表示不限时。超时返回 false
+    inline bool futex_wait(std::atomic<int> *addr, int val, const struct timespec *abstime)
+    {
+        long ret;
+        if (abstime)
+            ret = syscall(SYS_futex, (int *)addr, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, val, abstime, NULL,
+                          FUTEX_BITSET_MATCH_ANY);
+        else
+            ret = syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+        return !(ret == -1 && errno == ETIMEDOUT);
+    }
+
+    inline void futex_wake(std::atomic<int> *addr, int n)
+    {
+        syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    }
+
+    // 本次自旋上限：最近平均值的两倍，留出余量
+    inline int spin_limit(const std::atomic<int> &avg)
+    {
+        int limit = avg.load(std::memory_order_relaxed) * 2 + 10;
+        return limit < MAX_SPIN ? limit : MAX_SPIN;
+    }
+
+    // 按 1/8 的权重更新平均自旋次数(同 glibc 的自适应互斥锁)
+    // 自旋失败时按本次上限记入，平均值会向 MAX_SPIN 靠拢，下次转得更久；
+    // 短时间就能拿到锁时记入实际次数，平均值随之回落，上限也跟着变小
+    inline void spin_update(std::atomic<int> &avg, int spins)
+    {
+        int cur = avg.load(std::memory_order_relaxed);
+        avg.store(cur + (spins - cur) / 8, std::memory_order_relaxed);
+    }
+}
 
 class sem
 {
 public:
-    sem()
+    sem() : m_count(0), m_waiters(0), m_spin_avg(0)
     {
-        // 信号量初始化
-        if (sem_init(&m_sem, 0, 0) != 0)
-        {
-            throw std::exception();
-        }
     }
-    sem(int num)
+    sem(int num) : m_count(num), m_waiters(0), m_spin_avg(0)
     {
-        if (sem_init(&m_sem, 0, num) != 0)
+        if (num < 0)
         {
             throw std::exception();
         }
     }
     ~sem()
     {
-        sem_destroy(&m_sem);
     }
+    // 只复制计数，仅在没有线程等待时使用(如连接池初始化时重设容量)
+    sem &operator=(const sem &other)
+    {
+        m_count.store(other.m_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+#ifdef LOCK_PROFILE
+    bool wait(const char *file = __builtin_FILE(), int line = __builtin_LINE())
+    {
+        if (try_wait())
+        {
+            lock_profiler::acquired(this, lock_profiler::KIND_SEM, file, line, false, 0);
+            return true;
+        }
+        long long start = lock_profiler::now_ns();
+        wait_slow();
+        lock_profiler::acquired(this, lock_profiler::KIND_SEM, file, line, true, lock_profiler::now_ns() - start);
+        return true;
+    }
+#else
     bool wait()
     {
-        return sem_wait(&m_sem) == 0;
+        if (!try_wait())
+            wait_slow();
+        return true;
     }
+#endif
     bool post()
     {
-        return sem_post(&m_sem) == 0;
+        m_count.fetch_add(1, std::memory_order_seq_cst);
+        // 与 wait_slow 中先登记等待者、再检查计数的顺序配对，两边至少有一边能看到对方
+        if (m_waiters.load(std::memory_order_seq_cst) > 0)
+            lock_detail::futex_wake(&m_count, 1);
+        return true;
     }
 
 private:
-    sem_t m_sem;
+    bool try_wait()
+    {
+        int c = m_count.load(std::memory_order_relaxed);
+        while (c > 0)
+        {
+            if (m_count.compare_exchange_weak(c, c - 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+    void wait_slow()
+    {
+        // 线程池里任务往往紧跟着到来，先短暂自旋，省掉一次睡眠和唤醒
+        int limit = lock_detail::spin_limit(m_spin_avg);
+        for (int i = 0; i < limit; ++i)
+        {
+            lock_detail::cpu_relax();
+            if (try_wait())
+            {
+                lock_detail::spin_update(m_spin_avg, i + 1);
+                return;
+            }
+        }
+        lock_detail::spin_update(m_spin_avg, limit);
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        while (!try_wait())
+        {
+            lock_detail::futex_wait(&m_count, 0, NULL);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::atomic<int> m_count;
+    std::atomic<int> m_waiters;
+    std::atomic<int> m_spin_avg;
 };
 class locker
 {
 public:
-    locker()
+    // 0 未加锁，1 已加锁且无等待者，2 已加锁且可能有等待者
+    locker() : m_state(0), m_spin_avg(0)
+    {
+    }
+    ~locker()
     {
-        if (pthread_mutex_init(&m_mutex, NULL) != 0)
+    }
+#ifdef LOCK_PROFILE
+    bool lock(const char *file = __builtin_FILE(), int line = __builtin_LINE())
+    {
+        if (try_lock())
         {
-            throw std::exception();
+            lock_profiler::acquired(this, lock_profiler::KIND_MUTEX, file, line, false, 0);
+            return true;
         }
+        long long start = lock_profiler::now_ns();
+        lock_slow();
+        lock_profiler::acquired(this, lock_profiler::KIND_MUTEX, file, line, true, lock_profiler::now_ns() - start);
+        return true;
     }
-    ~locker()
+    bool unlock()
     {
-        pthread_mutex_destroy(&m_mutex);
+        lock_profiler::released(this);
+        unlock_fast();
+        return true;
     }
+#else
     bool lock()
     {
-        return pthread_mutex_lock(&m_mutex) == 0;
+        if (!try_lock())
+            lock_slow();
+        return true;
     }
     bool unlock()
     {
-        return pthread_mutex_unlock(&m_mutex) == 0;
+        unlock_fast();
+        return true;
     }
+#endif
     // 用于跟条件变量配合使用
-    pthread_mutex_t *get()
+    locker *get()
     {
-        return &m_mutex;
+        return this;
     }
 
 private:
-    pthread_mutex_t m_mutex;
+    bool try_lock()
+    {
+        int c = 0;
+        return m_state.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+    void lock_slow()
+    {
+        int limit = lock_detail::spin_limit(m_spin_avg);
+        for (int i = 0; i < limit; ++i)
+        {
+            lock_detail::cpu_relax();
+            if (m_state.load(std::memory_order_relaxed) == 0 && try_lock())
+            {
+                lock_detail::spin_update(m_spin_avg, i + 1);
+                return;
+            }
+        }
+        lock_detail::spin_update(m_spin_avg, limit);
+        // 标记为有等待者后睡眠，被唤醒的线程同样以2持有，保证解锁时会继续唤醒下一个
+        while (m_state.exchange(2, std::memory_order_acquire) != 0)
+        {
+            lock_detail::futex_wait(&m_state, 2, NULL);
+        }
+    }
+    void unlock_fast()
+    {
+        if (m_state.exchange(0, std::memory_order_release) == 2)
+            lock_detail::futex_wake(&m_state, 1);
+    }
+
+    std::atomic<int> m_state;
+    std::atomic<int> m_spin_avg;
 };
 class cond
 {
 public:
-    cond()
+    cond() : m_seq(0)
     {
-        if (pthread_cond_init(&m_cond, NULL) != 0)
-        {
-            // pthread_mutex_destroy(&m_mutex);
-            throw std::exception();
-        }
     }
     ~cond()
     {
-        pthread_cond_destroy(&m_cond);
     }
-    bool wait(pthread_mutex_t *m_mutex)
+#ifdef LOCK_PROFILE
+    bool wait(locker *m_mutex, const char *file = __builtin_FILE(), int line = __builtin_LINE())
+    {
+        return wait_until(m_mutex, NULL, file, line);
+    }
+    bool timewait(locker *m_mutex, struct timespec t, const char *file = __builtin_FILE(), int line = __builtin_LINE())
     {
-        int ret = 0;
-        // pthread_mutex_lock(&m_mutex);
-        ret = pthread_cond_wait(&m_cond, m_mutex);
-        // pthread_mutex_unlock(&m_mutex);
-        return ret == 0;
+        return wait_until(m_mutex, &t, file, line);
     }
-    bool timewait(pthread_mutex_t *m_mutex, struct timespec t)
+#else
+    bool wait(locker *m_mutex)
     {
-        int ret = 0;
-        // pthread_mutex_lock(&m_mutex);
-        ret = pthread_cond_timedwait(&m_cond, m_mutex, &t);
-        // pthread_mutex_unlock(&m_mutex);
-        return ret == 0;
+        return wait_until(m_mutex, NULL);
     }
+    // t 为 CLOCK_REALTIME 绝对时间，超时返回 false
+    bool timewait(locker *m_mutex, struct timespec t)
+    {
+        return wait_until(m_mutex, &t);
+    }
+#endif
     bool signal()
     {
-        return pthread_cond_signal(&m_cond) == 0;
+        m_seq.fetch_add(1, std::memory_order_release);
+        lock_detail::futex_wake(&m_seq, 1);
+        return true;
     }
     bool broadcast()
     {
-        return pthread_cond_broadcast(&m_cond) == 0;
+        m_seq.fetch_add(1, std::memory_order_release);
+        lock_detail::futex_wake(&m_seq, INT_MAX);
+        return true;
     }
 
 private:
-    // static pthread_mutex_t m_mutex;
-    pthread_cond_t m_cond;
+    // 解锁前取序号，解锁后到睡眠之间的 signal 会改变序号，futex_wait 直接返回，不会丢失通知
+    // 与 pthread_cond_wait 一样可能虚假唤醒，调用方需要在循环中重新检查条件
+#ifdef LOCK_PROFILE
+    bool wait_until(locker *m_mutex, const struct timespec *abstime, const char *file, int line)
+    {
+        long long start = lock_profiler::now_ns();
+        int seq = m_seq.load(std::memory_order_acquire);
+        m_mutex->unlock();
+        bool ret = lock_detail::futex_wait(&m_seq, seq, abstime);
+        m_mutex->lock(file, line);
+        lock_profiler::acquired(this, lock_profiler::KIND_COND, file, line, true, lock_profiler::now_ns() - start);
+        return ret;
+    }
+#else
+    bool wait_until(locker *m_mutex, const struct timespec *abstime)
+    {
+        int seq = m_seq.load(std::memory_order_acquire);
+        m_mutex->unlock();
+        bool ret = lock_detail::futex_wait(&m_seq, seq, abstime);
+        m_mutex->lock();
+        return ret;
+    }
+#endif
+
+    std::atomic<int> m_seq;
 };
 #endif
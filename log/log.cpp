@@ -1,50 +1,110 @@
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <vector>
+#include <algorithm>
 #include "log.h"
 #include <pthread.h>
 using namespace std;
 
+namespace
+{
+    // 线程退出时通知后台线程回收该线程的环形缓冲区
+    struct ring_holder
+    {
+        log_ring *ring;
+        ring_holder() : ring(NULL) {}
+        ~ring_holder()
+        {
+            if (ring)
+                ring->m_retired.store(true, std::memory_order_release);
+        }
+    };
+
+    // 每个线程缓存当前秒的时间前缀，同一秒内不再调用localtime
+    struct time_cache
+    {
+        time_t sec;
+        char text[32];
+        time_cache() : sec(-1) {}
+    };
+
+    thread_local ring_holder t_ring;
+    thread_local time_cache t_time;
+    thread_local char t_line[Log::LOG_LINE_SIZE];
+
+    const char *module_names[LOG_MOD_COUNT] = {"default", "server", "http", "timer", "sql", "storage"};
+
+    size_t round_up_pow2(size_t n)
+    {
+        size_t v = 1;
+        while (v < n)
+            v <<= 1;
+        return v;
+    }
+}
+
 Log::Log()
 {
     m_count = 0;
     m_is_async = false;
+    m_fd = -1;
+    m_ring_size = 0;
+    m_ring_count = 0;
+    m_flush_requested = false;
+    m_dropped = 0;
+    for (int i = 0; i < LOG_MOD_COUNT; ++i)
+        m_module_level[i] = 0;
+    m_binary = false;
+    m_format_count = 0;
+    m_formats_written = 0;
+    m_bytes = 0;
+    m_segment = 0;
+    m_cur_path[0] = '\0';
+    m_max_file_bytes = 0;
+    m_max_total_bytes = 0;
+    m_sweep_pending = false;
+    m_archive_started = false;
 }
 
 Log::~Log()
 {
-    if (m_fp != NULL)
+    m_mutex.lock();
+    if (m_is_async)
     {
-        fclose(m_fp);
+        drain_all();
     }
+    if (m_fd != -1)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_mutex.unlock();
 }
 // 异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size)
+bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size, bool binary)
 {
-    // 如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
-    {
-        // 设置写入方式flag
-        m_is_async = true;
-        // 创建并设置阻塞队列长度
-        m_log_queue = new block_queue<string>(max_queue_size);
-        pthread_t tid;
-        // flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
-    }
     // 输出内容的长度
     m_close_log = close_log;
-    m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
+    m_log_buf_size = log_buf_size < LOG_LINE_SIZE ? log_buf_size : LOG_LINE_SIZE;
 
     // 日志的最大行数
     m_split_lines = split_lines;
 
     time_t t = time(NULL);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
     // 从后往前找到第一个/的位置
     const char *p = strrchr(file_name, '/');
@@ -53,6 +113,8 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
     // 若输入的文件名没有/，则直接将时间+文件名作为日志名
     if (p == NULL)
     {
+        dir_name[0] = '\0';
+        strncpy(log_name, file_name, sizeof(log_name) - 1);
         snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
     }
     else
@@ -62,116 +124,654 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
         // dirname 相当于./
         strcpy(log_name, p + 1);
         strncpy(dir_name, file_name, p - file_name + 1);
+        dir_name[p - file_name + 1] = '\0';
         // 后面的参数跟format有关
         snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
     }
 
     m_today = my_tm.tm_mday;
 
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == NULL)
+    // 二进制日志加.bin后缀，切分后的文件沿用同样的名字
+    if (binary)
+    {
+        strncat(log_name, ".bin", sizeof(log_name) - strlen(log_name) - 1);
+        strncat(log_full_name, ".bin", sizeof(log_full_name) - strlen(log_full_name) - 1);
+    }
+
+    m_fd = open(log_full_name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (m_fd == -1)
     {
         return false;
     }
+    strcpy(m_cur_path, log_full_name);
+    // 追加到已有文件时从现有大小开始累计
+    struct stat st;
+    m_bytes = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+
+    // 如果设置了max_queue_size,则设置为异步
+    if (max_queue_size >= 1)
+    {
+        // 每个线程一个环形缓冲区，按每行约256字节估算，至少64KB
+        m_ring_size = round_up_pow2((size_t)max_queue_size * 256);
+        if (m_ring_size < 64 * 1024)
+            m_ring_size = 64 * 1024;
+        m_is_async = true;
+    }
+
+    if (binary)
+    {
+        m_binary = true;
+        m_mutex.lock();
+        write_binary_header();
+        m_mutex.unlock();
+        // 0号格式串用于无法登记的调用点，写入已格式化的文本
+        register_format("%s");
+    }
+
+    // 后台线程在同步模式下只负责切分和归档
+    pthread_t tid;
+    // flush_log_thread为回调函数,这里表示创建线程异步写日志
+    pthread_create(&tid, NULL, flush_log_thread, NULL);
+    pthread_detach(tid);
 
     return true;
 }
 
+void Log::set_rotation(long long max_file_bytes, long long max_total_bytes, archiver fn)
+{
+    m_mutex.lock();
+    m_max_file_bytes = max_file_bytes;
+    m_max_total_bytes = max_total_bytes;
+    m_archiver = fn;
+    m_mutex.unlock();
+    m_archive_mutex.lock();
+    if (!m_archive_started)
+    {
+        pthread_t tid;
+        m_archive_started = pthread_create(&tid, NULL, archive_thread, NULL) == 0;
+        if (m_archive_started)
+            pthread_detach(tid);
+    }
+    m_archive_mutex.unlock();
+    // 上次运行留下的未压缩文件也交给后台线程处理
+    m_sweep_pending = true;
+    if (!m_flush_requested.exchange(true))
+        m_flush_cond.signal();
+}
+
 void Log::write_log(int level, const char *format, ...)
 {
+    if (m_binary)
+    {
+        // 二进制文件中不能直接写文本行，格式化后作为0号格式串的参数记录
+        char text[LOG_LINE_SIZE / 2];
+        va_list valst;
+        va_start(valst, format);
+        vsnprintf(text, sizeof(text), format, valst);
+        va_end(valst);
+        write_text_record(level, text);
+        return;
+    }
+
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
+    const char *s;
     // 日志分级
     switch (level)
     {
     case 0:
-        strcpy(s, "[debug]:");
+        s = "[debug]:";
         break;
     case 1:
-        strcpy(s, "[info]:");
+        s = "[info]:";
         break;
     case 2:
-        strcpy(s, "[warn]:");
+        s = "[warn]:";
         break;
     case 3:
-        strcpy(s, "[erro]:");
+        s = "[erro]:";
         break;
     default:
-        strcpy(s, "[info]:");
+        s = "[info]:";
         break;
     }
-    // 写入一个log，对m_count++, m_split_lines最大行数
+
+    // 同一秒内复用已格式化的日期时间
+    if (t_time.sec != now.tv_sec)
+    {
+        struct tm my_tm;
+        localtime_r(&now.tv_sec, &my_tm);
+        snprintf(t_time.text, sizeof(t_time.text), "%d-%02d-%02d %02d:%02d:%02d",
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                 my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+        t_time.sec = now.tv_sec;
+    }
+
+    // 写入的具体时间内容格式，格式化到线程私有缓冲区，不需要加锁
+    int n = snprintf(t_line, 64, "%s.%06ld %s ", t_time.text, (long)now.tv_usec, s);
+
+    va_list valst;
+    va_start(valst, format);
+    int m = vsnprintf(t_line + n, m_log_buf_size - n - 1, format, valst);
+    va_end(valst);
+    if (m < 0)
+        m = 0;
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
+    t_line[n + m] = '\n';
+    size_t len = n + m + 1;
+
+    if (m_is_async && push_record(t_line, len))
+        return;
+
+    // 同步模式(或登记表已满)：直接一次write写入文件
+    struct iovec iov;
+    iov.iov_base = t_line;
+    iov.iov_len = len;
     m_mutex.lock();
-    // 更新现有行数
-    m_count++;
-    // 日志不是今天或写入的日志行数是最大行的倍数
-    // m_split_lines 为最大行数
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) // everyday log
-    {
-
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-        // 格式化日志名中的时间部分
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-        // 如果是时间不是今天，则创建今天的日志，更新m_today和m_count
-        if (m_today != my_tm.tm_mday)
+    write_all(&iov, 1);
+    account(len, 1);
+    m_mutex.unlock();
+}
+
+// 放入当前线程的环形缓冲区，线程登记表已满时返回false由调用方同步写入
+bool Log::push_record(const char *data, size_t len)
+{
+    log_ring *ring = thread_ring();
+    if (!ring)
+        return false;
+    // 缓冲区满时唤醒后台线程并短暂等待，仍然写不进去则丢弃，不阻塞请求线程
+    int retry = 0;
+    while (!ring->push(data, len))
+    {
+        if (!m_flush_requested.exchange(true))
+            m_flush_cond.signal();
+        if (++retry > 100)
         {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
+            m_dropped++;
+            return true;
         }
+        if (retry < 10)
+            sched_yield();
         else
-        {
-            // 超过了最大行，在之前的日志名基础上加后缀，m_count/m_split_lines
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
-        }
-        m_fp = fopen(new_log, "a");
+            usleep(100);
     }
+    // 缓冲区过半时请求提前刷盘
+    if (ring->used() > ring->capacity() / 2 && !m_flush_requested.load(std::memory_order_relaxed) &&
+        !m_flush_requested.exchange(true))
+        m_flush_cond.signal();
+    return true;
+}
 
+int Log::register_format(const char *format)
+{
+    log_format info;
+    if (!log_parse_format(format, &info))
+        return -1;
+    m_mutex.lock();
+    int id = m_format_count.load(std::memory_order_relaxed);
+    if (id >= MAX_LOG_FORMATS)
+    {
+        m_mutex.unlock();
+        return -1;
+    }
+    m_formats[id] = info;
+    m_format_count.store(id + 1, std::memory_order_release);
+    // 同步模式下没有后台线程，定义立即写入，保证先于使用它的记录
+    if (!m_is_async)
+        write_pending_formats();
     m_mutex.unlock();
+    return id;
+}
+
+void Log::write_binary(int id, int level, ...)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 
     va_list valst;
-    va_start(valst, format);
+    va_start(valst, level);
+    size_t len = log_encode_record(t_line, sizeof(t_line), m_formats[id], id, level, ns, valst);
+    va_end(valst);
+    if (len == 0)
+    {
+        // 参数超出单条记录的上限，退回到格式化后写0号格式串
+        char text[LOG_LINE_SIZE / 2];
+        va_start(valst, level);
+        vsnprintf(text, sizeof(text), m_formats[id].fmt, valst);
+        va_end(valst);
+        write_text_record(level, text);
+        return;
+    }
+
+    if (m_is_async && push_record(t_line, len))
+        return;
 
-    string log_str;
+    struct iovec iov;
+    iov.iov_base = t_line;
+    iov.iov_len = len;
+    m_mutex.lock();
+    write_pending_formats();
+    write_all(&iov, 1);
+    account(len, 1);
+    m_mutex.unlock();
+}
+
+void Log::write_text_record(int level, const char *text)
+{
+    write_binary(0, level, text);
+}
+
+void Log::flush(void)
+{
+    // 同步模式每行都已经write进内核，只有异步模式需要把缓冲区写出
+    if (!m_is_async)
+        return;
     m_mutex.lock();
+    drain_all();
+    m_mutex.unlock();
+}
 
-    // 写入的具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+void *Log::async_write_log()
+{
+    while (true)
+    {
+        m_flush_mutex.lock();
+        if (!m_flush_requested.load())
+        {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            long long ns = (long long)now.tv_usec * 1000 + (long long)LOG_FLUSH_INTERVAL_MS * 1000000;
+            struct timespec abstime;
+            abstime.tv_sec = now.tv_sec + ns / 1000000000;
+            abstime.tv_nsec = ns % 1000000000;
+            m_flush_cond.timewait(m_flush_mutex.get(), abstime);
+        }
+        m_flush_requested = false;
+        m_flush_mutex.unlock();
 
-    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+        m_mutex.lock();
+        drain_all();
+        bool rotate = rotation_due();
+        m_mutex.unlock();
+
+        if (rotate)
+            rotate_file();
+        if (m_sweep_pending.exchange(false))
+            sweep_old_segments();
+    }
+    return NULL;
+}
+
+log_ring *Log::thread_ring()
+{
+    if (t_ring.ring)
+        return t_ring.ring;
 
+    // 每个线程只在第一次写日志时加锁登记一次
+    log_ring *ring = new log_ring(m_ring_size);
+    m_mutex.lock();
+    if (m_ring_count >= MAX_LOG_THREADS)
+    {
+        m_mutex.unlock();
+        delete ring;
+        return NULL;
+    }
+    m_rings[m_ring_count++] = ring;
     m_mutex.unlock();
+    t_ring.ring = ring;
+    return ring;
+}
+
+// 把所有线程缓冲区中已提交的日志一次性写入文件
+// 环形缓冲区本身就是双缓冲：后台线程写出已提交的区域时，生产者继续写空闲区域
+void Log::drain_all()
+{
+    struct iovec iov[2 * MAX_LOG_THREADS];
+    size_t bytes[MAX_LOG_THREADS];
+    long long lines[MAX_LOG_THREADS];
+    bool retired[MAX_LOG_THREADS];
+    int iovcnt = 0;
+    long long total_lines = 0;
 
-    if (m_is_async && !m_log_queue->full())
+    for (int i = 0; i < m_ring_count; ++i)
     {
-        m_log_queue->push(log_str);
+        // 先读退出标记再取数据，保证看到线程退出前写入的全部内容
+        retired[i] = m_rings[i]->m_retired.load(std::memory_order_acquire);
+        iovcnt += m_rings[i]->peek(iov + iovcnt, &bytes[i], &lines[i]);
+        total_lines += lines[i];
     }
-    else
+
+    if (iovcnt > 0)
     {
+        // 记录引用的格式串都在写入记录之前登记，这里补写新登记的定义
+        if (m_binary)
+            write_pending_formats();
+        write_all(iov, iovcnt);
+        size_t total_bytes = 0;
+        for (int i = 0; i < m_ring_count; ++i)
+            total_bytes += bytes[i];
+        m_bytes += total_bytes;
+        m_count += total_lines;
+    }
+
+    for (int i = m_ring_count - 1; i >= 0; --i)
+    {
+        if (bytes[i] > 0)
+            m_rings[i]->consume(bytes[i], lines[i]);
+        if (retired[i])
+        {
+            // 线程已经退出，剩余内容已经全部写出
+            delete m_rings[i];
+            m_rings[i] = m_rings[--m_ring_count];
+        }
+    }
+}
+
+// 同步模式下请求线程调用：只累计并在需要切分时唤醒后台线程，不在请求线程上打开文件
+void Log::account(size_t bytes, long long lines)
+{
+    m_bytes += bytes;
+    m_count += lines;
+    if ((m_count >= m_split_lines || (m_max_file_bytes > 0 && m_bytes >= m_max_file_bytes)) &&
+        !m_flush_requested.load(std::memory_order_relaxed) && !m_flush_requested.exchange(true))
+        m_flush_cond.signal();
+}
+
+// 日志不是今天、行数或字节数超过上限时切换文件，需持有m_mutex
+bool Log::rotation_due()
+{
+    if (m_count >= m_split_lines || (m_max_file_bytes > 0 && m_bytes >= m_max_file_bytes))
+        return true;
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    return m_today != my_tm.tm_mday;
+}
+
+// 新文件在锁外打开，持锁期间只交换文件描述符，旧文件交给归档任务
+void Log::rotate_file()
+{
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    char tail[16] = {0};
+    // 格式化日志名中的时间部分
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+    bool new_day = m_today != my_tm.tm_mday;
+    int segment = new_day ? 0 : m_segment + 1;
+
+    // 当天的文件依次加后缀.1 .2 ...，跳过已经存在(或已被压缩)的序号，进程重启后不会覆盖旧文件
+    char new_log[256] = {0};
+    while (true)
+    {
+        if (segment == 0)
+            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
+        else
+            snprintf(new_log, 255, "%s%s%s.%d", dir_name, tail, log_name, segment);
+        string packed = string(new_log) + ".bundle";
+        if (access(new_log, F_OK) != 0 && access(packed.c_str(), F_OK) != 0)
+            break;
+        ++segment;
+    }
+
+    int fd = open(new_log, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd == -1)
+        return;
+
+    m_mutex.lock();
+    // 交换前把缓冲区中的内容写入旧文件
+    drain_all();
+    int old_fd = m_fd;
+    string old_path = m_cur_path;
+    m_fd = fd;
+    strcpy(m_cur_path, new_log);
+    m_today = my_tm.tm_mday;
+    m_segment = segment;
+    m_count = 0;
+    m_bytes = 0;
+    // 每个二进制文件都能单独解码：重新写文件头和全部格式串定义
+    if (m_binary)
+        write_binary_header();
+    m_mutex.unlock();
+
+    close(old_fd);
+    archive_segment(old_path);
+}
+
+void Log::archive_segment(const string &path)
+{
+    m_archive_mutex.lock();
+    m_archive_queue.push_back(path);
+    m_archive_mutex.unlock();
+    m_archive_cond.signal();
+}
+
+// 压缩整段日志要读写几十MB，放在最低优先级的独立线程上，CPU紧张时让给请求线程
+void Log::archive_loop()
+{
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    while (true)
+    {
+        m_archive_mutex.lock();
+        while (m_archive_queue.empty())
+            m_archive_cond.wait(m_archive_mutex.get());
+        string path = m_archive_queue.front();
+        m_archive_queue.pop_front();
+        m_archive_mutex.unlock();
+
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        archiver fn = m_archiver;
         m_mutex.unlock();
+        // 同一个文件可能被启动时的清扫和切分各提交一次
+        if (fn && !path.empty() && access(path.c_str(), F_OK) == 0)
+        {
+            // 进程重启后当天的首个文件可能再次被压缩，不覆盖已有的压缩包
+            string dst = path + ".bundle";
+            for (int k = 1; access(dst.c_str(), F_OK) == 0; ++k)
+                dst = path + "-" + to_string(k) + ".bundle";
+            if (fn(path, dst))
+                unlink(path.c_str());
+            else
+                unlink(dst.c_str());
+        }
+        prune_dir();
     }
+}
 
-    va_end(valst);
+// 按修改时间从旧到新删除本日志的文件，直到目录总大小不超过上限，当前文件不删除，只在归档线程调用
+void Log::prune_dir()
+{
+    m_mutex.lock();
+    string active = m_cur_path;
+    long long limit = m_max_total_bytes;
+    m_mutex.unlock();
+    if (limit <= 0)
+        return;
+
+    const char *dir = dir_name[0] ? dir_name : "./";
+    DIR *dp = opendir(dir);
+    if (!dp)
+        return;
+
+    vector<pair<time_t, pair<long long, string>>> files;
+    long long total = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != NULL)
+    {
+        if (!strstr(ent->d_name, log_name))
+            continue;
+        string path = string(dir_name) + ent->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        total += st.st_size;
+        if (path != active)
+            files.push_back(make_pair(st.st_mtime, make_pair((long long)st.st_size, path)));
+    }
+    closedir(dp);
+
+    sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size() && total > limit; ++i)
+    {
+        if (unlink(files[i].second.second.c_str()) == 0)
+            total -= files[i].second.first;
+    }
 }
 
-void Log::flush(void)
+// 启动时归档上次运行留下的未压缩文件
+void Log::sweep_old_segments()
 {
+    const char *dir = dir_name[0] ? dir_name : "./";
+    DIR *dp = opendir(dir);
+    if (!dp)
+        return;
+
     m_mutex.lock();
-    // 强制刷新写入流缓冲区
-    fflush(m_fp);
+    string active = m_cur_path;
     m_mutex.unlock();
+
+    vector<string> stale;
+    struct dirent *ent;
+    size_t suffix = strlen(".bundle");
+    while ((ent = readdir(dp)) != NULL)
+    {
+        size_t len = strlen(ent->d_name);
+        if (!strstr(ent->d_name, log_name) || (len > suffix && strcmp(ent->d_name + len - suffix, ".bundle") == 0))
+            continue;
+        string path = string(dir_name) + ent->d_name;
+        if (path != active)
+            stale.push_back(path);
+    }
+    closedir(dp);
+
+    for (size_t i = 0; i < stale.size(); ++i)
+        archive_segment(stale[i]);
+    if (stale.empty())
+        archive_segment(string());
+}
+
+// 文件头之后重写全部定义，进程重启追加到同一文件时编号以最新定义为准
+void Log::write_binary_header()
+{
+    struct iovec iov;
+    iov.iov_base = (void *)LOG_BINARY_MAGIC;
+    iov.iov_len = LOG_BINARY_MAGIC_LEN;
+    write_all(&iov, 1);
+    m_formats_written = 0;
+    write_pending_formats();
+}
+
+void Log::write_pending_formats()
+{
+    int count = m_format_count.load(std::memory_order_acquire);
+    char buf[LOG_LINE_SIZE];
+    while (m_formats_written < count)
+    {
+        size_t len = log_encode_format(buf, sizeof(buf), m_formats_written, m_formats[m_formats_written].fmt);
+        if (len > 0)
+        {
+            struct iovec iov;
+            iov.iov_base = buf;
+            iov.iov_len = len;
+            write_all(&iov, 1);
+        }
+        ++m_formats_written;
+    }
+}
+
+// writev可能只写出一部分，循环直到全部写完
+void Log::write_all(const struct iovec *iov_in, int iovcnt)
+{
+    struct iovec iov[IOV_MAX];
+    while (iovcnt > 0)
+    {
+        int batch = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+        memcpy(iov, iov_in, batch * sizeof(struct iovec));
+        iov_in += batch;
+        iovcnt -= batch;
+
+        struct iovec *cur = iov;
+        int left = batch;
+        while (left > 0)
+        {
+            ssize_t n = writev(m_fd, cur, left);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            while (left > 0 && (size_t)n >= cur->iov_len)
+            {
+                n -= cur->iov_len;
+                ++cur;
+                --left;
+            }
+            if (left > 0)
+            {
+                cur->iov_base = (char *)cur->iov_base + n;
+                cur->iov_len -= n;
+            }
+        }
+    }
+}
+
+void Log::set_level(int module, int level)
+{
+    if (module >= 0 && module < LOG_MOD_COUNT)
+        m_module_level[module].store(level, std::memory_order_relaxed);
+}
+
+bool Log::set_level(const char *module, const char *level)
+{
+    int lv;
+    if (strcasecmp(level, "debug") == 0)
+        lv = 0;
+    else if (strcasecmp(level, "info") == 0)
+        lv = 1;
+    else if (strcasecmp(level, "warn") == 0)
+        lv = 2;
+    else if (strcasecmp(level, "error") == 0)
+        lv = 3;
+    else if (strcasecmp(level, "off") == 0)
+        lv = 4;
+    else if (level[0] >= '0' && level[0] <= '4' && level[1] == '\0')
+        lv = level[0] - '0';
+    else
+        return false;
+
+    if (strcasecmp(module, "all") == 0)
+    {
+        for (int i = 0; i < LOG_MOD_COUNT; ++i)
+            set_level(i, lv);
+        return true;
+    }
+    for (int i = 0; i < LOG_MOD_COUNT; ++i)
+    {
+        if (strcasecmp(module, module_names[i]) == 0)
+        {
+            set_level(i, lv);
+            return true;
+        }
+    }
+    return false;
+}
+
+string Log::levels_to_json() const
+{
+    string json = "{";
+    for (int i = 0; i < LOG_MOD_COUNT; ++i)
+    {
+        if (i > 0)
+            json += ",";
+        json += "\"";
+        json += module_names[i];
+        json += "\":";
+        json += to_string(m_module_level[i].load(std::memory_order_relaxed));
+    }
+    json += ",\"min_level\":" + to_string(LOG_MIN_LEVEL) + "}";
+    return json;
 }
@@ -6,10 +6,79 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <time.h>
+#include "../lock/locker.h"
+#include "log_ring.h"
+#include "log_binary.h"
+#include "../metrics/flight_recorder.h"
 
 using namespace std;
 
+// 编译期最低日志级别，低于该级别的LOG_*调用在编译时被整体去掉
+// 0:debug 1:info 2:warn 3:error，可通过 make LOG_MIN_LEVEL=1 指定
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+// 日志模块，每个模块的运行期级别可以单独调整
+// 源文件在包含头文件之后重新定义LOG_MODULE即可归入对应模块
+enum log_module
+{
+    LOG_MOD_DEFAULT = 0,
+    LOG_MOD_SERVER,  // webserver 事件循环、连接管理
+    LOG_MOD_HTTP,    // http 报文解析与响应
+    LOG_MOD_TIMER,   // 定时器
+    LOG_MOD_SQL,     // 数据库连接池
+    LOG_MOD_STORAGE, // 存储系统
+    LOG_MOD_COUNT
+};
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MOD_DEFAULT
+#endif
+
+// 令牌桶限流(GCRA实现，只用一个原子变量)，用于热点路径上的日志
+// 每秒最多 rate 条，允许突发 burst 条，被限流的条数在下一次放行时汇总输出
+class log_rate_limiter
+{
+public:
+    log_rate_limiter(int rate, int burst)
+        : m_interval_ns(1000000000LL / (rate > 0 ? rate : 1)),
+          m_tolerance_ns(m_interval_ns * (burst > 0 ? burst - 1 : 0)),
+          m_tat(0), m_suppressed(0)
+    {
+    }
+    // 放行时通过suppressed返回此前被限流的条数
+    bool allow(long long *suppressed)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        long long now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        long long tat = m_tat.load(std::memory_order_relaxed);
+        while (true)
+        {
+            long long base = tat > now ? tat : now;
+            if (base - now > m_tolerance_ns)
+            {
+                m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (m_tat.compare_exchange_weak(tat, base + m_interval_ns, std::memory_order_relaxed))
+                break;
+        }
+        *suppressed = m_suppressed.load(std::memory_order_relaxed) ? m_suppressed.exchange(0) : 0;
+        return true;
+    }
+
+private:
+    const long long m_interval_ns;
+    const long long m_tolerance_ns;
+    std::atomic<long long> m_tat; // 理论到达时间
+    std::atomic<long long> m_suppressed;
+};
+
 class Log
 {
 public:
@@ -22,69 +91,168 @@ public:
     // 异步写日志公有方法，调用私有方法async_write_log
     static void *flush_log_thread(void *args)
     {
+        flight_recorder::install_alt_stack();
         Log::get_instance()->async_write_log();
+        return NULL;
+    }
+    static void *archive_thread(void *args)
+    {
+        flight_recorder::install_alt_stack();
+        Log::get_instance()->archive_loop();
+        return NULL;
     }
     // 可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    // max_queue_size>=1 为异步模式，每个线程的环形缓冲区按 max_queue_size 行估算大小
+    // binary为true时写二进制日志(文件名加.bin后缀)，由logdecode工具还原为文本
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0, bool binary = false);
     // 将输出内容按照标准格式整理
     void write_log(int level, const char *format, ...);
-    // 强制刷新缓冲区
+
+    // 二进制模式：每个调用点登记一次格式串(必须是静态存储的字符串)，返回编号
+    // 格式串含不支持的转换说明或登记表已满时返回-1，调用方改用write_log
+    bool is_binary() const { return m_binary; }
+    int register_format(const char *format);
+    // 只记录编号、时间戳和原始参数，不做格式化
+    void write_binary(int id, int level, ...);
+    // 强制把所有线程缓冲区中的日志写入文件
     void flush(void);
 
+    // 滚动出的日志段的归档函数：把src压缩为dst，成功返回true后由日志系统删除src
+    typedef std::function<bool(const string &src, const string &dst)> archiver;
+    // 按字节数切分文件(0为不限)，日志目录总大小上限(0为不限)，归档函数可以为空
+    // 切分、归档和清理都在后台完成，请求线程只负责累计字节数
+    // 压缩在单独的低优先级归档线程上按顺序进行，不占用刷盘线程和后台执行器
+    void set_rotation(long long max_file_bytes, long long max_total_bytes, archiver fn);
+    // 异步模式下缓冲区满被丢弃的行数
+    long long get_dropped_lines() const { return m_dropped.load(); }
+
+    // 运行期日志级别，按模块调整，无需重启
+    bool enabled(int module, int level) const
+    {
+        return level >= m_module_level[module].load(std::memory_order_relaxed);
+    }
+    void set_level(int module, int level);
+    // 按名字设置，module为"all"时设置全部模块；级别可以是数字或debug/info/warn/error/off
+    bool set_level(const char *module, const char *level);
+    // {"default":0,"server":1,...}
+    string levels_to_json() const;
+
+    static const int MAX_LOG_THREADS = 256;       // 最多登记的写日志线程数
+    static const int LOG_LINE_SIZE = 8192;        // 单行日志的最大长度
+    static const int LOG_FLUSH_INTERVAL_MS = 200; // 后台线程定时刷盘间隔
+    static const int MAX_LOG_FORMATS = 4096;      // 二进制模式最多登记的格式串数
+
 private:
     Log();
     virtual ~Log();
-    // 异步写日志方法
-    void *async_write_log()
-    {
-        string single_log;
-        // 从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
-        {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    // 后台线程：定时或在某个线程缓冲区过半时被唤醒，把所有线程的缓冲区一次writev写入文件
+    // 同步模式下也会启动，负责切分文件和归档
+    void *async_write_log();
+    // 当前线程的环形缓冲区，首次调用时创建并登记
+    log_ring *thread_ring();
+    // 以下需持有m_mutex
+    void drain_all();
+    // 累计写入量，达到切分条件时唤醒后台线程
+    void account(size_t bytes, long long lines);
+    void write_all(const struct iovec *iov, int iovcnt);
+    // 以下只在后台线程调用
+    bool rotation_due();
+    void rotate_file();
+    // 把日志段交给归档线程，path为空时只清理目录
+    void archive_segment(const string &path);
+    // 归档线程：逐个压缩队列中的日志段并清理目录
+    void archive_loop();
+    void prune_dir();
+    void sweep_old_segments();
+    void write_binary_header();
+    void write_pending_formats();
+    // 二进制模式下写入一行已经格式化好的文本(格式串无法登记时的退路)
+    void write_text_record(int level, const char *text);
+    // 把一条记录放入当前线程的缓冲区，异步模式失败时返回false
+    bool push_record(const char *data, size_t len);
 
 private:
     char dir_name[128]; // 路径名
     char log_name[128]; // log文件名
     int m_split_lines;  // 日志最大行数
     int m_log_buf_size; // 日志缓冲区大小
-    long long m_count;  // 日志行数记录
+    long long m_count;  // 当前文件的日志行数
+    long long m_bytes;  // 当前文件的字节数
     int m_today;        // 因为按天分类,记录当前时间是那一天
-    FILE *m_fp;         // 打开log的文件指针
-    char *m_buf;
-    block_queue<string> *m_log_queue; // 阻塞队列
-    bool m_is_async;                  // 是否同步标志位
-    locker m_mutex;
-    int m_close_log; // 关闭日志
+    int m_segment;      // 当天的文件序号
+    char m_cur_path[256]; // 当前写入的文件
+    int m_fd;           // 打开log的文件描述符
+    bool m_is_async;    // 是否同步标志位
+    locker m_mutex;     // 保护文件、行数和线程缓冲区登记表
+    int m_close_log;    // 关闭日志
+
+    size_t m_ring_size;                    // 每个线程环形缓冲区的字节数
+    log_ring *m_rings[MAX_LOG_THREADS];    // 已登记的线程缓冲区
+    int m_ring_count;
+    locker m_flush_mutex;                  // 配合m_flush_cond使用
+    cond m_flush_cond;                     // 唤醒后台刷盘线程
+    std::atomic<bool> m_flush_requested;   // 已有线程请求刷盘
+    std::atomic<long long> m_dropped;      // 丢弃的行数
+    std::atomic<int> m_module_level[LOG_MOD_COUNT]; // 各模块的运行期最低级别
+
+    bool m_binary;                         // 是否写二进制日志
+    log_format m_formats[MAX_LOG_FORMATS]; // 已登记的格式串，编号即下标，0号保留给"%s"
+    std::atomic<int> m_format_count;
+    int m_formats_written;                 // 当前文件中已经写入定义的格式串数，需持有m_mutex
+
+    long long m_max_file_bytes;            // 单个文件的字节上限
+    long long m_max_total_bytes;           // 日志目录的总大小上限
+    archiver m_archiver;
+    locker m_archive_mutex;                // 保护归档队列
+    cond m_archive_cond;                   // 唤醒归档线程
+    std::deque<string> m_archive_queue;    // 待归档的日志段
+    bool m_archive_started;                // 归档线程已启动，需持有m_archive_mutex
+    std::atomic<bool> m_sweep_pending;     // 需要归档上次运行遗留的文件
 };
 // 这四个宏定义在其他文件中使用，主要用于不同类型的日志输出
-#define LOG_DEBUG(format, ...)                                    \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(0, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
-    }
-#define LOG_INFO(format, ...)                                     \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(1, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
-    }
-#define LOG_WARN(format, ...)                                     \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(2, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
+// 刷盘由后台线程按时间和缓冲区水位决定，不再逐行flush
+// 级别低于LOG_MIN_LEVEL时条件在编译期为假，整个调用被优化掉
+// 二进制模式下每个调用点在第一次执行时登记格式串，之后只记录编号和参数
+#define LOG_EMIT(level, format, ...)                                                               \
+    if (Log::get_instance()->is_binary())                                                          \
+    {                                                                                              \
+        static const int log_fmt_id_ = Log::get_instance()->register_format(format);               \
+        if (log_fmt_id_ >= 0)                                                                      \
+            Log::get_instance()->write_binary(log_fmt_id_, level, ##__VA_ARGS__);                  \
+        else                                                                                       \
+            Log::get_instance()->write_log(level, format, ##__VA_ARGS__);                          \
+    }                                                                                              \
+    else                                                                                           \
+        Log::get_instance()->write_log(level, format, ##__VA_ARGS__);
+
+#define LOG_BASE(level, format, ...)                                                                       \
+    if (level >= LOG_MIN_LEVEL && 0 == m_close_log && Log::get_instance()->enabled(LOG_MODULE, level)) \
+    {                                                                                                      \
+        LOG_EMIT(level, format, ##__VA_ARGS__)                                                             \
     }
-#define LOG_ERROR(format, ...)                                    \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(3, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
+#define LOG_DEBUG(format, ...) LOG_BASE(0, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(1, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(2, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(3, format, ##__VA_ARGS__)
+
+// 热点路径使用的限流版本，每个调用点一个令牌桶：每秒最多rate条，突发burst条
+#define LOG_RATE_LIMITED(level, rate, burst, format, ...)                                                  \
+    if (level >= LOG_MIN_LEVEL && 0 == m_close_log && Log::get_instance()->enabled(LOG_MODULE, level)) \
+    {                                                                                                      \
+        static log_rate_limiter log_limiter_(rate, burst);                                                 \
+        long long log_suppressed_ = 0;                                                                     \
+        if (log_limiter_.allow(&log_suppressed_))                                                          \
+        {                                                                                                  \
+            if (log_suppressed_ > 0)                                                                       \
+            {                                                                                              \
+                LOG_EMIT(level, "(%lld similar messages suppressed)", log_suppressed_)                     \
+            }                                                                                              \
+            LOG_EMIT(level, format, ##__VA_ARGS__)                                                         \
+        }                                                                                                  \
     }
+#define LOG_DEBUG_RL(rate, burst, format, ...) LOG_RATE_LIMITED(0, rate, burst, format, ##__VA_ARGS__)
+#define LOG_INFO_RL(rate, burst, format, ...) LOG_RATE_LIMITED(1, rate, burst, format, ##__VA_ARGS__)
+#define LOG_WARN_RL(rate, burst, format, ...) LOG_RATE_LIMITED(2, rate, burst, format, ##__VA_ARGS__)
+#define LOG_ERROR_RL(rate, burst, format, ...) LOG_RATE_LIMITED(3, rate, burst, format, ##__VA_ARGS__)
 
 #endif
@@ -0,0 +1,367 @@
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "log_binary.h"
+
+namespace
+{
+    // 解析一个转换说明，p指向'%'之后，返回转换字符位置，spec_kinds返回需要的参数
+    // '*'宽度/精度各占一个int参数
+    const char *parse_spec(const char *p, unsigned char *kinds, int *n, bool *ok)
+    {
+        *ok = true;
+        while (*p && strchr("-+ #0'", *p))
+            ++p;
+        if (*p == '*')
+        {
+            kinds[(*n)++] = LOG_ARG_INT;
+            ++p;
+        }
+        else
+            while (*p >= '0' && *p <= '9')
+                ++p;
+        if (*p == '.')
+        {
+            ++p;
+            if (*p == '*')
+            {
+                kinds[(*n)++] = LOG_ARG_INT;
+                ++p;
+            }
+            else
+                while (*p >= '0' && *p <= '9')
+                    ++p;
+        }
+        int longs = 0;
+        bool big_float = false;
+        bool wide = false; // z/j/t 都是8字节
+        while (*p && strchr("hlLqjzt", *p))
+        {
+            if (*p == 'l')
+                ++longs;
+            else if (*p == 'L' || *p == 'q')
+                big_float = true, ++longs;
+            else if (*p == 'z' || *p == 'j' || *p == 't')
+                wide = true;
+            ++p;
+        }
+        if (*n >= log_format::MAX_ARGS)
+        {
+            *ok = false;
+            return p;
+        }
+        switch (*p)
+        {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            kinds[(*n)++] = (longs > 0 || wide) ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            kinds[(*n)++] = big_float ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            kinds[(*n)++] = LOG_ARG_STR;
+            break;
+        case 'p':
+            kinds[(*n)++] = LOG_ARG_PTR;
+            break;
+        default:
+            // %n、%ls 等不支持
+            *ok = false;
+            break;
+        }
+        return p;
+    }
+
+    template <typename T>
+    bool put(char *&dst, char *end, T v)
+    {
+        if (end - dst < (ptrdiff_t)sizeof(T))
+            return false;
+        memcpy(dst, &v, sizeof(T));
+        dst += sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    bool get(const char *&src, const char *end, T *v)
+    {
+        if (end - src < (ptrdiff_t)sizeof(T))
+            return false;
+        memcpy(v, src, sizeof(T));
+        src += sizeof(T);
+        return true;
+    }
+}
+
+bool log_parse_format(const char *fmt, log_format *info)
+{
+    info->fmt = fmt;
+    info->nargs = 0;
+    for (const char *p = fmt; *p; ++p)
+    {
+        if (*p != '%')
+            continue;
+        if (p[1] == '%')
+        {
+            ++p;
+            continue;
+        }
+        bool ok;
+        p = parse_spec(p + 1, info->kinds, &info->nargs, &ok);
+        if (!ok || !*p)
+        {
+            info->nargs = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t log_encode_format(char *buf, size_t cap, int id, const char *fmt)
+{
+    size_t len = strlen(fmt);
+    if (len > 0xffff)
+        len = 0xffff;
+    char *dst = buf, *end = buf + cap;
+    if (!put<char>(dst, end, 'F') || !put<uint16_t>(dst, end, id) || !put<uint16_t>(dst, end, len) ||
+        (size_t)(end - dst) < len)
+        return 0;
+    memcpy(dst, fmt, len);
+    return dst + len - buf;
+}
+
+size_t log_encode_record(char *buf, size_t cap, const log_format &info, int id, int level,
+                         uint64_t ts_ns, va_list ap)
+{
+    const size_t header = 1 + 2 + 1 + 8 + 2;
+    if (cap < header)
+        return 0;
+    char *dst = buf + header;
+    char *end = buf + cap;
+    for (int i = 0; i < info.nargs; ++i)
+    {
+        bool ok = true;
+        switch (info.kinds[i])
+        {
+        case LOG_ARG_INT:
+            ok = put<int32_t>(dst, end, va_arg(ap, int));
+            break;
+        case LOG_ARG_LONG:
+            ok = put<int64_t>(dst, end, va_arg(ap, long long));
+            break;
+        case LOG_ARG_DOUBLE:
+            ok = put<double>(dst, end, va_arg(ap, double));
+            break;
+        case LOG_ARG_LDOUBLE:
+            ok = put<long double>(dst, end, va_arg(ap, long double));
+            break;
+        case LOG_ARG_PTR:
+            ok = put<uint64_t>(dst, end, (uint64_t)(uintptr_t)va_arg(ap, void *));
+            break;
+        case LOG_ARG_STR:
+        {
+            const char *s = va_arg(ap, const char *);
+            if (!s)
+                s = "(null)";
+            size_t len = strlen(s);
+            size_t room = end - dst;
+            if (room < 2)
+                return 0;
+            // 超长字符串截断，不让一条日志失败
+            if (len > room - 2)
+                len = room - 2;
+            if (len > 0xffff)
+                len = 0xffff;
+            put<uint16_t>(dst, end, len);
+            memcpy(dst, s, len);
+            dst += len;
+            break;
+        }
+        }
+        if (!ok)
+            return 0;
+    }
+    size_t payload = dst - (buf + header);
+    if (payload > 0xffff)
+        return 0;
+    char *h = buf;
+    put<char>(h, end, 'L');
+    put<uint16_t>(h, end, id);
+    put<uint8_t>(h, end, level);
+    put<uint64_t>(h, end, ts_ns);
+    put<uint16_t>(h, end, payload);
+    return dst - buf;
+}
+
+bool log_render_payload(const char *fmt, const char *payload, size_t len, std::string *out)
+{
+    const char *src = payload;
+    const char *end = payload + len;
+    char spec[64];
+    char tmp[512];
+    for (const char *p = fmt; *p; ++p)
+    {
+        if (*p != '%')
+        {
+            out->push_back(*p);
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out->push_back('%');
+            ++p;
+            continue;
+        }
+        // 复制转换说明，'*'替换为记录中的int值，长度修饰符单独记录
+        // 整数有l/ll/z/j/t修饰时按8字节记录，L/q修饰的浮点按long double记录
+        size_t k = 0;
+        spec[k++] = '%';
+        bool wide = false;
+        bool big = false;
+        const char *q = p + 1;
+        for (; *q && !strchr("diuxXocfFeEgGaAsp", *q); ++q)
+        {
+            if (*q == '*')
+            {
+                int32_t v;
+                if (!get(src, end, &v))
+                    return false;
+                k += snprintf(spec + k, sizeof(spec) - k, "%d", v);
+            }
+            else if (strchr("hlLqjzt", *q))
+            {
+                if (*q == 'L' || *q == 'q')
+                    big = true;
+                if (*q != 'h')
+                    wide = true;
+            }
+            else if (k < sizeof(spec) - 4)
+                spec[k++] = *q;
+        }
+        if (!*q)
+            return false;
+        char conv = *q;
+        p = q;
+        int n = 0;
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+        {
+            if (wide)
+            {
+                int64_t v;
+                if (!get(src, end, &v))
+                    return false;
+                spec[k++] = 'l';
+                spec[k++] = 'l';
+                spec[k++] = conv;
+                spec[k] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, (long long)v);
+            }
+            else
+            {
+                int32_t v;
+                if (!get(src, end, &v))
+                    return false;
+                spec[k++] = conv;
+                spec[k] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, (int)v);
+            }
+            break;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+            if (big)
+            {
+                long double v;
+                if (!get(src, end, &v))
+                    return false;
+                spec[k++] = 'L';
+                spec[k++] = conv;
+                spec[k] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, v);
+            }
+            else
+            {
+                double v;
+                if (!get(src, end, &v))
+                    return false;
+                spec[k++] = conv;
+                spec[k] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, v);
+            }
+            break;
+        }
+        case 'p':
+        {
+            uint64_t v;
+            if (!get(src, end, &v))
+                return false;
+            spec[k++] = 'p';
+            spec[k] = '\0';
+            n = snprintf(tmp, sizeof(tmp), spec, (void *)(uintptr_t)v);
+            break;
+        }
+        case 's':
+        {
+            uint16_t slen;
+            if (!get(src, end, &slen) || end - src < slen)
+                return false;
+            std::string s(src, slen);
+            src += slen;
+            spec[k++] = 's';
+            spec[k] = '\0';
+            // 字符串可能很长，单独计算需要的空间
+            int need = snprintf(NULL, 0, spec, s.c_str());
+            std::string buf(need + 1, '\0');
+            snprintf(&buf[0], need + 1, spec, s.c_str());
+            out->append(buf.c_str(), need);
+            continue;
+        }
+        }
+        if (n > 0)
+            out->append(tmp, n < (int)sizeof(tmp) ? n : (int)sizeof(tmp) - 1);
+    }
+    return true;
+}
+
+void log_render_prefix(uint64_t ts_ns, int level, std::string *out)
+{
+    static const char *levels[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+    time_t sec = ts_ns / 1000000000ULL;
+    long usec = (ts_ns % 1000000000ULL) / 1000;
+    struct tm my_tm;
+    localtime_r(&sec, &my_tm);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+             my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+             my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, usec,
+             (level >= 0 && level <= 3) ? levels[level] : levels[1]);
+    out->append(buf);
+}
@@ -0,0 +1,58 @@
+/*************************************************************
+ *二进制日志格式
+ *热点路径只记录格式串编号、时间戳和原始参数，不做任何格式化
+ *格式串在登记时解析出参数类型，渲染由logdecode工具离线完成
+ *
+ *文件布局(小端)：
+ *  文件头   "TWSBLOG1"
+ *  格式定义 'F' u16:id u16:len fmt[len]
+ *  日志记录 'L' u16:id u8:level u64:纳秒时间戳 u16:len payload[len]
+ *payload 依次存放参数：整数4/8字节，浮点8/16字节，指针8字节，字符串 u16:len + 内容
+ **************************************************************/
+
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define LOG_BINARY_MAGIC "TWSBLOG1"
+#define LOG_BINARY_MAGIC_LEN 8
+
+enum log_arg_kind
+{
+    LOG_ARG_INT = 0, // int 及更窄的整数、char
+    LOG_ARG_LONG,    // long/long long/size_t 等8字节整数
+    LOG_ARG_DOUBLE,
+    LOG_ARG_LDOUBLE,
+    LOG_ARG_PTR,
+    LOG_ARG_STR
+};
+
+struct log_format
+{
+    static const int MAX_ARGS = 16;
+    const char *fmt;
+    int nargs;                  // -1 表示格式串无法用二进制方式记录
+    unsigned char kinds[MAX_ARGS];
+};
+
+// 登记时调用：解析printf格式串得到参数类型序列
+bool log_parse_format(const char *fmt, log_format *info);
+
+// 热点路径：把一条日志编码为'L'记录，返回写入的字节数，空间不足返回0
+size_t log_encode_record(char *buf, size_t cap, const log_format &info, int id, int level,
+                         uint64_t ts_ns, va_list ap);
+
+// 编码一条'F'格式定义记录
+size_t log_encode_format(char *buf, size_t cap, int id, const char *fmt);
+
+// 离线渲染：把payload按格式串还原为文本(不含时间戳和级别前缀)
+bool log_render_payload(const char *fmt, const char *payload, size_t len, std::string *out);
+
+// 渲染与文本日志一致的行前缀 "2025-08-07 10:00:00.123456 [info]: "
+void log_render_prefix(uint64_t ts_ns, int level, std::string *out);
+
+#endif
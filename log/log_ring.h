@@ -0,0 +1,98 @@
+/*************************************************************
+ *单生产者单消费者的无锁字节环形缓冲区
+ *每个写日志的线程独占一个，后台刷盘线程是唯一的消费者
+ *生产者写完数据后 release 发布 m_head，消费者 acquire 读取；反之亦然
+ **************************************************************/
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <string.h>
+#include <sys/uio.h>
+
+class log_ring
+{
+public:
+    // capacity 必须是2的幂
+    explicit log_ring(size_t capacity)
+        : m_retired(false), m_capacity(capacity), m_mask(capacity - 1), m_buf(new char[capacity]),
+          m_head(0), m_lines(0), m_tail(0), m_lines_consumed(0)
+    {
+    }
+    ~log_ring()
+    {
+        delete[] m_buf;
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+    // 生产者：当前已写入未消费的字节数
+    size_t used() const
+    {
+        return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire);
+    }
+
+    // 生产者：写入一行，空间不足时返回false，不写入任何内容
+    bool push(const char *data, size_t len)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        if (m_capacity - (head - tail) < len)
+            return false;
+        size_t pos = head & m_mask;
+        size_t first = m_capacity - pos < len ? m_capacity - pos : len;
+        memcpy(m_buf + pos, data, first);
+        if (first < len)
+            memcpy(m_buf, data + first, len - first);
+        m_lines.store(m_lines.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_head.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    // 消费者：取出当前可读的数据，最多两段(环绕时)，返回段数
+    int peek(struct iovec iov[2], size_t *bytes, long long *lines)
+    {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        *lines = m_lines.load(std::memory_order_relaxed) - m_lines_consumed;
+        *bytes = head - tail;
+        if (*bytes == 0)
+            return 0;
+        size_t pos = tail & m_mask;
+        size_t first = m_capacity - pos < *bytes ? m_capacity - pos : *bytes;
+        iov[0].iov_base = m_buf + pos;
+        iov[0].iov_len = first;
+        if (first == *bytes)
+            return 1;
+        iov[1].iov_base = m_buf;
+        iov[1].iov_len = *bytes - first;
+        return 2;
+    }
+
+    // 消费者：释放已经写入文件的数据
+    void consume(size_t bytes, long long lines)
+    {
+        m_lines_consumed += lines;
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + bytes, std::memory_order_release);
+    }
+
+    // 所属线程退出后置位，消费者清空后负责释放
+    std::atomic<bool> m_retired;
+
+private:
+    log_ring(const log_ring &) = delete;
+    log_ring &operator=(const log_ring &) = delete;
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    char *m_buf;
+
+    // 生产者和消费者各自改写的字段放在不同的缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> m_head;
+    std::atomic<long long> m_lines;
+    alignas(64) std::atomic<size_t> m_tail;
+    long long m_lines_consumed;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*************************************************************
+ *二进制日志解码工具
+ *把 Log 二进制模式写出的 .bin 文件还原为与文本日志相同格式的行
+ *用法: ./logdecode ServerLog.bin [更多文件...]，不带参数时读标准输入
+ **************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "log_binary.h"
+
+namespace
+{
+    bool read_all(FILE *fp, std::string *data)
+    {
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            data->append(buf, n);
+        return !ferror(fp);
+    }
+
+    template <typename T>
+    T load(const char *p)
+    {
+        T v;
+        memcpy(&v, p, sizeof(T));
+        return v;
+    }
+
+    // 返回解码出的记录数，遇到截断或损坏的记录时停止并返回-1
+    long long decode(const std::string &data, const char *name)
+    {
+        std::map<int, std::string> formats;
+        std::string line;
+        long long records = 0;
+        size_t pos = 0;
+        while (pos < data.size())
+        {
+            // 进程重启或文件切分时会再次写入文件头，后面跟着新的格式串定义
+            if (data.size() - pos >= LOG_BINARY_MAGIC_LEN &&
+                memcmp(data.data() + pos, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) == 0)
+            {
+                pos += LOG_BINARY_MAGIC_LEN;
+                continue;
+            }
+            const char *p = data.data() + pos;
+            size_t left = data.size() - pos;
+            if (p[0] == 'F' && left >= 5)
+            {
+                int id = load<uint16_t>(p + 1);
+                size_t len = load<uint16_t>(p + 3);
+                if (left < 5 + len)
+                    break;
+                formats[id].assign(p + 5, len);
+                pos += 5 + len;
+                continue;
+            }
+            if (p[0] == 'L' && left >= 14)
+            {
+                int id = load<uint16_t>(p + 1);
+                int level = load<uint8_t>(p + 3);
+                uint64_t ns = load<uint64_t>(p + 4);
+                size_t len = load<uint16_t>(p + 12);
+                if (left < 14 + len)
+                    break;
+                line.clear();
+                log_render_prefix(ns, level, &line);
+                std::map<int, std::string>::iterator it = formats.find(id);
+                if (it == formats.end() || !log_render_payload(it->second.c_str(), p + 14, len, &line))
+                    line += "<undecodable record, format " + std::to_string(id) + ">";
+                line.push_back('\n');
+                fwrite(line.data(), 1, line.size(), stdout);
+                pos += 14 + len;
+                ++records;
+                continue;
+            }
+            if (p[0] != 'F' && p[0] != 'L')
+            {
+                fprintf(stderr, "%s: corrupt record at offset %zu\n", name, pos);
+                return -1;
+            }
+            break;
+        }
+        if (pos < data.size())
+        {
+            // 进程崩溃时最后一条记录可能只写了一半
+            fprintf(stderr, "%s: truncated record at offset %zu\n", name, pos);
+            return -1;
+        }
+        return records;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; ++i)
+        files.push_back(argv[i]);
+    if (files.empty())
+        files.push_back("-");
+
+    int ret = 0;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        bool is_stdin = strcmp(files[i], "-") == 0;
+        FILE *fp = is_stdin ? stdin : fopen(files[i], "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "%s: open failed\n", files[i]);
+            ret = 1;
+            continue;
+        }
+        std::string data;
+        bool ok = read_all(fp, &data);
+        if (!is_stdin)
+            fclose(fp);
+        if (!ok)
+        {
+            fprintf(stderr, "%s: read failed\n", files[i]);
+            ret = 1;
+            continue;
+        }
+        if (data.size() < LOG_BINARY_MAGIC_LEN || memcmp(data.data(), LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) != 0)
+        {
+            fprintf(stderr, "%s: not a binary log file\n", files[i]);
+            ret = 1;
+            continue;
+        }
+        if (decode(data, files[i]) < 0)
+            ret = 1;
+    }
+    return ret;
+}
@@ -21,6 +21,7 @@ int main(int argc, char *argv[])
 
     //日志
     server.log_write();
+    Log::get_instance()->set_level("all", to_string(config.log_level).c_str());
 
     //数据库
     server.sql_pool();
@@ -0,0 +1,209 @@
+#include "connections.h"
+#include <time.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const char *state_names[CONN_STATE_COUNT] = {"closed", "idle", "reading", "processing", "writing"};
+
+    long long wall_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+
+    struct conn_snapshot
+    {
+        int fd;
+        int state;
+        uint32_t ip;
+        uint32_t port;
+        long long accept_ms;
+        long long bytes_in;
+        long long bytes_out;
+        long long requests;
+    };
+}
+
+conn_registry::conn_registry() : m_max_fd(-1)
+{
+    m_slots = new slot[MAX_CONNS];
+    for (int i = 0; i < MAX_CONNS; ++i)
+    {
+        m_slots[i].state.store(CONN_CLOSED, std::memory_order_relaxed);
+        m_slots[i].gen.store(0, std::memory_order_relaxed);
+        m_slots[i].peer_ip.store(0, std::memory_order_relaxed);
+        m_slots[i].peer_port.store(0, std::memory_order_relaxed);
+        m_slots[i].accept_ms.store(0, std::memory_order_relaxed);
+        m_slots[i].bytes_in.store(0, std::memory_order_relaxed);
+        m_slots[i].bytes_out.store(0, std::memory_order_relaxed);
+        m_slots[i].requests.store(0, std::memory_order_relaxed);
+    }
+
+    metrics_registry *r = metrics_registry::get_instance();
+    m_open = r->add_gauge("tws_active_connections", "Currently open client connections");
+    m_accepted = r->add_counter("tws_connections_accepted_total", "Client connections accepted");
+    m_bytes_in = r->add_counter("tws_received_bytes_total", "Bytes read from client sockets");
+    m_bytes_out = r->add_counter("tws_sent_bytes_total", "Bytes written to client sockets");
+}
+
+unsigned conn_registry::on_accept(int fd, const sockaddr_in &addr)
+{
+    slot *s = slot_of(fd);
+    if (!s)
+        return 0;
+    unsigned gen = s->gen.load(std::memory_order_relaxed) + 1;
+    s->gen.store(gen, std::memory_order_release);
+    s->peer_ip.store(addr.sin_addr.s_addr, std::memory_order_relaxed);
+    s->peer_port.store(ntohs(addr.sin_port), std::memory_order_relaxed);
+    s->accept_ms.store(wall_ms(), std::memory_order_relaxed);
+    s->bytes_in.store(0, std::memory_order_relaxed);
+    s->bytes_out.store(0, std::memory_order_relaxed);
+    s->requests.store(0, std::memory_order_relaxed);
+    // 上一个使用该fd的连接可能没走到on_close(例如服务器繁忙时直接关闭)，此时不重复计数
+    if (s->state.exchange(CONN_IDLE, std::memory_order_release) == CONN_CLOSED && m_open)
+        m_open->inc();
+    if (m_accepted)
+        m_accepted->inc();
+    if (fd > m_max_fd.load(std::memory_order_relaxed))
+        m_max_fd.store(fd, std::memory_order_release);
+    return gen;
+}
+
+void conn_registry::on_close(int fd, unsigned gen)
+{
+    slot *s = slot_of(fd);
+    if (!s)
+        return;
+    // 旧连接迟到的关闭，fd已经属于新连接
+    if (s->gen.load(std::memory_order_acquire) != gen)
+        return;
+    if (s->state.exchange(CONN_CLOSED, std::memory_order_acq_rel) != CONN_CLOSED && m_open)
+        m_open->dec();
+}
+
+unsigned conn_registry::generation(int fd)
+{
+    slot *s = slot_of(fd);
+    return s ? s->gen.load(std::memory_order_acquire) : 0;
+}
+
+void conn_registry::set_state(int fd, int state)
+{
+    slot *s = slot_of(fd);
+    if (!s)
+        return;
+    // 已关闭的连接不能被迟到的工作线程重新置为打开
+    int cur = s->state.load(std::memory_order_relaxed);
+    while (cur != CONN_CLOSED && !s->state.compare_exchange_weak(cur, state, std::memory_order_relaxed))
+        ;
+}
+
+void conn_registry::add_bytes_in(int fd, long long n)
+{
+    slot *s = slot_of(fd);
+    if (!s || n <= 0)
+        return;
+    bump(s->bytes_in, n);
+    if (m_bytes_in)
+        m_bytes_in->inc(n);
+}
+
+void conn_registry::add_bytes_out(int fd, long long n)
+{
+    slot *s = slot_of(fd);
+    if (!s || n <= 0)
+        return;
+    bump(s->bytes_out, n);
+    if (m_bytes_out)
+        m_bytes_out->inc(n);
+}
+
+void conn_registry::add_request(int fd)
+{
+    slot *s = slot_of(fd);
+    if (s)
+        bump(s->requests, 1);
+}
+
+long long conn_registry::open_count() const
+{
+    return m_open ? m_open->value() : 0;
+}
+
+Json::Value conn_registry::to_json() const
+{
+    std::vector<conn_snapshot> conns;
+    int states[CONN_STATE_COUNT] = {0};
+    int max_fd = m_max_fd.load(std::memory_order_acquire);
+    for (int fd = 0; fd <= max_fd; ++fd)
+    {
+        const slot &s = m_slots[fd];
+        int state = s.state.load(std::memory_order_acquire);
+        if (state == CONN_CLOSED)
+            continue;
+        conn_snapshot c;
+        c.fd = fd;
+        c.state = state;
+        c.ip = s.peer_ip.load(std::memory_order_relaxed);
+        c.port = s.peer_port.load(std::memory_order_relaxed);
+        c.accept_ms = s.accept_ms.load(std::memory_order_relaxed);
+        c.bytes_in = s.bytes_in.load(std::memory_order_relaxed);
+        c.bytes_out = s.bytes_out.load(std::memory_order_relaxed);
+        c.requests = s.requests.load(std::memory_order_relaxed);
+        conns.push_back(c);
+        if (state > 0 && state < CONN_STATE_COUNT)
+            states[state]++;
+    }
+
+    Json::Value root;
+    root["open"] = (Json::Value::UInt64)conns.size();
+    root["accepted_total"] = Json::Value(static_cast<Json::Value::Int64>(m_accepted ? m_accepted->value() : 0));
+    for (int i = CONN_IDLE; i < CONN_STATE_COUNT; ++i)
+        root["states"][state_names[i]] = states[i];
+
+    // 去重后的对端IP，兼容原先的IP列表展示
+    std::set<uint32_t> ips;
+    char ip[INET_ADDRSTRLEN];
+    Json::Value peers(Json::arrayValue);
+    for (size_t i = 0; i < conns.size(); ++i)
+    {
+        if (!ips.insert(conns[i].ip).second)
+            continue;
+        struct in_addr a;
+        a.s_addr = conns[i].ip;
+        inet_ntop(AF_INET, &a, ip, sizeof(ip));
+        peers.append(ip);
+    }
+    root["peers"] = peers;
+
+    size_t n = std::min<size_t>(TOP_N, conns.size());
+    std::partial_sort(conns.begin(), conns.begin() + n, conns.end(),
+                      [](const conn_snapshot &a, const conn_snapshot &b)
+                      { return a.bytes_in + a.bytes_out > b.bytes_in + b.bytes_out; });
+    long long now = wall_ms();
+    Json::Value top(Json::arrayValue);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const conn_snapshot &c = conns[i];
+        struct in_addr a;
+        a.s_addr = c.ip;
+        inet_ntop(AF_INET, &a, ip, sizeof(ip));
+        Json::Value item;
+        item["fd"] = c.fd;
+        item["peer"] = std::string(ip) + ":" + std::to_string(c.port);
+        item["state"] = state_names[c.state < CONN_STATE_COUNT ? c.state : 0];
+        item["age_s"] = Json::Value(static_cast<Json::Value::Int64>((now - c.accept_ms) / 1000));
+        item["bytes_in"] = Json::Value(static_cast<Json::Value::Int64>(c.bytes_in));
+        item["bytes_out"] = Json::Value(static_cast<Json::Value::Int64>(c.bytes_out));
+        item["requests"] = Json::Value(static_cast<Json::Value::Int64>(c.requests));
+        top.append(item);
+    }
+    root["top"] = top;
+    return root;
+}
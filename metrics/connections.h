@@ -0,0 +1,92 @@
+#ifndef METRICS_CONNECTIONS_H
+#define METRICS_CONNECTIONS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "json/json.h"
+#include "registry.h"
+
+/*
+连接登记表
+按fd下标的固定槽位，每个槽位记录对端地址、接入时间、收发字节数、已处理请求数和当前状态
+同一个fd同一时刻只归一个连接，也只有一个线程在处理(EPOLLONESHOT)，
+所以接入、读写都不需要加锁；关闭可能与工作线程并发，状态用原子交换保证只关一次
+每次接入槽位的代数加一，关闭时带上接入时的代数，代数不符说明fd已被新连接复用，迟到的关闭直接忽略
+调用方要在 close(fd) 之前调用 on_close，否则fd可能已被新连接复用
+/monitor 读取时扫描到出现过的最大fd为止
+*/
+
+enum conn_state
+{
+    CONN_CLOSED = 0,
+    CONN_IDLE,       // 等待请求(新连接或keep-alive)
+    CONN_READING,    // 正在接收请求
+    CONN_PROCESSING, // 正在生成响应
+    CONN_WRITING,    // 正在发送响应
+    CONN_STATE_COUNT
+};
+
+class conn_registry
+{
+public:
+    static conn_registry *get_instance()
+    {
+        static conn_registry instance;
+        return &instance;
+    }
+
+    static const int MAX_CONNS = 65536; // 与 MAX_FD 一致，超出的fd不记录
+    static const int TOP_N = 10;        // /monitor 列出流量最大的连接数
+
+    // 主线程接入新连接后调用，返回该连接的代数
+    unsigned on_accept(int fd, const sockaddr_in &addr);
+    // 可以重复调用，只有第一次生效；gen 为接入时的代数，与槽位当前代数不符时忽略
+    void on_close(int fd, unsigned gen);
+    // 槽位当前的代数，接入线程在 on_accept 之后读取
+    unsigned generation(int fd);
+
+    void set_state(int fd, int state);
+    void add_bytes_in(int fd, long long n);
+    void add_bytes_out(int fd, long long n);
+    void add_request(int fd);
+
+    // 当前打开的连接数，由各线程的计数格子合并而来
+    long long open_count() const;
+
+    // {"open","accepted_total","states":{...},"peers":[ip...],"top":[{fd,peer,age_s,...}]}
+    Json::Value to_json() const;
+
+private:
+    struct alignas(64) slot
+    {
+        std::atomic<int> state;
+        std::atomic<unsigned> gen;     // 接入代数，只由接入线程增加
+        std::atomic<uint32_t> peer_ip; // 网络字节序
+        std::atomic<uint32_t> peer_port;
+        std::atomic<long long> accept_ms;
+        std::atomic<long long> bytes_in;
+        std::atomic<long long> bytes_out;
+        std::atomic<long long> requests;
+    };
+
+    conn_registry();
+    conn_registry(const conn_registry &) = delete;
+    conn_registry &operator=(const conn_registry &) = delete;
+
+    slot *slot_of(int fd) { return (fd >= 0 && fd < MAX_CONNS) ? &m_slots[fd] : NULL; }
+    // 槽位只有当前处理线程写，用普通读改写
+    static void bump(std::atomic<long long> &v, long long n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    slot *m_slots;
+    std::atomic<int> m_max_fd; // 出现过的最大fd，只由接入线程增大
+    metric_gauge *m_open;
+    metric_counter *m_accepted;
+    metric_counter *m_bytes_in;
+    metric_counter *m_bytes_out;
+};
+
+#endif
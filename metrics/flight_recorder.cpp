@@ -0,0 +1,215 @@
+#include "flight_recorder.h"
+#include <string.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "json/json.h"
+
+namespace
+{
+    const char *type_names[FR_TYPE_COUNT] = {"request_start", "request_end", "error", "timer_expire", "conn_close"};
+
+    thread_local int t_tid = 0;
+
+    int current_tid()
+    {
+        if (t_tid == 0)
+            t_tid = syscall(SYS_gettid);
+        return t_tid;
+    }
+
+    // 崩溃时写入的文件，安装处理函数时确定
+    char g_dump_path[256];
+
+    // 信号处理函数中不能用snprintf，手工拼接
+    struct line_writer
+    {
+        char buf[256];
+        size_t len;
+        line_writer() : len(0) {}
+        void str(const char *s)
+        {
+            while (*s && len < sizeof(buf) - 1)
+                buf[len++] = *s++;
+        }
+        void num(long long v, int width = 0)
+        {
+            char tmp[24];
+            int n = 0;
+            bool neg = v < 0;
+            unsigned long long u = neg ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+            do
+            {
+                tmp[n++] = '0' + u % 10;
+                u /= 10;
+            } while (u);
+            while (n < width)
+                tmp[n++] = '0';
+            if (neg)
+                tmp[n++] = '-';
+            while (n > 0 && len < sizeof(buf) - 1)
+                buf[len++] = tmp[--n];
+        }
+        void flush(int fd)
+        {
+            buf[len++] = '\n';
+            size_t off = 0;
+            while (off < len)
+            {
+                ssize_t n = ::write(fd, buf + off, len - off);
+                if (n <= 0)
+                    break;
+                off += n;
+            }
+            len = 0;
+        }
+    };
+
+    void crash_handler(int sig)
+    {
+        int fd = open(g_dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd != -1)
+        {
+            line_writer w;
+            w.str("fatal signal ");
+            w.num(sig);
+            w.str(", last events:");
+            w.flush(fd);
+            flight_recorder::get_instance()->dump(fd);
+            close(fd);
+        }
+        // 恢复默认处理后重新投递，处理函数返回后按默认行为终止并产生core
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+}
+
+void flight_recorder::record(int type, int fd, long long a, long long b, const char *msg)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint64_t seq = m_next.fetch_add(1, std::memory_order_relaxed);
+    slot &s = m_slots[seq & (CAPACITY - 1)];
+    // 先标记为正在写入，读取方看到0或前后序号不一致都会丢弃该槽位
+    s.stamp.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s.ev.ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    s.ev.tid = current_tid();
+    s.ev.type = type;
+    s.ev.fd = fd;
+    s.ev.a = a;
+    s.ev.b = b;
+    if (msg)
+    {
+        strncpy(s.ev.msg, msg, sizeof(s.ev.msg) - 1);
+        s.ev.msg[sizeof(s.ev.msg) - 1] = '\0';
+    }
+    else
+        s.ev.msg[0] = '\0';
+
+    s.stamp.store(seq + 1, std::memory_order_release);
+}
+
+bool flight_recorder::read(uint64_t seq, flight_event *ev) const
+{
+    const slot &s = m_slots[seq & (CAPACITY - 1)];
+    if (s.stamp.load(std::memory_order_acquire) != seq + 1)
+        return false;
+    memcpy(ev, &s.ev, sizeof(*ev));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return s.stamp.load(std::memory_order_relaxed) == seq + 1;
+}
+
+std::string flight_recorder::to_json(int max) const
+{
+    uint64_t end = m_next.load(std::memory_order_acquire);
+    if (max > CAPACITY)
+        max = CAPACITY;
+    uint64_t begin = end > (uint64_t)max ? end - max : 0;
+
+    Json::Value root;
+    Json::Value events(Json::arrayValue);
+    flight_event ev;
+    for (uint64_t seq = begin; seq < end; ++seq)
+    {
+        if (!read(seq, &ev))
+            continue;
+        Json::Value item;
+        item["seq"] = Json::Value(static_cast<Json::Value::UInt64>(seq));
+        item["ts_us"] = Json::Value(static_cast<Json::Value::UInt64>(ev.ts_ns / 1000));
+        item["tid"] = ev.tid;
+        item["type"] = (ev.type >= 0 && ev.type < FR_TYPE_COUNT) ? type_names[ev.type] : "unknown";
+        item["fd"] = ev.fd;
+        item["a"] = Json::Value(static_cast<Json::Value::Int64>(ev.a));
+        item["b"] = Json::Value(static_cast<Json::Value::Int64>(ev.b));
+        item["msg"] = ev.msg;
+        events.append(item);
+    }
+    root["capacity"] = CAPACITY;
+    root["total"] = Json::Value(static_cast<Json::Value::UInt64>(end));
+    root["events"] = events;
+
+    Json::StreamWriterBuilder writer;
+    return Json::writeString(writer, root);
+}
+
+void flight_recorder::dump(int fd) const
+{
+    uint64_t end = m_next.load(std::memory_order_acquire);
+    uint64_t begin = end > (uint64_t)CAPACITY ? end - CAPACITY : 0;
+    flight_event ev;
+    line_writer w;
+    for (uint64_t seq = begin; seq < end; ++seq)
+    {
+        if (!read(seq, &ev))
+            continue;
+        w.num(ev.ts_ns / 1000000000ULL);
+        w.str(".");
+        w.num((ev.ts_ns % 1000000000ULL) / 1000, 6);
+        w.str(" tid=");
+        w.num(ev.tid);
+        w.str(" ");
+        w.str((ev.type >= 0 && ev.type < FR_TYPE_COUNT) ? type_names[ev.type] : "unknown");
+        w.str(" fd=");
+        w.num(ev.fd);
+        w.str(" a=");
+        w.num(ev.a);
+        w.str(" b=");
+        w.num(ev.b);
+        if (ev.msg[0])
+        {
+            w.str(" ");
+            w.str(ev.msg);
+        }
+        w.flush(fd);
+    }
+}
+
+bool flight_recorder::install_crash_handler(const char *path)
+{
+    strncpy(g_dump_path, path, sizeof(g_dump_path) - 1);
+    g_dump_path[sizeof(g_dump_path) - 1] = '\0';
+    // 保证单例在崩溃前已经构造，信号处理函数中不会触发静态初始化
+    get_instance();
+
+    // 主线程栈溢出时也要能执行处理函数，其他线程在各自的入口函数中准备
+    install_alt_stack();
+
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = crash_handler;
+    sa.sa_flags = SA_ONSTACK;
+    sigfillset(&sa.sa_mask);
+    int sigs[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); ++i)
+    {
+        if (sigaction(sigs[i], &sa, NULL) == -1)
+            return false;
+    }
+    return true;
+}
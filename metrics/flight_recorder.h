@@ -0,0 +1,117 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <signal.h>
+#include <stdlib.h>
+
+/*
+飞行记录器：固定大小的无锁环形缓冲区，保存最近 CAPACITY 条结构化事件
+与文件日志无关，关闭日志时也一直记录；可以通过 /admin/flight 查看，
+进程收到 SIGSEGV/SIGABRT 等信号时由信号处理函数把内容写入文件
+写入方：fetch_add 取得序号，按序号占用槽位，写完后用 release 发布序号
+读取方：按序号校验槽位(类似seqlock)，被覆盖或正在写入的槽位直接跳过
+*/
+
+enum flight_event_type
+{
+    FR_REQUEST_START = 0, // 请求报文接收完整，msg为URL
+    FR_REQUEST_END,       // 响应生成完毕，a为HTTP_CODE，b为处理耗时(微秒)
+    FR_ERROR,             // 错误，msg为说明
+    FR_TIMER_EXPIRE,      // 非活动连接超时关闭
+    FR_CONN_CLOSE,        // 连接关闭
+    FR_TYPE_COUNT
+};
+
+struct flight_event
+{
+    uint64_t ts_ns; // CLOCK_REALTIME 纳秒
+    int tid;        // 线程号
+    int type;
+    int fd;
+    long long a;
+    long long b;
+    char msg[48];
+};
+
+class flight_recorder
+{
+public:
+    static const int CAPACITY = 4096; // 必须是2的幂
+
+    static flight_recorder *get_instance()
+    {
+        static flight_recorder instance;
+        return &instance;
+    }
+
+    // 记录一条事件，msg超长时截断，可以在任意线程调用
+    void record(int type, int fd, long long a = 0, long long b = 0, const char *msg = NULL);
+
+    // 最近max条事件，按时间从旧到新
+    std::string to_json(int max = CAPACITY) const;
+
+    // 以文本形式写入fd，只使用异步信号安全的函数，供崩溃时调用
+    void dump(int fd) const;
+
+    // 为致命信号安装处理函数，崩溃时把记录写入path；同时为调用线程准备备用信号栈
+    static bool install_crash_handler(const char *path);
+
+    // 为调用线程准备备用信号栈，栈溢出时崩溃处理函数才有栈可用
+    // 备用信号栈是线程私有的，每个线程的入口函数都要调用；重复调用无效果，线程退出时释放
+    static void install_alt_stack()
+    {
+        struct alt_stack
+        {
+            void *sp;
+            alt_stack() : sp(NULL) {}
+            ~alt_stack()
+            {
+                if (!sp)
+                    return;
+                stack_t ss;
+                ss.ss_sp = NULL;
+                ss.ss_size = 0;
+                ss.ss_flags = SS_DISABLE;
+                sigaltstack(&ss, NULL);
+                free(sp);
+            }
+        };
+        static thread_local alt_stack stack;
+        if (stack.sp)
+            return;
+        stack_t ss;
+        ss.ss_size = SIGSTKSZ * 4;
+        ss.ss_sp = malloc(ss.ss_size);
+        ss.ss_flags = 0;
+        if (ss.ss_sp && sigaltstack(&ss, NULL) == 0)
+            stack.sp = ss.ss_sp;
+        else
+            free(ss.ss_sp);
+    }
+
+private:
+    flight_recorder() : m_next(0)
+    {
+        for (int i = 0; i < CAPACITY; ++i)
+            m_slots[i].stamp.store(0, std::memory_order_relaxed);
+    }
+    flight_recorder(const flight_recorder &) = delete;
+    flight_recorder &operator=(const flight_recorder &) = delete;
+
+    // 读取序号为seq的事件，槽位已被覆盖或正在写入时返回false
+    bool read(uint64_t seq, flight_event *ev) const;
+
+    struct slot
+    {
+        std::atomic<uint64_t> stamp; // 0表示正在写入，否则为序号+1
+        flight_event ev;
+    };
+
+    std::atomic<uint64_t> m_next;
+    slot m_slots[CAPACITY];
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include "history.h"
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+    const char MAGIC[8] = {'T', 'W', 'S', 'H', 'I', 'S', 'T', '1'};
+    const uint32_t VERSION = 1;
+    const uint32_t CAPACITY[HISTORY_TIERS] = {600, 8640, 10080};
+    const int PERIOD[HISTORY_TIERS] = {1, 10, 60};
+}
+
+metrics_history::metrics_history() : m_header(NULL), m_map_size(0)
+{
+    memset(m_acc, 0, sizeof(m_acc));
+}
+
+metrics_history::~metrics_history()
+{
+    if (m_header)
+        munmap(m_header, m_map_size);
+}
+
+int metrics_history::parse_resolution(const char *s)
+{
+    if (!s || strcmp(s, "1s") == 0)
+        return HISTORY_1S;
+    if (strcmp(s, "10s") == 0)
+        return HISTORY_10S;
+    if (strcmp(s, "1m") == 0)
+        return HISTORY_1M;
+    return -1;
+}
+
+bool metrics_history::open(const char *path)
+{
+    size_t size = sizeof(header);
+    for (int t = 0; t < HISTORY_TIERS; ++t)
+        size += CAPACITY[t] * sizeof(history_sample);
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    bool fresh = fstat(fd, &st) == -1 || (size_t)st.st_size != size;
+    if (fresh && ftruncate(fd, size) == -1)
+    {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // 映射建立后文件描述符可以关闭
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    header *h = (header *)p;
+    if (!fresh)
+    {
+        fresh = memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->version != VERSION ||
+                h->sample_size != sizeof(history_sample);
+        for (int t = 0; t < HISTORY_TIERS && !fresh; ++t)
+            fresh = h->capacity[t] != CAPACITY[t];
+    }
+    if (fresh)
+    {
+        memset(p, 0, size);
+        memcpy(h->magic, MAGIC, sizeof(MAGIC));
+        h->version = VERSION;
+        h->sample_size = sizeof(history_sample);
+        for (int t = 0; t < HISTORY_TIERS; ++t)
+            h->capacity[t] = CAPACITY[t];
+    }
+
+    m_lock.lock();
+    if (m_header)
+        munmap(m_header, m_map_size);
+    m_header = h;
+    m_map_size = size;
+    m_lock.unlock();
+    return true;
+}
+
+history_sample *metrics_history::samples(int tier) const
+{
+    char *base = (char *)m_header + sizeof(header);
+    for (int t = 0; t < tier; ++t)
+        base += CAPACITY[t] * sizeof(history_sample);
+    return (history_sample *)base;
+}
+
+void metrics_history::push(int tier, const history_sample &s)
+{
+    uint64_t seq = m_header->next[tier];
+    samples(tier)[seq % CAPACITY[tier]] = s;
+    m_header->next[tier] = seq + 1;
+}
+
+void metrics_history::accumulate(int tier, const history_sample &s)
+{
+    accumulator &a = m_acc[tier];
+    int64_t bucket = s.ts / PERIOD[tier];
+    if (a.count > 0 && a.bucket != bucket)
+    {
+        history_sample out;
+        out.ts = a.bucket * PERIOD[tier];
+        out.cpu_percent = a.cpu / a.count;
+        out.memory_mb = a.memory / a.count;
+        out.rps = a.rps / a.count;
+        out.p50_ms = a.p50 / a.count;
+        out.p99_ms = a.p99;
+        out.connections = (uint32_t)(a.connections / a.count + 0.5);
+        push(tier, out);
+        // 逐级向下聚合
+        if (tier + 1 < HISTORY_TIERS)
+            accumulate(tier + 1, out);
+        a.count = 0;
+    }
+    if (a.count == 0)
+    {
+        a.bucket = bucket;
+        a.cpu = a.memory = a.rps = a.p50 = a.connections = 0;
+        a.p99 = 0;
+    }
+    a.count++;
+    a.cpu += s.cpu_percent;
+    a.memory += s.memory_mb;
+    a.rps += s.rps;
+    a.p50 += s.p50_ms;
+    a.connections += s.connections;
+    if (s.p99_ms > a.p99)
+        a.p99 = s.p99_ms;
+}
+
+void metrics_history::append(const history_sample &s)
+{
+    m_lock.lock();
+    if (m_header)
+    {
+        push(HISTORY_1S, s);
+        accumulate(HISTORY_10S, s);
+    }
+    m_lock.unlock();
+}
+
+void metrics_history::collect(int tier, std::string &out, bool binary) const
+{
+    uint64_t end = m_header->next[tier];
+    uint64_t begin = end > CAPACITY[tier] ? end - CAPACITY[tier] : 0;
+    const history_sample *arr = samples(tier);
+    char buf[160];
+    bool first = true;
+    for (uint64_t seq = begin; seq < end; ++seq)
+    {
+        const history_sample &s = arr[seq % CAPACITY[tier]];
+        if (s.ts == 0)
+            continue;
+        if (binary)
+        {
+            out.append((const char *)&s, sizeof(s));
+            continue;
+        }
+        int n = snprintf(buf, sizeof(buf), "%s[%lld,%.1f,%.0f,%.1f,%.2f,%.2f,%u]", first ? "" : ",",
+                         (long long)s.ts, s.cpu_percent, s.memory_mb, s.rps, s.p50_ms, s.p99_ms, s.connections);
+        out.append(buf, n);
+        first = false;
+    }
+}
+
+std::string metrics_history::to_json(int tier) const
+{
+    std::string out;
+    if (tier < 0 || tier >= HISTORY_TIERS)
+        return out;
+    char buf[160];
+    snprintf(buf, sizeof(buf),
+             "{\"resolution_s\":%d,\"fields\":[\"ts\",\"cpu_percent\",\"memory_mb\",\"rps\",\"p50_ms\",\"p99_ms\","
+             "\"connections\"],\"samples\":[",
+             PERIOD[tier]);
+    out.reserve(CAPACITY[tier] * 48);
+    out += buf;
+    m_lock.lock();
+    if (m_header)
+        collect(tier, out, false);
+    m_lock.unlock();
+    out += "]}";
+    return out;
+}
+
+std::string metrics_history::to_binary(int tier) const
+{
+    std::string out;
+    if (tier < 0 || tier >= HISTORY_TIERS)
+        return out;
+    uint32_t head[2] = {(uint32_t)PERIOD[tier], 0};
+    out.append("TWSH", 4);
+    out.append((const char *)head, sizeof(head));
+    m_lock.lock();
+    if (m_header)
+        collect(tier, out, true);
+    m_lock.unlock();
+    uint32_t count = (out.size() - 4 - sizeof(head)) / sizeof(history_sample);
+    memcpy(&out[8], &count, sizeof(count));
+    return out;
+}
@@ -0,0 +1,96 @@
+#ifndef METRICS_HISTORY_H
+#define METRICS_HISTORY_H
+
+#include <stdint.h>
+#include <string>
+#include "../lock/locker.h"
+
+/*
+指标历史
+三档分辨率的环形缓冲：1秒×10分钟、10秒×24小时、1分钟×7天，总内存固定(约620KB)
+数据放在 mmap 的文件里，进程重启后仍然保留，由 ServerMetrics 的刷新线程每秒写入一次
+低分辨率档由上一档聚合：p99取最大值，其余取平均
+*/
+
+// 写入文件的格式，字段顺序和大小不能随意改动
+struct history_sample
+{
+    int64_t ts;       // 区间起点，unix 秒，0 表示空槽位
+    float cpu_percent;
+    float memory_mb;
+    float rps;        // 区间内每秒请求数
+    float p50_ms;     // 区间内全部路由的请求耗时分位数
+    float p99_ms;
+    uint32_t connections;
+};
+
+enum history_resolution
+{
+    HISTORY_1S = 0,
+    HISTORY_10S,
+    HISTORY_1M,
+    HISTORY_TIERS
+};
+
+class metrics_history
+{
+public:
+    static metrics_history *get_instance()
+    {
+        static metrics_history instance;
+        return &instance;
+    }
+
+    // 打开或创建持久化文件，格式不符时清空重建
+    bool open(const char *path);
+    // 每秒调用一次，ts 为当前 unix 秒
+    void append(const history_sample &s);
+
+    // 按时间顺序输出某一档的全部样本
+    // JSON: {"resolution_s":1,"fields":[...],"samples":[[ts,cpu,...],...]}
+    std::string to_json(int tier) const;
+    // 二进制: "TWSH" + uint32 分辨率(秒) + uint32 样本数 + history_sample[]，本机字节序
+    std::string to_binary(int tier) const;
+
+    // "1s"/"10s"/"1m"，无法识别时返回-1
+    static int parse_resolution(const char *s);
+
+private:
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t sample_size;
+        uint32_t capacity[HISTORY_TIERS];
+        uint32_t reserved;
+        uint64_t next[HISTORY_TIERS]; // 下一个写入的序号
+    };
+
+    // 聚合到下一档的累加器，只在内存中
+    struct accumulator
+    {
+        int64_t bucket; // ts / 周期
+        int count;
+        double cpu, memory, rps, p50, connections;
+        float p99;
+    };
+
+    metrics_history();
+    ~metrics_history();
+    metrics_history(const metrics_history &) = delete;
+    metrics_history &operator=(const metrics_history &) = delete;
+
+    void push(int tier, const history_sample &s);
+    // 把 s 计入 tier 档的累加器，跨过周期边界时先把累加结果写入该档
+    void accumulate(int tier, const history_sample &s);
+    history_sample *samples(int tier) const;
+    // 按时间顺序复制非空样本，调用方持有锁
+    void collect(int tier, std::string &out, bool binary) const;
+
+    mutable locker m_lock;
+    header *m_header; // 指向映射区域开头，NULL 表示未打开
+    size_t m_map_size;
+    accumulator m_acc[HISTORY_TIERS];
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include "latency.h"
+#include <stdio.h>
+
+namespace
+{
+    const char *route_names[ROUTE_COUNT] = {"static", "monitor", "api_files", "download", "upload", "auth"};
+    const char *stage_names[STAGE_COUNT] = {"queue_wait", "parse", "handler", "write"};
+
+    thread_local void *t_shard = NULL;
+
+    Json::Value summary(const latency_histogram &h)
+    {
+        Json::Value v;
+        uint64_t count = h.count();
+        v["count"] = Json::Value(static_cast<Json::Value::UInt64>(count));
+        v["avg_us"] = count > 0 ? (double)h.sum() / count : 0.0;
+        v["max_us"] = Json::Value(static_cast<Json::Value::UInt64>(h.max()));
+        v["p50_us"] = Json::Value(static_cast<Json::Value::UInt64>(h.percentile(0.50)));
+        v["p90_us"] = Json::Value(static_cast<Json::Value::UInt64>(h.percentile(0.90)));
+        v["p99_us"] = Json::Value(static_cast<Json::Value::UInt64>(h.percentile(0.99)));
+        v["p999_us"] = Json::Value(static_cast<Json::Value::UInt64>(h.percentile(0.999)));
+        return v;
+    }
+}
+
+latency_histogram::latency_histogram() : m_count(0), m_sum(0), m_max(0)
+{
+    for (int i = 0; i < BUCKETS; ++i)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+}
+
+// v < 2*SUB 时每个值一个桶；否则按最高位所在的区间 e 右移，保留 SUB_BITS+1 位有效数字
+int latency_histogram::bucket_of(uint64_t v)
+{
+    if (v >= (1ULL << VALUE_BITS))
+        v = (1ULL << VALUE_BITS) - 1;
+    if (v < 2 * SUB)
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int e = msb - SUB_BITS;
+    return SUB * e + (int)(v >> e);
+}
+
+uint64_t latency_histogram::bucket_upper(int idx)
+{
+    if (idx < 2 * SUB)
+        return idx;
+    int e = idx / SUB - 1;
+    uint64_t top = idx - SUB * e;
+    return ((top + 1) << e) - 1;
+}
+
+void latency_histogram::record(uint64_t v, bool exclusive)
+{
+    std::atomic<uint64_t> &b = m_buckets[bucket_of(v)];
+    if (exclusive)
+    {
+        // 单写者：读者可能读到旧值，但不会读到撕裂的值
+        b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_sum.store(m_sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        if (v > m_max.load(std::memory_order_relaxed))
+            m_max.store(v, std::memory_order_relaxed);
+    }
+    else
+    {
+        b.fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t cur = m_max.load(std::memory_order_relaxed);
+        while (v > cur && !m_max.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+            ;
+    }
+}
+
+void latency_histogram::merge_into(latency_histogram &out) const
+{
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        uint64_t n = m_buckets[i].load(std::memory_order_relaxed);
+        if (n)
+            out.m_buckets[i].store(out.m_buckets[i].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    out.m_count.store(out.count() + count(), std::memory_order_relaxed);
+    out.m_sum.store(out.sum() + sum(), std::memory_order_relaxed);
+    if (max() > out.max())
+        out.m_max.store(max(), std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::percentile(double q) const
+{
+    // 用桶计数之和而不是m_count，读取期间仍有写入时两者可能不一致
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+        total += m_buckets[i].load(std::memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t upper = bucket_upper(i);
+            return upper < max() ? upper : max();
+        }
+    }
+    return max();
+}
+
+uint64_t latency_histogram::count_le(uint64_t v) const
+{
+    uint64_t n = 0;
+    for (int i = 0; i < BUCKETS && bucket_upper(i) <= v; ++i)
+        n += m_buckets[i].load(std::memory_order_relaxed);
+    return n;
+}
+
+latency_stats::shard *latency_stats::local_shard(bool *exclusive)
+{
+    if (t_shard)
+    {
+        *exclusive = t_shard != &m_shared;
+        return (shard *)t_shard;
+    }
+    shard *s = &m_shared;
+    m_lock.lock();
+    int n = m_shard_count.load(std::memory_order_relaxed);
+    if (n < MAX_SHARDS)
+    {
+        s = new shard;
+        m_shards[n] = s;
+        m_shard_count.store(n + 1, std::memory_order_release);
+    }
+    m_lock.unlock();
+    t_shard = s;
+    *exclusive = s != &m_shared;
+    return s;
+}
+
+void latency_stats::record_route(int route, long long us)
+{
+    if (route < 0 || route >= ROUTE_COUNT || us < 0)
+        return;
+    bool exclusive;
+    local_shard(&exclusive)->routes[route].record(us, exclusive);
+}
+
+void latency_stats::record_stage(int stage, long long us)
+{
+    if (stage < 0 || stage >= STAGE_COUNT || us < 0)
+        return;
+    bool exclusive;
+    local_shard(&exclusive)->stages[stage].record(us, exclusive);
+}
+
+latency_stats::shard *latency_stats::merge() const
+{
+    // 合并结果较大，放在堆上
+    shard *merged = new shard;
+    int n = m_shard_count.load(std::memory_order_acquire);
+    for (int i = 0; i <= n; ++i)
+    {
+        const shard *s = i < n ? m_shards[i] : &m_shared;
+        for (int r = 0; r < ROUTE_COUNT; ++r)
+            s->routes[r].merge_into(merged->routes[r]);
+        for (int k = 0; k < STAGE_COUNT; ++k)
+            s->stages[k].merge_into(merged->stages[k]);
+    }
+    return merged;
+}
+
+void latency_stats::merge_routes(latency_histogram &out) const
+{
+    int n = m_shard_count.load(std::memory_order_acquire);
+    for (int i = 0; i <= n; ++i)
+    {
+        const shard *s = i < n ? m_shards[i] : &m_shared;
+        for (int r = 0; r < ROUTE_COUNT; ++r)
+            s->routes[r].merge_into(out);
+    }
+}
+
+Json::Value latency_stats::to_json() const
+{
+    shard *merged = merge();
+    Json::Value root;
+    for (int r = 0; r < ROUTE_COUNT; ++r)
+        root["routes"][route_names[r]] = summary(merged->routes[r]);
+    for (int k = 0; k < STAGE_COUNT; ++k)
+        root["stages"][stage_names[k]] = summary(merged->stages[k]);
+    delete merged;
+    return root;
+}
+
+void latency_stats::to_prometheus(std::string &out) const
+{
+    // 细粒度桶按上界归入 le 桶，边界附近有不超过1/16的误差
+    static const double les[] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    shard *merged = merge();
+    char buf[160];
+    const char *names[2] = {"tws_request_duration_seconds", "tws_request_stage_seconds"};
+    const char *helps[2] = {"Time from a complete request to the last response byte, by route",
+                            "Time spent in each request stage"};
+    for (int kind = 0; kind < 2; ++kind)
+    {
+        out += std::string("# HELP ") + names[kind] + " " + helps[kind] + "\n";
+        out += std::string("# TYPE ") + names[kind] + " histogram\n";
+        int count = kind == 0 ? (int)ROUTE_COUNT : (int)STAGE_COUNT;
+        for (int i = 0; i < count; ++i)
+        {
+            const latency_histogram &h = kind == 0 ? merged->routes[i] : merged->stages[i];
+            const char *label = kind == 0 ? "route" : "stage";
+            const char *value = kind == 0 ? route_names[i] : stage_names[i];
+            for (size_t b = 0; b < sizeof(les) / sizeof(les[0]); ++b)
+            {
+                snprintf(buf, sizeof(buf), "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", names[kind], label, value, les[b],
+                         (unsigned long long)h.count_le((uint64_t)(les[b] * 1e6)));
+                out += buf;
+            }
+            snprintf(buf, sizeof(buf), "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", names[kind], label, value,
+                     (unsigned long long)h.count());
+            out += buf;
+            snprintf(buf, sizeof(buf), "%s_count{%s=\"%s\"} %llu\n", names[kind], label, value,
+                     (unsigned long long)h.count());
+            out += buf;
+            snprintf(buf, sizeof(buf), "%s_sum{%s=\"%s\"} %.6f\n", names[kind], label, value, h.sum() / 1e6);
+            out += buf;
+        }
+    }
+    delete merged;
+}
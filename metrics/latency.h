@@ -0,0 +1,124 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include "../lock/locker.h"
+#include "json/json.h"
+
+/*
+请求延迟直方图
+对数线性分桶(类似HdrHistogram)：每个2的幂区间再均分16份，相对误差不超过1/16，
+每个直方图固定 BUCKETS 个计数器，内存占用与请求量无关
+每个线程写自己的分片，只有读取(/monitor)时才把所有分片合并
+*/
+
+// 按路由分类统计请求从接收完整到响应发送完毕的总耗时
+enum route_class
+{
+    ROUTE_STATIC = 0, // 静态页面与资源
+    ROUTE_MONITOR,    // /monitor 与 /admin/*
+    ROUTE_FILES,      // /api/files
+    ROUTE_DOWNLOAD,   // /download/
+    ROUTE_UPLOAD,     // /upload
+    ROUTE_AUTH,       // 登录、注册、会话
+    ROUTE_COUNT
+};
+
+// 按阶段统计，不区分路由
+enum request_stage
+{
+    STAGE_QUEUE = 0, // 在线程池队列中等待
+    STAGE_PARSE,     // 解析请求报文
+    STAGE_HANDLER,   // do_request，包括挂起等待后台操作的时间
+    STAGE_WRITE,     // 响应生成后到最后一个字节写出
+    STAGE_COUNT
+};
+
+class latency_histogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB = 1 << SUB_BITS;
+    static const int VALUE_BITS = 40; // 最大记录约12天(微秒)，更大的值计入最后一个桶
+    static const int BUCKETS = SUB * (VALUE_BITS - SUB_BITS - 1) + 2 * SUB;
+
+    latency_histogram();
+
+    // exclusive 为 true 时调用方保证只有一个写入线程，用普通的读改写代替原子加
+    void record(uint64_t v, bool exclusive);
+    // 累加到 out 中，读取时调用
+    void merge_into(latency_histogram &out) const;
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    // q 取 0~1，返回对应桶的上界
+    uint64_t percentile(double q) const;
+    // 上界不超过 v 的桶的计数之和，用于换算为 Prometheus 的 le 桶
+    uint64_t count_le(uint64_t v) const;
+    uint64_t bucket_count(int idx) const { return m_buckets[idx].load(std::memory_order_relaxed); }
+
+    static int bucket_of(uint64_t v);
+    static uint64_t bucket_upper(int idx);
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+class latency_stats
+{
+public:
+    static latency_stats *get_instance()
+    {
+        static latency_stats instance;
+        return &instance;
+    }
+
+    void record_route(int route, long long us);
+    void record_stage(int stage, long long us);
+
+    // {"routes":{"static":{count,avg_us,max_us,p50_us,...}},"stages":{...}}
+    Json::Value to_json() const;
+    // 以 Prometheus 直方图格式(秒)追加到 out
+    void to_prometheus(std::string &out) const;
+    // 所有路由合并后累加到 out，用于计算一段时间内的分位数
+    void merge_routes(latency_histogram &out) const;
+
+    static long long now_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    static const int MAX_SHARDS = 64; // 超出后的线程共用一个原子分片
+
+private:
+    struct shard
+    {
+        latency_histogram routes[ROUTE_COUNT];
+        latency_histogram stages[STAGE_COUNT];
+    };
+
+    latency_stats() : m_shard_count(0) {}
+    latency_stats(const latency_stats &) = delete;
+    latency_stats &operator=(const latency_stats &) = delete;
+
+    // 当前线程的分片，首次调用时登记；登记表已满时返回共享分片
+    shard *local_shard(bool *exclusive);
+    // 合并所有分片，调用方负责delete
+    shard *merge() const;
+
+    shard *m_shards[MAX_SHARDS];
+    std::atomic<int> m_shard_count;
+    locker m_lock; // 保护分片登记
+    shard m_shared;
+};
+
+#endif
@@ -1,8 +1,12 @@
 #include "metrics.h"
-#include <fstream>  // For reading /proc/stat and /proc/meminfo
+#include "../threadpool/task_executor.h"
+#include "latency.h"
+#include "connections.h"
+#include "runtime_stats.h"
+#include "history.h"
+#include "flight_recorder.h"
+#include "../log/log.h"
 #include <unistd.h> // For sysconf
-#include <sstream>  // For std::stringstream
-#include <iomanip>  // For std::fixed, std::setprecision
 #include <ctime>    // For std::time_t, std::localtime, std::put_time if needed for datetime
 
 // 实现单例模式
@@ -13,156 +17,134 @@ ServerMetrics &ServerMetrics::get_instance()
 }
 
 ServerMetrics::ServerMetrics()
-    : total_requests_(0),
-      active_connections_(0),
+    : last_history_requests_(0),
       current_cpu_usage_(0.0),
       current_memory_usage_mb_(0),
-      start_time_(std::chrono::system_clock::now()), // 记录服务器启动时间
-      last_total_cpu_time_(0),                       // Initialize CPU tracking variables
-      last_idle_cpu_time_(0)
+      start_time_(std::chrono::system_clock::now()) // 记录服务器启动时间
 {
+    register_metrics();
+
     // 启动后台线程，每秒刷新一次 CPU 和内存使用率
     std::thread([this]() {
+        flight_recorder::install_alt_stack();
         while (true) {
             refresh_system_metrics();
+            record_history();
             std::this_thread::sleep_for(std::chrono::seconds(1));
         }
     }).detach();
 }
 
+void ServerMetrics::register_metrics()
+{
+    metrics_registry *r = metrics_registry::get_instance();
+    total_requests_ = r->add_counter("tws_requests_total", "Requests dispatched to a handler");
+    // 256B ~ 64MB，4倍递增
+    std::vector<long long> bounds;
+    for (long long b = 256; b <= 64LL * 1024 * 1024; b *= 4)
+        bounds.push_back(b);
+    response_bytes_ = r->add_histogram("tws_response_bytes", "Size of each response including headers", bounds);
+
+    r->add_callback("tws_uptime_seconds", "Seconds since the server started", "gauge",
+                    [this]() { return (double)get_uptime_seconds(); });
+    r->add_callback("tws_cpu_usage_percent", "Host CPU usage sampled every second", "gauge",
+                    [this]() { return current_cpu_usage_; });
+    r->add_callback("tws_memory_usage_bytes", "Host memory in use", "gauge",
+                    [this]() { return (double)current_memory_usage_mb_ * 1024 * 1024; });
+
+    // 执行器统计在同一把锁下取出，四个回调各取一次，数值之间可能有微小偏差
+    r->add_callback("tws_executor_tasks_total", "Background tasks by outcome", "counter",
+                    []() { return (double)task_executor::get_instance()->get_stats().submitted; }, "state=\"submitted\"");
+    r->add_callback("tws_executor_tasks_total", "Background tasks by outcome", "counter",
+                    []() { return (double)task_executor::get_instance()->get_stats().completed; }, "state=\"completed\"");
+    r->add_callback("tws_executor_tasks_total", "Background tasks by outcome", "counter",
+                    []() { return (double)task_executor::get_instance()->get_stats().rejected; }, "state=\"rejected\"");
+    r->add_callback("tws_executor_tasks_total", "Background tasks by outcome", "counter",
+                    []() { return (double)task_executor::get_instance()->get_stats().failed; }, "state=\"failed\"");
+    r->add_callback("tws_executor_queue_size", "Background tasks waiting to run", "gauge",
+                    []() { return (double)task_executor::get_instance()->get_stats().queue_size; });
+    r->add_callback("tws_log_dropped_lines_total", "Log lines dropped because the async queue was full", "counter",
+                    []() { return (double)Log::get_instance()->get_dropped_lines(); });
+
+    r->add_collector([](std::string &out) { latency_stats::get_instance()->to_prometheus(out); });
+    r->add_collector([this](std::string &out) { proc_.to_prometheus(out); });
+}
+
+void ServerMetrics::record_history()
+{
+    latency_histogram *merged = new latency_histogram;
+    latency_stats::get_instance()->merge_routes(*merged);
+    if (last_latency_buckets_.empty())
+        last_latency_buckets_.assign(latency_histogram::BUCKETS, 0);
+
+    // 与上一秒的累计计数相减，得到这一秒内完成的请求的分布
+    std::vector<uint64_t> delta(latency_histogram::BUCKETS);
+    uint64_t total = 0;
+    for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+    {
+        uint64_t cur = merged->bucket_count(i);
+        delta[i] = cur >= last_latency_buckets_[i] ? cur - last_latency_buckets_[i] : 0;
+        last_latency_buckets_[i] = cur;
+        total += delta[i];
+    }
+    delete merged;
+
+    double qs[2] = {0.50, 0.99};
+    float result_ms[2] = {0, 0};
+    for (int k = 0; k < 2 && total > 0; ++k)
+    {
+        uint64_t rank = (uint64_t)(qs[k] * total + 0.5);
+        if (rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+        {
+            seen += delta[i];
+            if (seen >= rank)
+            {
+                result_ms[k] = latency_histogram::bucket_upper(i) / 1000.0f;
+                break;
+            }
+        }
+    }
+
+    long long requests = get_total_requests();
+    history_sample s;
+    s.ts = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    metrics_mutex_.lock();
+    s.cpu_percent = current_cpu_usage_;
+    s.memory_mb = current_memory_usage_mb_;
+    metrics_mutex_.unlock();
+    // 第一次采样时没有上一秒的基准
+    s.rps = last_history_requests_ > 0 ? requests - last_history_requests_ : 0;
+    s.p50_ms = result_ms[0];
+    s.p99_ms = result_ms[1];
+    s.connections = get_active_connections();
+    last_history_requests_ = requests;
+    metrics_history::get_instance()->append(s);
+}
+
 void ServerMetrics::increment_requests()
 {
-    total_requests_++;
+    if (total_requests_)
+        total_requests_->inc();
 }
 
 long long ServerMetrics::get_total_requests() const
 {
-    return total_requests_.load();
+    return total_requests_ ? total_requests_->value() : 0;
 }
 // 周期性刷新系统指标
 void ServerMetrics::refresh_system_metrics()
 {
+    proc_.refresh();
+    proc_snapshot s = proc_.snapshot();
     metrics_mutex_.lock();
-    update_cpu_usage_internal();
-    update_memory_usage_internal();
+    current_cpu_usage_ = s.host_cpu_percent;
+    current_memory_usage_mb_ = s.host_mem_used_kb / 1024;
     metrics_mutex_.unlock();
 }
 
-// 外部实现更新CPU使用率
-void ServerMetrics::update_cpu_usage_internal()
-{
-    std::ifstream file("/proc/stat");
-    std::string line;
-    if (!file.is_open())
-    {
-        // Handle error: file not found or cannot be opened.
-        // For simplicity, we'll just return and keep previous values.
-        return;
-    }
-
-    if (std::getline(file, line))
-    {
-        std::istringstream iss(line);
-        std::string cpu_label;
-        long long user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice;
-
-        // Parse the "cpu" line from /proc/stat
-        // The values are typically: user nice system idle iowait irq softirq steal guest guest_nice
-        // guest/guest_nice might not be present on older kernels, but istringstream handles extra fields gracefully.
-        iss >> cpu_label >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal >> guest >> guest_nice;
-
-        // Calculate total CPU time (all jiffies)
-        long long current_total_cpu_time = user + nice + system + idle + iowait + irq + softirq + steal + guest + guest_nice;
-        // Calculate idle CPU time (idle + iowait)
-        long long current_idle_cpu_time = idle + iowait;
-
-        // Calculate differences since last read
-        long long total_diff = current_total_cpu_time - last_total_cpu_time_;
-        long long idle_diff = current_idle_cpu_time - last_idle_cpu_time_;
-
-        if (total_diff > 0)
-        {
-            current_cpu_usage_ = 100.0 * (1.0 - (double)idle_diff / total_diff);
-        }
-        else
-        {
-            // If total_diff is 0, no CPU activity or first read. Keep previous value or set to 0.
-            current_cpu_usage_ = 0.0;
-        }
-
-        // Store current values for next calculation
-        last_total_cpu_time_ = current_total_cpu_time;
-        last_idle_cpu_time_ = current_idle_cpu_time;
-    }
-}
-
-void ServerMetrics::update_memory_usage_internal()
-{
-    std::ifstream file("/proc/meminfo");
-    std::string line;
-    long long mem_total = 0;
-    long long mem_free = 0;
-    long long mem_available = 0; // Preferred over MemFree for available memory
-
-    if (!file.is_open())
-    {
-        printf("Error: Could not open /proc/meminfo\n");
-        return;
-    }
-
-    while (std::getline(file, line))
-    {
-        std::istringstream iss(line);
-        std::string key;
-        long long value;
-        std::string unit; // "kB"
-
-        iss >> key >> value >> unit;
-
-        if (key == "MemTotal:")
-        {
-            mem_total = value;
-        }
-        else if (key == "MemFree:")
-        { // Fallback if MemAvailable is not present
-            mem_free = value;
-        }
-        else if (key == "MemAvailable:")
-        { // Most accurate for user-space applications
-            mem_available = value;
-        }
-
-        // Optimization: if we found all needed keys, break early
-        // We prioritize MemAvailable, so if it's found, MemFree is less important.
-        if (mem_total > 0 && (mem_available > 0 || (mem_available == 0 && mem_free > 0)))
-        {
-            break;
-        }
-    }
-
-    // Calculate used memory: MemTotal - MemAvailable (preferred) or MemTotal - MemFree
-    if (mem_total > 0)
-    {
-        if (mem_available > 0)
-        {
-            current_memory_usage_mb_ = (mem_total - mem_available) / 1024; // Convert kB to MB
-        }
-        else if (mem_free > 0)
-        {
-            // Fallback to MemFree if MemAvailable is not present (older kernels)
-            current_memory_usage_mb_ = (mem_total - mem_free) / 1024; // Convert kB to MB
-        }
-        else
-        {
-            current_memory_usage_mb_ = 0; // No valid free/available memory found
-        }
-    }
-    else
-    {
-        current_memory_usage_mb_ = 0; // Could not read or total memory is 0
-    }
-}
-
 double ServerMetrics::get_cpu_usage_percent() const
 {
     return current_cpu_usage_;
@@ -180,19 +162,15 @@ long long ServerMetrics::get_uptime_seconds() const
     return duration.count();
 }
 
-void ServerMetrics::increment_active_connections()
-{
-    active_connections_++;
-}
-
-void ServerMetrics::decrement_active_connections()
+int ServerMetrics::get_active_connections() const
 {
-    active_connections_--;
+    return conn_registry::get_instance()->open_count();
 }
 
-int ServerMetrics::get_active_connections() const
+void ServerMetrics::record_response_bytes(long long bytes)
 {
-    return active_connections_.load();
+    if (response_bytes_)
+        response_bytes_->observe(bytes);
 }
 
 std::string ServerMetrics::to_json() const
@@ -203,20 +181,41 @@ std::string ServerMetrics::to_json() const
     // 设置基本字段
     root["cpu_usage_percent"] = current_cpu_usage_;
     root["memory_usage_mb"] = Json::Value(static_cast<Json::Value::UInt64>(current_memory_usage_mb_));
-    root["total_requests"] = Json::Value(static_cast<Json::Value::UInt64>(total_requests_.load()));
+    root["total_requests"] = Json::Value(static_cast<Json::Value::UInt64>(get_total_requests()));
     root["uptime_seconds"] = Json::Value(static_cast<Json::Value::UInt64>(get_uptime_seconds()));
-    root["active_connections"] = Json::Value(static_cast<Json::Value::UInt64>(active_connections_.load()));
+    root["active_connections"] = Json::Value(static_cast<Json::Value::Int64>(get_active_connections()));
     root["start_time"] = std::chrono::system_clock::to_time_t(start_time_);
 
-    // 创建一个 JSON 数组来存储连接的 IP 地址
-    Json::Value connected_ips(Json::arrayValue);
-    for (const auto &ip : m_connected_ips)
-    {
-        connected_ips.append(ip);
-    }
-
-    // 添加 IP 地址数组到 JSON 对象中
-    root["connected_ips"] = connected_ips;
+    // 按fd登记的连接：状态分布、流量最大的连接，以及去重后的对端IP
+    Json::Value connections = conn_registry::get_instance()->to_json();
+    root["connected_ips"] = connections["peers"];
+    root["connections"] = connections;
+
+    // 后台执行器
+    task_executor::stats es = task_executor::get_instance()->get_stats();
+    Json::Value executor;
+    executor["threads"] = es.thread_number;
+    executor["queue_size"] = es.queue_size;
+    executor["submitted"] = Json::Value(static_cast<Json::Value::Int64>(es.submitted));
+    executor["completed"] = Json::Value(static_cast<Json::Value::Int64>(es.completed));
+    executor["rejected"] = Json::Value(static_cast<Json::Value::Int64>(es.rejected));
+    executor["failed"] = Json::Value(static_cast<Json::Value::Int64>(es.failed));
+    executor["avg_wait_us"] = es.completed > 0 ? (double)es.total_wait_us / es.completed : 0.0;
+    executor["avg_exec_us"] = es.completed > 0 ? (double)es.total_exec_us / es.completed : 0.0;
+    root["executor"] = executor;
+
+    // 本进程的CPU、RSS、fd、上下文切换、磁盘读写，以及各网卡吞吐
+    Json::Value proc = proc_.to_json();
+    root["process"] = proc["process"];
+    root["network"] = proc["network"];
+
+    // 线程池队列与利用率、事件循环每轮事件数与耗时
+    Json::Value runtime = runtime_stats::get_instance()->to_json();
+    root["threadpool"] = runtime["threadpool"];
+    root["event_loop"] = runtime["event_loop"];
+
+    // 按路由和阶段的延迟分位数
+    root["latency"] = latency_stats::get_instance()->to_json();
 
     // 将 JSON 对象转为字符串
     Json::StreamWriterBuilder writer;
@@ -224,32 +223,3 @@ std::string ServerMetrics::to_json() const
 
     return json_str;
 }
-
-void ServerMetrics::addConnectedIP(const std::string &ip)
-{
-    m_connected_ips_mutex.lock();
-    auto result = m_connected_ips.insert(ip);
-    if (result.second)
-    {
-        increment_active_connections(); // 只有在新IP被添加时才增加活跃连接数
-    }
-    m_connected_ips_mutex.unlock();
-}
-
-void ServerMetrics::removeConnectedIP(const std::string &ip)
-{
-    m_connected_ips_mutex.lock();
-    auto result = m_connected_ips.erase(ip);
-    if (result>0)
-    {
-        decrement_active_connections(); // 只有在IP存在并被移除时才减少活跃连接数
-    }
-    m_connected_ips_mutex.unlock();
-}
-
-void ServerMetrics::getAllConnectedIPs(std::unordered_set<std::string> &connected_ips)
-{
-    m_connected_ips_mutex.lock();
-    connected_ips = m_connected_ips;
-    m_connected_ips_mutex.unlock();
-}
\ No newline at end of file
@@ -6,7 +6,8 @@
 #include <chrono>
 #include "../lock/locker.h"
 #include "json/json.h"
-#include <unordered_set>
+#include "registry.h"
+#include "proc_stats.h"
 #include <vector>
 #include <thread>
 class ServerMetrics
@@ -31,47 +32,40 @@ public:
     // 获取服务器运行时间
     long long get_uptime_seconds() const;
 
-    // 获取活跃连接数
-    void increment_active_connections();
-    void decrement_active_connections();
+    // 获取活跃连接数，由 conn_registry 维护
     int get_active_connections() const;
 
+    // 每个响应的字节数(状态行+头部+正文)
+    void record_response_bytes(long long bytes);
+
     // 将所有指标生成JSON格式字符串
     std::string to_json() const;
 
-    // 拓展IP地址管理
-    void addConnectedIP(const std::string &ip);
-    void removeConnectedIP(const std::string &ip);
-    void getAllConnectedIPs(std::unordered_set<std::string> &connected_ips);
-
 public:
     // 以下需要锁保护，因为它们可能由多个线程更新或读取
     mutable locker metrics_mutex_;
 
-    // 拓展功能
-    std::unordered_set<std::string> m_connected_ips; // 用于存储所有连接的 IP 地址
-    locker m_connected_ips_mutex;                    // 互斥锁保护连接的 IP 地址集合
-
 private:
     ServerMetrics(); // 私有构造函数，实现单例模式
 
-    std::atomic<long long> total_requests_;
-    std::atomic<int> active_connections_; // 活跃连接数
+    // 每个工作线程写自己的格子，避免所有线程争用同一条缓存行
+    metric_counter *total_requests_;
+    metric_histogram *response_bytes_;
+
+    // 向注册表登记 /metrics 输出的指标
+    void register_metrics();
+
+    // 每秒向 metrics_history 写入一个样本，只在刷新线程中调用
+    void record_history();
+    long long last_history_requests_;
+    std::vector<uint64_t> last_latency_buckets_; // 上一秒的累计桶计数，用于求这一秒的分位数
 
     double current_cpu_usage_;                                      // CPU 使用率百分比
     long long current_memory_usage_mb_;                             // 内存使用量 (MB)
     std::chrono::time_point<std::chrono::system_clock> start_time_; // 服务器启动时间
 
-    // 记录上次CPU使用率计算的状态
-    long long last_total_cpu_time_;
-    long long last_idle_cpu_time_;
-
-    // 外部函数用于更新CPU和内存使用率
-    void update_cpu_usage_internal();
-    void update_memory_usage_internal();
-    // TODO: 线程池队列大小、日志等可以后续添加
-    std::atomic<int> thread_pool_queue_size_;
-    std::vector<std::string> log_buffer_; // 存储最近的日志
+    // 保持打开的 /proc 文件，整机与本进程指标都从这里取
+    proc_stats proc_;
 };
 
 #endif // SERVER_METRICS_H
@@ -0,0 +1,371 @@
+#include "proc_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+namespace
+{
+    long long mono_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    int open_proc(const char *path)
+    {
+        return open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    // 在 "key: value" 格式的内容中查找 key，返回其后的数值，找不到返回-1
+    long long field_value(const char *buf, const char *key)
+    {
+        size_t len = strlen(key);
+        const char *p = buf;
+        while (p && *p)
+        {
+            if (strncmp(p, key, len) == 0 && p[len] == ':')
+                return strtoll(p + len + 1, NULL, 10);
+            p = strchr(p, '\n');
+            if (p)
+                ++p;
+        }
+        return -1;
+    }
+
+    // 从 p 开始跳过 n 个以空白分隔的字段
+    const char *skip_fields(const char *p, int n)
+    {
+        for (int i = 0; i < n && *p; ++i)
+        {
+            while (*p == ' ')
+                ++p;
+            while (*p && *p != ' ')
+                ++p;
+        }
+        while (*p == ' ')
+            ++p;
+        return p;
+    }
+
+    Json::Value int64(long long v)
+    {
+        return Json::Value(static_cast<Json::Value::Int64>(v));
+    }
+}
+
+proc_stats::proc_stats()
+    : m_fd_dir(NULL), m_last_mono_us(0), m_last_host_total(0), m_last_host_idle(0), m_last_proc_ticks(0)
+{
+    m_stat_fd = open_proc("/proc/stat");
+    m_meminfo_fd = open_proc("/proc/meminfo");
+    m_self_stat_fd = open_proc("/proc/self/stat");
+    m_self_status_fd = open_proc("/proc/self/status");
+    m_self_io_fd = open_proc("/proc/self/io");
+    m_net_dev_fd = open_proc("/proc/net/dev");
+    m_fd_dir = opendir("/proc/self/fd");
+    m_clk_tck = sysconf(_SC_CLK_TCK);
+    m_page_size = sysconf(_SC_PAGESIZE);
+
+    m_snap.host_cpu_percent = 0;
+    m_snap.host_mem_total_kb = 0;
+    m_snap.host_mem_used_kb = 0;
+    m_snap.cpu_percent = 0;
+    m_snap.rss_bytes = 0;
+    m_snap.vm_bytes = 0;
+    m_snap.threads = 0;
+    m_snap.open_fds = 0;
+    m_snap.voluntary_ctxt_switches = 0;
+    m_snap.nonvoluntary_ctxt_switches = 0;
+    m_snap.read_bytes = 0;
+    m_snap.write_bytes = 0;
+    m_snap.read_bytes_per_s = 0;
+    m_snap.write_bytes_per_s = 0;
+}
+
+proc_stats::~proc_stats()
+{
+    int fds[] = {m_stat_fd, m_meminfo_fd, m_self_stat_fd, m_self_status_fd, m_self_io_fd, m_net_dev_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i)
+    {
+        if (fds[i] != -1)
+            close(fds[i]);
+    }
+    if (m_fd_dir)
+        closedir(m_fd_dir);
+}
+
+int proc_stats::read_proc(int fd)
+{
+    if (fd == -1)
+        return -1;
+    size_t len = 0;
+    while (len < sizeof(m_buf) - 1)
+    {
+        ssize_t n = pread(fd, m_buf + len, sizeof(m_buf) - 1 - len, len);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        len += n;
+    }
+    m_buf[len] = '\0';
+    return len;
+}
+
+void proc_stats::refresh()
+{
+    long long now = mono_us();
+    double elapsed_s = m_last_mono_us > 0 ? (now - m_last_mono_us) / 1e6 : 0;
+    m_last_mono_us = now;
+
+    // 解析结果直接写入 m_snap，读取方拿锁复制
+    m_lock.lock();
+    parse_host_cpu();
+    parse_meminfo();
+    parse_self_stat(elapsed_s);
+    parse_self_status();
+    parse_self_io(elapsed_s);
+    parse_net_dev(elapsed_s);
+    m_snap.open_fds = count_fds();
+    m_lock.unlock();
+}
+
+void proc_stats::parse_host_cpu()
+{
+    if (read_proc(m_stat_fd) <= 0 || strncmp(m_buf, "cpu ", 4) != 0)
+        return;
+    // user nice system idle iowait irq softirq steal，guest 已计入 user
+    long long v[8] = {0};
+    char *p = m_buf + 4;
+    for (int i = 0; i < 8; ++i)
+        v[i] = strtoll(p, &p, 10);
+    long long total = 0;
+    for (int i = 0; i < 8; ++i)
+        total += v[i];
+    long long idle = v[3] + v[4];
+    long long total_diff = total - m_last_host_total;
+    long long idle_diff = idle - m_last_host_idle;
+    m_snap.host_cpu_percent = (m_last_host_total > 0 && total_diff > 0) ? 100.0 * (1.0 - (double)idle_diff / total_diff) : 0.0;
+    m_last_host_total = total;
+    m_last_host_idle = idle;
+}
+
+void proc_stats::parse_meminfo()
+{
+    if (read_proc(m_meminfo_fd) <= 0)
+        return;
+    long long total = field_value(m_buf, "MemTotal");
+    long long available = field_value(m_buf, "MemAvailable");
+    // 老内核没有 MemAvailable
+    if (available < 0)
+        available = field_value(m_buf, "MemFree");
+    if (total <= 0 || available < 0)
+        return;
+    m_snap.host_mem_total_kb = total;
+    m_snap.host_mem_used_kb = total - available;
+}
+
+void proc_stats::parse_self_stat(double elapsed_s)
+{
+    if (read_proc(m_self_stat_fd) <= 0)
+        return;
+    // 进程名可能包含空格和括号，从最后一个 ')' 之后开始数，之后第一个字段是第3个字段 state
+    const char *p = strrchr(m_buf, ')');
+    if (!p)
+        return;
+    p = skip_fields(p + 1, 11); // 跳到第14个字段 utime
+    char *end;
+    long long utime = strtoll(p, &end, 10);
+    long long stime = strtoll(end, &end, 10);
+    p = skip_fields(end, 4); // 跳到第20个字段 num_threads
+    m_snap.threads = strtol(p, &end, 10);
+    p = skip_fields(end, 2); // 第23个字段 vsize
+    m_snap.vm_bytes = strtoll(p, &end, 10);
+    m_snap.rss_bytes = strtoll(end, &end, 10) * m_page_size;
+
+    long long ticks = utime + stime;
+    if (elapsed_s > 0 && m_clk_tck > 0)
+        m_snap.cpu_percent = 100.0 * (ticks - m_last_proc_ticks) / m_clk_tck / elapsed_s;
+    m_last_proc_ticks = ticks;
+}
+
+void proc_stats::parse_self_status()
+{
+    if (read_proc(m_self_status_fd) <= 0)
+        return;
+    long long v = field_value(m_buf, "voluntary_ctxt_switches");
+    if (v >= 0)
+        m_snap.voluntary_ctxt_switches = v;
+    v = field_value(m_buf, "nonvoluntary_ctxt_switches");
+    if (v >= 0)
+        m_snap.nonvoluntary_ctxt_switches = v;
+}
+
+void proc_stats::parse_self_io(double elapsed_s)
+{
+    // 部分容器内没有读取 /proc/self/io 的权限
+    if (read_proc(m_self_io_fd) <= 0)
+        return;
+    long long r = field_value(m_buf, "read_bytes");
+    long long w = field_value(m_buf, "write_bytes");
+    if (r < 0 || w < 0)
+        return;
+    if (elapsed_s > 0)
+    {
+        m_snap.read_bytes_per_s = (r - m_snap.read_bytes) / elapsed_s;
+        m_snap.write_bytes_per_s = (w - m_snap.write_bytes) / elapsed_s;
+    }
+    m_snap.read_bytes = r;
+    m_snap.write_bytes = w;
+}
+
+void proc_stats::parse_net_dev(double elapsed_s)
+{
+    if (read_proc(m_net_dev_fd) <= 0)
+        return;
+    // 前两行是表头
+    char *p = strchr(m_buf, '\n');
+    if (p)
+        p = strchr(p + 1, '\n');
+    std::vector<net_iface_stats> ifaces;
+    while (p && *++p)
+    {
+        char *colon = strchr(p, ':');
+        char *eol = strchr(p, '\n');
+        if (!colon || (eol && colon > eol))
+            break;
+        while (*p == ' ')
+            ++p;
+        net_iface_stats s;
+        s.name.assign(p, colon);
+        // 接收8个字段后是发送字段
+        char *q = colon + 1;
+        s.rx_bytes = strtoll(q, &q, 10);
+        for (int i = 0; i < 7; ++i)
+            strtoll(q, &q, 10);
+        s.tx_bytes = strtoll(q, &q, 10);
+        s.rx_bytes_per_s = 0;
+        s.tx_bytes_per_s = 0;
+        for (size_t i = 0; i < m_snap.net.size() && elapsed_s > 0; ++i)
+        {
+            if (m_snap.net[i].name == s.name)
+            {
+                s.rx_bytes_per_s = (s.rx_bytes - m_snap.net[i].rx_bytes) / elapsed_s;
+                s.tx_bytes_per_s = (s.tx_bytes - m_snap.net[i].tx_bytes) / elapsed_s;
+                break;
+            }
+        }
+        ifaces.push_back(s);
+        p = eol;
+    }
+    m_snap.net.swap(ifaces);
+}
+
+int proc_stats::count_fds()
+{
+    if (!m_fd_dir)
+        return 0;
+    rewinddir(m_fd_dir);
+    int n = 0;
+    struct dirent *ent;
+    while ((ent = readdir(m_fd_dir)) != NULL)
+    {
+        if (ent->d_name[0] != '.')
+            ++n;
+    }
+    // 不计入目录自身占用的fd
+    return n > 0 ? n - 1 : 0;
+}
+
+proc_snapshot proc_stats::snapshot() const
+{
+    m_lock.lock();
+    proc_snapshot s = m_snap;
+    m_lock.unlock();
+    return s;
+}
+
+Json::Value proc_stats::to_json() const
+{
+    proc_snapshot s = snapshot();
+    Json::Value root;
+    Json::Value proc;
+    proc["cpu_percent"] = s.cpu_percent;
+    proc["rss_bytes"] = int64(s.rss_bytes);
+    proc["vm_bytes"] = int64(s.vm_bytes);
+    proc["threads"] = s.threads;
+    proc["open_fds"] = s.open_fds;
+    proc["voluntary_ctxt_switches"] = int64(s.voluntary_ctxt_switches);
+    proc["nonvoluntary_ctxt_switches"] = int64(s.nonvoluntary_ctxt_switches);
+    proc["disk_read_bytes"] = int64(s.read_bytes);
+    proc["disk_write_bytes"] = int64(s.write_bytes);
+    proc["disk_read_bytes_per_s"] = s.read_bytes_per_s;
+    proc["disk_write_bytes_per_s"] = s.write_bytes_per_s;
+    root["process"] = proc;
+
+    Json::Value net(Json::arrayValue);
+    for (size_t i = 0; i < s.net.size(); ++i)
+    {
+        Json::Value item;
+        item["name"] = s.net[i].name;
+        item["rx_bytes"] = int64(s.net[i].rx_bytes);
+        item["tx_bytes"] = int64(s.net[i].tx_bytes);
+        item["rx_bytes_per_s"] = s.net[i].rx_bytes_per_s;
+        item["tx_bytes_per_s"] = s.net[i].tx_bytes_per_s;
+        net.append(item);
+    }
+    root["network"] = net;
+    return root;
+}
+
+void proc_stats::to_prometheus(std::string &out) const
+{
+    proc_snapshot s = snapshot();
+    char buf[256];
+    struct
+    {
+        const char *name;
+        const char *help;
+        const char *type;
+        double value;
+    } items[] = {
+        {"tws_process_cpu_percent", "Process CPU usage, 100 means one full core", "gauge", s.cpu_percent},
+        {"tws_process_resident_memory_bytes", "Process resident set size", "gauge", (double)s.rss_bytes},
+        {"tws_process_virtual_memory_bytes", "Process virtual memory size", "gauge", (double)s.vm_bytes},
+        {"tws_process_threads", "Process threads", "gauge", (double)s.threads},
+        {"tws_process_open_fds", "Open file descriptors", "gauge", (double)s.open_fds},
+        {"tws_process_voluntary_ctxt_switches_total", "Voluntary context switches", "counter",
+         (double)s.voluntary_ctxt_switches},
+        {"tws_process_nonvoluntary_ctxt_switches_total", "Involuntary context switches", "counter",
+         (double)s.nonvoluntary_ctxt_switches},
+        {"tws_process_disk_read_bytes_total", "Bytes the process caused to be read from storage", "counter",
+         (double)s.read_bytes},
+        {"tws_process_disk_write_bytes_total", "Bytes the process caused to be written to storage", "counter",
+         (double)s.write_bytes},
+    };
+    for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); ++i)
+    {
+        snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n%s %.10g\n", items[i].name, items[i].help,
+                 items[i].name, items[i].type, items[i].name, items[i].value);
+        out += buf;
+    }
+
+    const char *dirs[2] = {"receive", "transmit"};
+    for (int d = 0; d < 2; ++d)
+    {
+        snprintf(buf, sizeof(buf), "# HELP tws_network_%s_bytes_total Bytes %s per interface (host-wide)\n"
+                                   "# TYPE tws_network_%s_bytes_total counter\n",
+                 dirs[d], d == 0 ? "received" : "transmitted", dirs[d]);
+        out += buf;
+        for (size_t i = 0; i < s.net.size(); ++i)
+        {
+            snprintf(buf, sizeof(buf), "tws_network_%s_bytes_total{interface=\"%s\"} %lld\n", dirs[d],
+                     s.net[i].name.c_str(), d == 0 ? s.net[i].rx_bytes : s.net[i].tx_bytes);
+            out += buf;
+        }
+    }
+}
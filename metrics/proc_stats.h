@@ -0,0 +1,97 @@
+#ifndef METRICS_PROC_STATS_H
+#define METRICS_PROC_STATS_H
+
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include "../lock/locker.h"
+#include "json/json.h"
+
+/*
+/proc 采集
+文件在构造时打开并一直保持，每次刷新用 pread 从偏移0重新读取(内核会重新生成内容)，
+手工解析数字，不经过 iostream，也不分配内存(网卡列表除外)
+除整机 CPU/内存外，还采集本进程的 CPU、RSS、打开的fd数、上下文切换、磁盘读写字节，以及各网卡的收发速率
+*/
+
+struct net_iface_stats
+{
+    std::string name;
+    long long rx_bytes;
+    long long tx_bytes;
+    double rx_bytes_per_s;
+    double tx_bytes_per_s;
+};
+
+struct proc_snapshot
+{
+    // 整机
+    double host_cpu_percent;
+    long long host_mem_total_kb;
+    long long host_mem_used_kb;
+    // 本进程
+    double cpu_percent; // 100 表示占满一个核
+    long long rss_bytes;
+    long long vm_bytes;
+    int threads;
+    int open_fds;
+    long long voluntary_ctxt_switches;
+    long long nonvoluntary_ctxt_switches;
+    long long read_bytes;  // 实际落到块设备的读写
+    long long write_bytes;
+    double read_bytes_per_s;
+    double write_bytes_per_s;
+    std::vector<net_iface_stats> net;
+};
+
+class proc_stats
+{
+public:
+    proc_stats();
+    ~proc_stats();
+
+    // 只由刷新线程调用，两次调用之间的差值用于计算速率
+    void refresh();
+    proc_snapshot snapshot() const;
+
+    // {"process":{...},"network":[{...}]}
+    Json::Value to_json() const;
+    void to_prometheus(std::string &out) const;
+
+private:
+    proc_stats(const proc_stats &) = delete;
+    proc_stats &operator=(const proc_stats &) = delete;
+
+    // 读取整个文件到 m_buf，返回内容长度，失败返回-1
+    int read_proc(int fd);
+    void parse_host_cpu();
+    void parse_meminfo();
+    void parse_self_stat(double elapsed_s);
+    void parse_self_status();
+    void parse_self_io(double elapsed_s);
+    void parse_net_dev(double elapsed_s);
+    int count_fds();
+
+    int m_stat_fd;
+    int m_meminfo_fd;
+    int m_self_stat_fd;
+    int m_self_status_fd;
+    int m_self_io_fd;
+    int m_net_dev_fd;
+    DIR *m_fd_dir;
+
+    char m_buf[16384];
+    long m_clk_tck;
+    long m_page_size;
+
+    // 上一次的累计值
+    long long m_last_mono_us;
+    long long m_last_host_total;
+    long long m_last_host_idle;
+    long long m_last_proc_ticks;
+
+    mutable locker m_lock; // 保护 m_snap
+    proc_snapshot m_snap;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "profiler.h"
+#include "flight_recorder.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <map>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct sample
+    {
+        std::atomic<int> depth; // 写完调用栈后才置为非0
+        void *pcs[cpu_profiler::MAX_DEPTH];
+    };
+
+    // 信号处理函数只访问这些全局量
+    sample *g_samples = NULL;
+    int g_capacity = 0;
+    std::atomic<int> g_next(0);
+    std::atomic<int> g_dropped(0);
+    std::atomic<bool> g_active(false);
+
+    // 处理函数自身和信号返回跳板占前两帧
+    const int SKIP_FRAMES = 2;
+
+    void prof_handler(int, siginfo_t *, void *)
+    {
+        if (!g_active.load(std::memory_order_acquire))
+            return;
+        int saved_errno = errno;
+        int idx = g_next.fetch_add(1, std::memory_order_relaxed);
+        if (idx < g_capacity)
+        {
+            sample &s = g_samples[idx];
+            int n = backtrace(s.pcs, cpu_profiler::MAX_DEPTH);
+            s.depth.store(n > 0 ? n : 1, std::memory_order_release);
+        }
+        else
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+        errno = saved_errno;
+    }
+
+    void sleep_ms(long long ms)
+    {
+        struct timespec ts;
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000;
+        // 采样期间本线程也会被SIGPROF打断，剩余时间继续睡
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+            ;
+    }
+
+    void set_timer(int hz)
+    {
+        struct itimerval it;
+        memset(&it, 0, sizeof(it));
+        if (hz > 0)
+        {
+            it.it_interval.tv_usec = 1000000 / hz;
+            it.it_value = it.it_interval;
+        }
+        setitimer(ITIMER_PROF, &it, NULL);
+    }
+}
+
+std::string cpu_profiler::profile(int seconds, int hz)
+{
+    bool expected = false;
+    if (!m_running.compare_exchange_strong(expected, true))
+        return "";
+    if (seconds < 1)
+        seconds = 1;
+    if (seconds > MAX_SECONDS)
+        seconds = MAX_SECONDS;
+    if (hz < 1)
+        hz = 1;
+    if (hz > 1000)
+        hz = 1000;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long long want = (long long)seconds * hz * (cpus > 0 ? cpus : 1);
+    g_capacity = want < MAX_SAMPLES ? (int)want : MAX_SAMPLES;
+    g_samples = new sample[g_capacity];
+    for (int i = 0; i < g_capacity; ++i)
+        g_samples[i].depth.store(0, std::memory_order_relaxed);
+    g_next.store(0, std::memory_order_relaxed);
+    g_dropped.store(0, std::memory_order_relaxed);
+
+    // 第一次调用 backtrace 会加载 libgcc，不能发生在信号处理函数中
+    void *warm[4];
+    backtrace(warm, 4);
+
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_sigaction = prof_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+    g_active.store(true, std::memory_order_release);
+    set_timer(hz);
+
+    sleep_ms(seconds * 1000LL);
+
+    set_timer(0);
+    g_active.store(false, std::memory_order_release);
+    // 等待已经进入处理函数的线程写完；之后仍可能有挂起的SIGPROF，忽略而不是恢复默认(默认会终止进程)
+    sleep_ms(20);
+    signal(SIGPROF, SIG_IGN);
+
+    int taken = g_next.load(std::memory_order_relaxed);
+    if (taken > g_capacity)
+        taken = g_capacity;
+    std::map<std::vector<void *>, int> stacks;
+    for (int i = 0; i < taken; ++i)
+    {
+        int depth = g_samples[i].depth.load(std::memory_order_acquire);
+        if (depth <= SKIP_FRAMES)
+            continue;
+        // 根在前，与 folded 格式一致
+        std::vector<void *> key(g_samples[i].pcs + SKIP_FRAMES, g_samples[i].pcs + depth);
+        std::reverse(key.begin(), key.end());
+        stacks[key]++;
+    }
+    delete[] g_samples;
+    g_samples = NULL;
+    g_capacity = 0;
+
+    std::string out;
+    char buf[512];
+    snprintf(buf, sizeof(buf), "# tws cpu profile\n# seconds=%d hz=%d samples=%d dropped=%d\n", seconds, hz, taken,
+             g_dropped.load(std::memory_order_relaxed));
+    out += buf;
+    // 可执行映射，离线符号化时把地址换算为模块内偏移
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps)
+    {
+        char line[512];
+        while (fgets(line, sizeof(line), maps))
+        {
+            char range[64], perms[8], offset[32], dev[16], path[400];
+            unsigned long inode;
+            path[0] = '\0';
+            if (sscanf(line, "%63s %7s %31s %15s %lu %399s", range, perms, offset, dev, &inode, path) < 5)
+                continue;
+            if (perms[2] != 'x' || path[0] != '/')
+                continue;
+            snprintf(buf, sizeof(buf), "# map %s %s %s\n", range, offset, path);
+            out += buf;
+        }
+        fclose(maps);
+    }
+    for (std::map<std::vector<void *>, int>::const_iterator it = stacks.begin(); it != stacks.end(); ++it)
+    {
+        for (size_t i = 0; i < it->first.size(); ++i)
+        {
+            snprintf(buf, sizeof(buf), "%s%p", i ? ";" : "", it->first[i]);
+            out += buf;
+        }
+        snprintf(buf, sizeof(buf), " %d\n", it->second);
+        out += buf;
+    }
+
+    m_running.store(false, std::memory_order_relaxed);
+    return out;
+}
+
+void cpu_profiler::profile_async(int seconds, int hz, std::function<void(std::string)> done)
+{
+    if (running())
+    {
+        done(std::string());
+        return;
+    }
+    try
+    {
+        std::thread([this, seconds, hz, done]()
+        {
+            flight_recorder::install_alt_stack();
+            done(profile(seconds, hz));
+        }).detach();
+    }
+    catch (const std::system_error &)
+    {
+        done(std::string());
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef METRICS_PROFILER_H
+#define METRICS_PROFILER_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+/*
+采样式CPU剖析
+只在调用 profile() 期间用 setitimer(ITIMER_PROF) 触发 SIGPROF，在信号处理函数中记录被打断线程的调用栈，
+内核把 SIGPROF 投递给正在消耗CPU的线程，因此主线程、工作线程和后台执行器都会被采到；未启用时没有任何开销
+服务端只输出原始地址(folded stack)和可执行映射，符号化交给离线工具 profsym 完成
+*/
+
+class cpu_profiler
+{
+public:
+    static cpu_profiler *get_instance()
+    {
+        static cpu_profiler instance;
+        return &instance;
+    }
+
+    static const int MAX_DEPTH = 48;
+    static const int MAX_SAMPLES = 65536;
+    // 采样期间连接的空闲定时器不会延长，上限须小于连接空闲超时(3*TIMESLOT=15s)，留出发送结果的余量
+    static const int MAX_SECONDS = 10;
+
+    // 采样 seconds 秒后返回结果，期间阻塞调用线程；已有采样在进行时返回空串
+    // 输出格式：以 # 开头的头部与映射行，之后每行为 "根;...;叶 次数"，地址为十六进制
+    std::string profile(int seconds, int hz);
+    // 在单独创建的线程上调用 profile()，结束后在该线程上调用 done；不占用工作线程和后台执行器
+    // 已有采样在进行或无法创建线程时 done 收到空串(可能在返回前调用)
+    void profile_async(int seconds, int hz, std::function<void(std::string)> done);
+
+    bool running() const { return m_running.load(std::memory_order_relaxed); }
+
+private:
+    cpu_profiler() : m_running(false) {}
+    cpu_profiler(const cpu_profiler &) = delete;
+    cpu_profiler &operator=(const cpu_profiler &) = delete;
+
+    std::atomic<bool> m_running;
+};
+
+#endif
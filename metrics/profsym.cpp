@@ -0,0 +1,185 @@
+/*************************************************************
+ *CPU剖析结果符号化工具
+ *把 /admin/profile 输出的地址栈换算为 函数名 栈，输出可直接交给 flamegraph.pl
+ *需要与服务端相同的可执行文件和动态库，依赖 binutils 的 addr2line
+ *用法: ./profsym profile.txt > folded.txt，不带参数时读标准输入
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+namespace
+{
+    struct mapping
+    {
+        uint64_t start;
+        uint64_t end;
+        uint64_t offset;
+        std::string path;
+    };
+
+    struct stack_line
+    {
+        std::vector<uint64_t> pcs; // 根在前
+        long long count;
+    };
+
+    // 返回包含 addr 的映射下标，找不到返回-1
+    int find_mapping(const std::vector<mapping> &maps, uint64_t addr)
+    {
+        for (size_t i = 0; i < maps.size(); ++i)
+        {
+            if (addr >= maps[i].start && addr < maps[i].end)
+                return i;
+        }
+        return -1;
+    }
+
+    std::string base_name(const std::string &path)
+    {
+        size_t pos = path.find_last_of('/');
+        return pos == std::string::npos ? path : path.substr(pos + 1);
+    }
+
+    // 对同一模块内的偏移批量调用 addr2line，结果写入 names
+    void symbolize(const std::string &path, const std::vector<uint64_t> &offsets, std::map<uint64_t, std::string> &names)
+    {
+        const size_t BATCH = 256;
+        for (size_t begin = 0; begin < offsets.size(); begin += BATCH)
+        {
+            std::string cmd = "addr2line -f -C -e '" + path + "'";
+            size_t end = begin + BATCH < offsets.size() ? begin + BATCH : offsets.size();
+            char buf[32];
+            for (size_t i = begin; i < end; ++i)
+            {
+                snprintf(buf, sizeof(buf), " 0x%llx", (unsigned long long)offsets[i]);
+                cmd += buf;
+            }
+            cmd += " 2>/dev/null";
+            FILE *fp = popen(cmd.c_str(), "r");
+            if (!fp)
+                return;
+            char func[4096], loc[4096];
+            // 每个地址输出两行：函数名、文件:行号
+            for (size_t i = begin; i < end && fgets(func, sizeof(func), fp) && fgets(loc, sizeof(loc), fp); ++i)
+            {
+                func[strcspn(func, "\n")] = '\0';
+                if (strcmp(func, "??") != 0)
+                    names[offsets[i]] = func;
+            }
+            pclose(fp);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *fp = argc > 1 ? fopen(argv[1], "r") : stdin;
+    if (!fp)
+    {
+        fprintf(stderr, "open %s failed\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<mapping> maps;
+    std::vector<stack_line> stacks;
+    char line[65536];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "# map ", 6) == 0)
+        {
+            unsigned long long start, end, offset;
+            char path[4096];
+            if (sscanf(line + 6, "%llx-%llx %llx %4095s", &start, &end, &offset, path) == 4)
+            {
+                mapping m;
+                m.start = start;
+                m.end = end;
+                m.offset = offset;
+                m.path = path;
+                maps.push_back(m);
+            }
+            continue;
+        }
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+        char *space = strrchr(line, ' ');
+        if (!space)
+            continue;
+        *space = '\0';
+        stack_line s;
+        s.count = atoll(space + 1);
+        for (char *tok = strtok(line, ";"); tok; tok = strtok(NULL, ";"))
+            s.pcs.push_back(strtoull(tok, NULL, 16));
+        stacks.push_back(s);
+    }
+    if (fp != stdin)
+        fclose(fp);
+
+    // 叶子帧是被打断处的地址，其余是返回地址，减1后才落在call指令内
+    std::map<int, std::vector<uint64_t> > by_module;
+    for (size_t i = 0; i < stacks.size(); ++i)
+    {
+        for (size_t k = 0; k < stacks[i].pcs.size(); ++k)
+        {
+            uint64_t pc = stacks[i].pcs[k] - (k + 1 < stacks[i].pcs.size() ? 1 : 0);
+            stacks[i].pcs[k] = pc;
+            int m = find_mapping(maps, pc);
+            if (m >= 0)
+                by_module[m].push_back(pc - maps[m].start + maps[m].offset);
+        }
+    }
+    std::map<int, std::map<uint64_t, std::string> > names;
+    for (std::map<int, std::vector<uint64_t> >::iterator it = by_module.begin(); it != by_module.end(); ++it)
+        symbolize(maps[it->first].path, it->second, names[it->first]);
+
+    // 符号化后不同地址可能落在同一函数，重新合并
+    std::map<std::string, long long> folded;
+    char buf[64];
+    for (size_t i = 0; i < stacks.size(); ++i)
+    {
+        std::string key;
+        for (size_t k = 0; k < stacks[i].pcs.size(); ++k)
+        {
+            uint64_t pc = stacks[i].pcs[k];
+            int m = find_mapping(maps, pc);
+            std::string frame;
+            if (m >= 0)
+            {
+                uint64_t off = pc - maps[m].start + maps[m].offset;
+                std::map<uint64_t, std::string>::const_iterator n = names[m].find(off);
+                if (n != names[m].end())
+                    frame = n->second;
+                else
+                {
+                    snprintf(buf, sizeof(buf), "+0x%llx", (unsigned long long)off);
+                    frame = base_name(maps[m].path) + buf;
+                }
+            }
+            else
+            {
+                snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)pc);
+                frame = buf;
+            }
+            // ; 是 folded 格式的分隔符
+            for (size_t c = 0; c < frame.size(); ++c)
+            {
+                if (frame[c] == ';')
+                    frame[c] = ':';
+            }
+            if (!key.empty())
+                key += ';';
+            key += frame;
+        }
+        folded[key] += stacks[i].count;
+    }
+    for (std::map<std::string, long long>::const_iterator it = folded.begin(); it != folded.end(); ++it)
+        printf("%s %lld\n", it->first.c_str(), it->second);
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "registry.h"
+#include <stdio.h>
+#include <algorithm>
+
+namespace
+{
+    thread_local void *t_cells = NULL;
+
+    std::string format_value(double v)
+    {
+        char buf[64];
+        if (v == (long long)v)
+            snprintf(buf, sizeof(buf), "%lld", (long long)v);
+        else
+            snprintf(buf, sizeof(buf), "%.6g", v);
+        return buf;
+    }
+
+    // name{labels,extra} value
+    void append_sample(std::string &out, const std::string &name, const std::string &labels,
+                       const std::string &extra, double value)
+    {
+        out += name;
+        if (!labels.empty() || !extra.empty())
+        {
+            out += '{';
+            out += labels;
+            if (!labels.empty() && !extra.empty())
+                out += ',';
+            out += extra;
+            out += '}';
+        }
+        out += ' ';
+        out += format_value(value);
+        out += '\n';
+    }
+}
+
+void metric_counter::inc(long long n)
+{
+    metrics_registry::get_instance()->add_cell(m_cell, n);
+}
+
+long long metric_counter::value() const
+{
+    return metrics_registry::get_instance()->sum_cell(m_cell);
+}
+
+void metric_gauge::inc(long long n)
+{
+    metrics_registry::get_instance()->add_cell(m_cell, n);
+}
+
+long long metric_gauge::value() const
+{
+    return metrics_registry::get_instance()->sum_cell(m_cell);
+}
+
+void metric_histogram::observe(long long v)
+{
+    // 桶很少，线性查找即可；超过所有上界的计入+Inf桶
+    size_t i = 0;
+    while (i < m_bounds.size() && v > m_bounds[i])
+        ++i;
+    metrics_registry *r = metrics_registry::get_instance();
+    r->add_cell(m_cell + i, 1);
+    r->add_cell(m_cell + m_bounds.size() + 1, 1);
+    r->add_cell(m_cell + m_bounds.size() + 2, v);
+}
+
+metrics_registry::cells *metrics_registry::local_cells(bool *exclusive)
+{
+    if (t_cells)
+    {
+        *exclusive = t_cells != &m_shared;
+        return (cells *)t_cells;
+    }
+    cells *c = &m_shared;
+    m_lock.lock();
+    int n = m_thread_count.load(std::memory_order_relaxed);
+    if (n < MAX_THREADS)
+    {
+        c = new cells;
+        m_threads[n] = c;
+        m_thread_count.store(n + 1, std::memory_order_release);
+    }
+    m_lock.unlock();
+    t_cells = c;
+    *exclusive = c != &m_shared;
+    return c;
+}
+
+void metrics_registry::add_cell(int cell, long long n)
+{
+    bool exclusive;
+    std::atomic<long long> &v = local_cells(&exclusive)->v[cell];
+    if (exclusive)
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    else
+        v.fetch_add(n, std::memory_order_relaxed);
+}
+
+long long metrics_registry::sum_cell(int cell) const
+{
+    long long sum = m_shared.v[cell].load(std::memory_order_relaxed);
+    int n = m_thread_count.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+        sum += m_threads[i]->v[cell].load(std::memory_order_relaxed);
+    return sum;
+}
+
+// 需持有m_lock
+int metrics_registry::alloc_cells(int n)
+{
+    if (m_next_cell + n > MAX_CELLS)
+        return -1;
+    int cell = m_next_cell;
+    m_next_cell += n;
+    return cell;
+}
+
+metric_counter *metrics_registry::add_counter(const char *name, const char *help, const char *labels)
+{
+    m_lock.lock();
+    int cell = alloc_cells(1);
+    if (cell < 0)
+    {
+        m_lock.unlock();
+        return NULL;
+    }
+    metric_counter *c = new metric_counter;
+    c->m_cell = cell;
+    entry e;
+    e.name = name;
+    e.help = help;
+    e.type = "counter";
+    e.labels = labels;
+    e.cell = cell;
+    e.histogram = NULL;
+    e.scale = 1;
+    m_entries.push_back(e);
+    m_lock.unlock();
+    return c;
+}
+
+metric_gauge *metrics_registry::add_gauge(const char *name, const char *help, const char *labels)
+{
+    m_lock.lock();
+    int cell = alloc_cells(1);
+    if (cell < 0)
+    {
+        m_lock.unlock();
+        return NULL;
+    }
+    metric_gauge *g = new metric_gauge;
+    g->m_cell = cell;
+    entry e;
+    e.name = name;
+    e.help = help;
+    e.type = "gauge";
+    e.labels = labels;
+    e.cell = cell;
+    e.histogram = NULL;
+    e.scale = 1;
+    m_entries.push_back(e);
+    m_lock.unlock();
+    return g;
+}
+
+metric_histogram *metrics_registry::add_histogram(const char *name, const char *help,
+                                                  const std::vector<long long> &bounds, double scale,
+                                                  const char *labels)
+{
+    m_lock.lock();
+    // 各桶(含+Inf)、总数、总和
+    int cell = alloc_cells(bounds.size() + 3);
+    if (cell < 0)
+    {
+        m_lock.unlock();
+        return NULL;
+    }
+    metric_histogram *h = new metric_histogram;
+    h->m_cell = cell;
+    h->m_bounds = bounds;
+    std::sort(h->m_bounds.begin(), h->m_bounds.end());
+    entry e;
+    e.name = name;
+    e.help = help;
+    e.type = "histogram";
+    e.labels = labels;
+    e.cell = cell;
+    e.histogram = h;
+    e.scale = scale > 0 ? scale : 1;
+    m_entries.push_back(e);
+    m_lock.unlock();
+    return h;
+}
+
+void metrics_registry::add_callback(const char *name, const char *help, const char *type,
+                                    std::function<double()> fn, const char *labels)
+{
+    m_lock.lock();
+    entry e;
+    e.name = name;
+    e.help = help;
+    e.type = type;
+    e.labels = labels;
+    e.cell = -1;
+    e.histogram = NULL;
+    e.scale = 1;
+    e.fn = fn;
+    m_entries.push_back(e);
+    m_lock.unlock();
+}
+
+void metrics_registry::add_collector(std::function<void(std::string &out)> fn)
+{
+    m_lock.lock();
+    m_collectors.push_back(fn);
+    m_lock.unlock();
+}
+
+std::string metrics_registry::scrape()
+{
+    // 注册只发生在启动阶段，抓取时复制一份，避免回调执行期间持有锁
+    m_lock.lock();
+    std::vector<entry> entries = m_entries;
+    std::vector<std::function<void(std::string &)>> collectors = m_collectors;
+    m_lock.unlock();
+
+    std::string out;
+    out.reserve(4096);
+    std::string last_name;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const entry &e = entries[i];
+        if (e.name != last_name)
+        {
+            out += "# HELP " + e.name + " " + e.help + "\n";
+            out += "# TYPE " + e.name + " " + e.type + "\n";
+            last_name = e.name;
+        }
+        if (e.histogram)
+        {
+            const std::vector<long long> &bounds = e.histogram->m_bounds;
+            long long cumulative = 0;
+            for (size_t b = 0; b <= bounds.size(); ++b)
+            {
+                cumulative += sum_cell(e.cell + b);
+                std::string le = b < bounds.size() ? format_value(bounds[b] / e.scale) : "+Inf";
+                append_sample(out, e.name + "_bucket", e.labels, "le=\"" + le + "\"", cumulative);
+            }
+            append_sample(out, e.name + "_count", e.labels, "", sum_cell(e.cell + bounds.size() + 1));
+            append_sample(out, e.name + "_sum", e.labels, "", sum_cell(e.cell + bounds.size() + 2) / e.scale);
+        }
+        else if (e.cell >= 0)
+            append_sample(out, e.name, e.labels, "", sum_cell(e.cell));
+        else
+            append_sample(out, e.name, e.labels, "", e.fn());
+    }
+    for (size_t i = 0; i < collectors.size(); ++i)
+        collectors[i](out);
+    return out;
+}
@@ -0,0 +1,127 @@
+#ifndef METRICS_REGISTRY_H
+#define METRICS_REGISTRY_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+#include "../lock/locker.h"
+
+/*
+指标注册表
+计数器、增减型仪表和直方图都由若干"格子"组成，每个线程有自己的一组格子，
+写入时只改本线程的格子(单写者，relaxed读改写，无锁前缀指令)，抓取时把所有线程的格子相加
+另外支持在抓取时调用回调取值的指标，以及整段输出的收集器
+输出为 Prometheus 文本格式，由 /metrics 提供
+*/
+
+class metrics_registry;
+
+class metric_counter
+{
+public:
+    void inc(long long n = 1);
+    long long value() const;
+
+private:
+    friend class metrics_registry;
+    int m_cell;
+};
+
+// 只支持增减，值为所有线程增减量之和，可以在不同线程分别inc/dec
+class metric_gauge
+{
+public:
+    void inc(long long n = 1);
+    void dec(long long n = 1) { inc(-n); }
+    long long value() const;
+
+private:
+    friend class metrics_registry;
+    int m_cell;
+};
+
+// 固定桶上界的直方图，占用 桶数+2 个格子(各桶计数、总数、总和)
+class metric_histogram
+{
+public:
+    void observe(long long v);
+
+private:
+    friend class metrics_registry;
+    int m_cell;
+    std::vector<long long> m_bounds; // 升序的桶上界
+};
+
+class metrics_registry
+{
+public:
+    static metrics_registry *get_instance()
+    {
+        static metrics_registry instance;
+        return &instance;
+    }
+
+    static const int MAX_CELLS = 1024;  // 所有指标共用的格子数
+    static const int MAX_THREADS = 256; // 超出后的线程共用一组原子格子
+
+    // labels 形如 route="static"，同名不同标签的指标共用HELP/TYPE
+    // 格子用完时返回NULL，调用方应在启动阶段注册
+    metric_counter *add_counter(const char *name, const char *help, const char *labels = "");
+    metric_gauge *add_gauge(const char *name, const char *help, const char *labels = "");
+    // bounds 为桶上界(升序)，scale 为输出时的除数，例如微秒记录、秒输出时为1e6
+    metric_histogram *add_histogram(const char *name, const char *help, const std::vector<long long> &bounds,
+                                    double scale = 1, const char *labels = "");
+    // 抓取时调用 fn 取值，type 为 "counter" 或 "gauge"
+    void add_callback(const char *name, const char *help, const char *type, std::function<double()> fn,
+                      const char *labels = "");
+    // 直接追加一段 Prometheus 文本，用于已有的统计结构(如延迟直方图)
+    void add_collector(std::function<void(std::string &out)> fn);
+
+    // 所有指标的 Prometheus 文本格式
+    std::string scrape();
+
+    // 供指标对象使用
+    void add_cell(int cell, long long n);
+    long long sum_cell(int cell) const;
+
+private:
+    struct cells
+    {
+        std::atomic<long long> v[MAX_CELLS];
+        cells()
+        {
+            for (int i = 0; i < MAX_CELLS; ++i)
+                v[i].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    struct entry
+    {
+        std::string name;
+        std::string help;
+        std::string type;
+        std::string labels;
+        int cell;                          // 格子指标的起始格子，回调指标为-1
+        const metric_histogram *histogram; // 直方图指标
+        double scale;
+        std::function<double()> fn;
+    };
+
+    metrics_registry() : m_next_cell(0), m_thread_count(0) {}
+    metrics_registry(const metrics_registry &) = delete;
+    metrics_registry &operator=(const metrics_registry &) = delete;
+
+    cells *local_cells(bool *exclusive);
+    int alloc_cells(int n);
+
+    locker m_lock; // 保护注册和线程登记
+    std::vector<entry> m_entries;
+    std::vector<std::function<void(std::string &)>> m_collectors;
+    int m_next_cell;
+    cells *m_threads[MAX_THREADS];
+    std::atomic<int> m_thread_count;
+    cells m_shared;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "runtime_stats.h"
+#include "registry.h"
+
+namespace
+{
+    Json::Value int64(long long v)
+    {
+        return Json::Value(static_cast<Json::Value::Int64>(v));
+    }
+
+    Json::Value distribution(const latency_histogram &h)
+    {
+        Json::Value v;
+        uint64_t count = h.count();
+        v["avg"] = count > 0 ? (double)h.sum() / count : 0.0;
+        v["p50"] = int64(h.percentile(0.50));
+        v["p99"] = int64(h.percentile(0.99));
+        v["max"] = int64(h.max());
+        return v;
+    }
+
+    void bump(std::atomic<long long> &v, long long n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+}
+
+runtime_stats::runtime_stats()
+    : m_worker_count(0), m_queue_depth(0), m_queue_depth_max(0), m_queue_capacity(0), m_rejected(0),
+      m_loop_iterations(0), m_loop_wait_us(0), m_loop_busy_us(0)
+{
+    for (int i = 0; i < MAX_WORKERS; ++i)
+    {
+        m_workers[i].tasks.store(0, std::memory_order_relaxed);
+        m_workers[i].busy_us.store(0, std::memory_order_relaxed);
+        m_workers[i].idle_us.store(0, std::memory_order_relaxed);
+    }
+    register_metrics();
+}
+
+void runtime_stats::register_metrics()
+{
+    metrics_registry *r = metrics_registry::get_instance();
+    r->add_callback("tws_threadpool_queue_depth", "Requests waiting in the worker queue", "gauge",
+                    [this]() { return (double)m_queue_depth.load(std::memory_order_relaxed); });
+    r->add_callback("tws_threadpool_rejected_total", "Requests dropped because the worker queue was full", "counter",
+                    [this]() { return (double)m_rejected.load(std::memory_order_relaxed); });
+    r->add_callback("tws_threadpool_busy_seconds_total", "Time workers spent handling requests", "counter",
+                    [this]()
+                    {
+                        long long sum = 0;
+                        int n = m_worker_count.load(std::memory_order_acquire);
+                        for (int i = 0; i < n && i < MAX_WORKERS; ++i)
+                            sum += m_workers[i].busy_us.load(std::memory_order_relaxed);
+                        return sum / 1e6;
+                    });
+    r->add_callback("tws_event_loop_iterations_total", "epoll_wait calls in the main loop", "counter",
+                    [this]() { return (double)m_loop_iterations.load(std::memory_order_relaxed); });
+    r->add_callback("tws_event_loop_busy_seconds_total", "Time the main loop spent handling events", "counter",
+                    [this]() { return m_loop_busy_us.load(std::memory_order_relaxed) / 1e6; });
+}
+
+int runtime_stats::register_worker()
+{
+    m_lock.lock();
+    int idx = m_worker_count.load(std::memory_order_relaxed);
+    m_worker_count.store(idx + 1, std::memory_order_release);
+    m_lock.unlock();
+    return idx < MAX_WORKERS ? idx : MAX_WORKERS - 1;
+}
+
+void runtime_stats::worker_task(int idx, long long idle_us, long long busy_us)
+{
+    worker_slot &w = m_workers[idx];
+    // 共用最后一个槽位时有多个写者
+    if (idx == MAX_WORKERS - 1 && m_worker_count.load(std::memory_order_relaxed) > MAX_WORKERS)
+    {
+        w.tasks.fetch_add(1, std::memory_order_relaxed);
+        w.idle_us.fetch_add(idle_us, std::memory_order_relaxed);
+        w.busy_us.fetch_add(busy_us, std::memory_order_relaxed);
+        return;
+    }
+    bump(w.tasks, 1);
+    bump(w.idle_us, idle_us);
+    bump(w.busy_us, busy_us);
+}
+
+void runtime_stats::set_queue_depth(int depth)
+{
+    m_queue_depth.store(depth, std::memory_order_relaxed);
+    if (depth > m_queue_depth_max.load(std::memory_order_relaxed))
+        m_queue_depth_max.store(depth, std::memory_order_relaxed);
+}
+
+void runtime_stats::record_loop(int events, long long wait_us, long long busy_us)
+{
+    bump(m_loop_iterations, 1);
+    bump(m_loop_wait_us, wait_us);
+    bump(m_loop_busy_us, busy_us);
+    m_loop_events.record(events > 0 ? events : 0, true);
+    m_loop_iter_us.record(busy_us > 0 ? busy_us : 0, true);
+}
+
+Json::Value runtime_stats::to_json() const
+{
+    Json::Value root;
+
+    Json::Value pool;
+    pool["queue_depth"] = m_queue_depth.load(std::memory_order_relaxed);
+    pool["queue_depth_max"] = m_queue_depth_max.load(std::memory_order_relaxed);
+    pool["queue_capacity"] = m_queue_capacity.load(std::memory_order_relaxed);
+    pool["rejected"] = int64(m_rejected.load(std::memory_order_relaxed));
+    Json::Value workers(Json::arrayValue);
+    int n = m_worker_count.load(std::memory_order_acquire);
+    if (n > MAX_WORKERS)
+        n = MAX_WORKERS;
+    long long total_busy = 0, total_idle = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        long long busy = m_workers[i].busy_us.load(std::memory_order_relaxed);
+        long long idle = m_workers[i].idle_us.load(std::memory_order_relaxed);
+        Json::Value w;
+        w["tasks"] = int64(m_workers[i].tasks.load(std::memory_order_relaxed));
+        w["busy_us"] = int64(busy);
+        w["idle_us"] = int64(idle);
+        w["utilization"] = busy + idle > 0 ? (double)busy / (busy + idle) : 0.0;
+        workers.append(w);
+        total_busy += busy;
+        total_idle += idle;
+    }
+    pool["threads"] = n;
+    pool["utilization"] = total_busy + total_idle > 0 ? (double)total_busy / (total_busy + total_idle) : 0.0;
+    pool["workers"] = workers;
+    root["threadpool"] = pool;
+
+    Json::Value loop;
+    long long wait = m_loop_wait_us.load(std::memory_order_relaxed);
+    long long busy = m_loop_busy_us.load(std::memory_order_relaxed);
+    loop["iterations"] = int64(m_loop_iterations.load(std::memory_order_relaxed));
+    loop["utilization"] = wait + busy > 0 ? (double)busy / (wait + busy) : 0.0;
+    loop["events_per_wait"] = distribution(m_loop_events);
+    loop["iteration_us"] = distribution(m_loop_iter_us);
+    root["event_loop"] = loop;
+    return root;
+}
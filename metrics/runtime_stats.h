@@ -0,0 +1,73 @@
+#ifndef METRICS_RUNTIME_STATS_H
+#define METRICS_RUNTIME_STATS_H
+
+#include <atomic>
+#include "../lock/locker.h"
+#include "json/json.h"
+#include "latency.h"
+
+/*
+线程池与事件循环的运行统计
+工作线程各写自己的槽位(单写者)，事件循环只有主线程写，都不需要原子加；
+队列深度在已持有的队列锁内顺带更新
+用来区分延迟来自事件循环、排队还是处理本身
+*/
+
+class runtime_stats
+{
+public:
+    static runtime_stats *get_instance()
+    {
+        static runtime_stats instance;
+        return &instance;
+    }
+
+    static const int MAX_WORKERS = 64; // 超出的工作线程合并记在最后一个槽位
+
+    // 工作线程启动时调用一次，返回槽位下标
+    int register_worker();
+    // idle_us 为取到任务前的等待，busy_us 为处理耗时
+    void worker_task(int idx, long long idle_us, long long busy_us);
+
+    // 调用方持有队列锁
+    void set_queue_depth(int depth);
+    void set_queue_capacity(int capacity) { m_queue_capacity.store(capacity, std::memory_order_relaxed); }
+    void queue_rejected() { m_rejected.fetch_add(1, std::memory_order_relaxed); }
+
+    // 只由主线程调用：本轮 epoll_wait 返回的事件数、阻塞时间和处理时间
+    void record_loop(int events, long long wait_us, long long busy_us);
+
+    // {"threadpool":{...,"workers":[...]},"event_loop":{...}}
+    Json::Value to_json() const;
+
+private:
+    struct alignas(64) worker_slot
+    {
+        std::atomic<long long> tasks;
+        std::atomic<long long> busy_us;
+        std::atomic<long long> idle_us;
+    };
+
+    runtime_stats();
+    runtime_stats(const runtime_stats &) = delete;
+    runtime_stats &operator=(const runtime_stats &) = delete;
+
+    void register_metrics();
+
+    worker_slot m_workers[MAX_WORKERS];
+    std::atomic<int> m_worker_count;
+    locker m_lock; // 保护工作线程登记
+
+    std::atomic<int> m_queue_depth;
+    std::atomic<int> m_queue_depth_max;
+    std::atomic<int> m_queue_capacity;
+    std::atomic<long long> m_rejected;
+
+    std::atomic<long long> m_loop_iterations;
+    std::atomic<long long> m_loop_wait_us;
+    std::atomic<long long> m_loop_busy_us;
+    latency_histogram m_loop_events;  // 每次 epoll_wait 的事件数
+    latency_histogram m_loop_iter_us; // 每轮事件处理耗时
+};
+
+#endif
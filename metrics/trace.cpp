@@ -0,0 +1,102 @@
+#include "trace.h"
+#include "latency.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace
+{
+    // (void *)1 表示登记表已满，本线程不再尝试
+    thread_local void *t_buffer = NULL;
+    thread_local unsigned t_sample_counter = 0;
+}
+
+bool tracer::sample()
+{
+    int every = m_sample_every.load(std::memory_order_relaxed);
+    if (every <= 0)
+        return false;
+    return ++t_sample_counter % every == 0;
+}
+
+tracer::thread_buffer *tracer::local_buffer()
+{
+    if (t_buffer)
+        return t_buffer == (void *)1 ? NULL : (thread_buffer *)t_buffer;
+    thread_buffer *b = NULL;
+    m_lock.lock();
+    int n = m_thread_count.load(std::memory_order_relaxed);
+    if (n < MAX_THREADS)
+    {
+        b = new thread_buffer;
+        b->tid = syscall(SYS_gettid);
+        b->next = 0;
+        m_threads[n] = b;
+        m_thread_count.store(n + 1, std::memory_order_release);
+    }
+    m_lock.unlock();
+    t_buffer = b ? (void *)b : (void *)1;
+    return b;
+}
+
+void tracer::record(uint64_t req, const char *name, long long start_us, long long end_us)
+{
+    if (req == 0)
+        return;
+    thread_buffer *b = local_buffer();
+    if (!b)
+        return;
+    b->lock.lock();
+    span &s = b->spans[b->next % SPANS_PER_THREAD];
+    s.req = req;
+    s.name = name;
+    s.start_us = start_us;
+    s.dur_us = end_us > start_us ? end_us - start_us : 0;
+    b->next++;
+    b->lock.unlock();
+}
+
+std::string tracer::to_chrome_json() const
+{
+    std::string out;
+    out.reserve(1 << 16);
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    int pid = getpid();
+    char buf[256];
+    bool first = true;
+    int n = m_thread_count.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+    {
+        thread_buffer *b = m_threads[i];
+        // 逐个线程加锁复制，避免长时间阻塞写入方
+        b->lock.lock();
+        uint64_t end = b->next;
+        uint64_t begin = end > (uint64_t)SPANS_PER_THREAD ? end - SPANS_PER_THREAD : 0;
+        for (uint64_t seq = begin; seq < end; ++seq)
+        {
+            const span &s = b->spans[seq % SPANS_PER_THREAD];
+            int len = snprintf(buf, sizeof(buf),
+                               "%s{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                               "\"pid\":%d,\"tid\":%d,\"args\":{\"req\":%llu}}",
+                               first ? "" : ",", s.name, s.start_us, s.dur_us, pid, b->tid,
+                               (unsigned long long)s.req);
+            out.append(buf, len);
+            first = false;
+        }
+        b->lock.unlock();
+    }
+    out += "]}";
+    return out;
+}
+
+trace_span::trace_span(uint64_t req, const char *name) : m_req(req), m_name(name), m_start_us(0)
+{
+    if (m_req)
+        m_start_us = latency_stats::now_us();
+}
+
+trace_span::~trace_span()
+{
+    if (m_req)
+        tracer::get_instance()->record(m_req, m_name, m_start_us, latency_stats::now_us());
+}
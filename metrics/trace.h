@@ -0,0 +1,90 @@
+#ifndef METRICS_TRACE_H
+#define METRICS_TRACE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include "../lock/locker.h"
+
+/*
+请求追踪
+每个请求分配一个请求ID，按 1/N 采样；被采样的请求在各处理阶段记录耗时片段(span)
+片段写入当前线程自己的环形缓冲(写满后覆盖最旧的)，只在 /admin/trace 导出时才读取所有线程的缓冲，
+导出格式为 Chrome trace_event JSON，可直接用 Perfetto 或 chrome://tracing 打开
+一个请求可能先后经过主线程、工作线程和后台执行器，按请求ID(args.req)关联
+*/
+
+class tracer
+{
+public:
+    static tracer *get_instance()
+    {
+        static tracer instance;
+        return &instance;
+    }
+
+    static const int MAX_THREADS = 128;     // 超出的线程不记录片段
+    static const int SPANS_PER_THREAD = 4096;
+    static const int DEFAULT_SAMPLE_EVERY = 100;
+
+    // 新请求的ID，从1开始
+    uint64_t next_request_id() { return m_next_id.fetch_add(1, std::memory_order_relaxed) + 1; }
+    // 按当前采样率决定本请求是否记录片段，每个线程独立计数
+    bool sample();
+    // 0 表示关闭追踪
+    void set_sample_every(int n) { m_sample_every.store(n < 0 ? 0 : n, std::memory_order_relaxed); }
+    int sample_every() const { return m_sample_every.load(std::memory_order_relaxed); }
+
+    // name 必须是字符串常量，缓冲中只保存指针
+    void record(uint64_t req, const char *name, long long start_us, long long end_us);
+
+    // {"traceEvents":[{"name","ph":"X","ts","dur","pid","tid","args":{"req"}}...]}
+    std::string to_chrome_json() const;
+
+private:
+    struct span
+    {
+        uint64_t req;
+        const char *name;
+        long long start_us;
+        long long dur_us;
+    };
+
+    struct thread_buffer
+    {
+        int tid;
+        uint64_t next; // 下一个写入的序号
+        locker lock;   // 只与导出竞争
+        span spans[SPANS_PER_THREAD];
+    };
+
+    tracer() : m_next_id(0), m_sample_every(DEFAULT_SAMPLE_EVERY), m_thread_count(0) {}
+    tracer(const tracer &) = delete;
+    tracer &operator=(const tracer &) = delete;
+
+    thread_buffer *local_buffer();
+
+    std::atomic<uint64_t> m_next_id;
+    std::atomic<int> m_sample_every;
+    thread_buffer *m_threads[MAX_THREADS];
+    std::atomic<int> m_thread_count;
+    locker m_lock; // 保护线程登记
+};
+
+// 作用域内的片段，req 为0(未采样)时不读时钟也不记录
+class trace_span
+{
+public:
+    trace_span(uint64_t req, const char *name);
+    ~trace_span();
+
+private:
+    trace_span(const trace_span &) = delete;
+    trace_span &operator=(const trace_span &) = delete;
+
+    uint64_t m_req;
+    const char *m_name;
+    long long m_start_us;
+};
+
+#endif
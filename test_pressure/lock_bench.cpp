@@ -0,0 +1,159 @@
+/*************************************************************
+ *锁竞争压测
+ *对比 lock/locker.h 中基于 futex 的 locker/sem 与 pthread_mutex_t/sem_t，
+ *分别用 1/2/4/8/16 个线程测试：
+ *  mutex   所有线程反复争抢同一把锁，临界区内做少量计算
+ *  handoff 一个生产者投递任务，其余线程按线程池的方式 sem.wait 后从加锁队列取任务
+ *用法: ./lock_bench [每轮操作数]
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <list>
+#include "../lock/locker.h"
+
+static long long g_ops = 2000000;
+
+static double now_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// 与 locker/sem 接口相同的 pthread 版本，作为对照
+class pthread_locker
+{
+public:
+    pthread_locker() { pthread_mutex_init(&m_mutex, NULL); }
+    ~pthread_locker() { pthread_mutex_destroy(&m_mutex); }
+    bool lock() { return pthread_mutex_lock(&m_mutex) == 0; }
+    bool unlock() { return pthread_mutex_unlock(&m_mutex) == 0; }
+
+private:
+    pthread_mutex_t m_mutex;
+};
+
+class pthread_sem
+{
+public:
+    pthread_sem() { sem_init(&m_sem, 0, 0); }
+    ~pthread_sem() { sem_destroy(&m_sem); }
+    bool wait() { return sem_wait(&m_sem) == 0; }
+    bool post() { return sem_post(&m_sem) == 0; }
+
+private:
+    sem_t m_sem;
+};
+
+template <typename L>
+struct mutex_case
+{
+    L lock;
+    long long counter;
+    long long per_thread;
+};
+
+template <typename L>
+static void *mutex_worker(void *arg)
+{
+    mutex_case<L> *c = (mutex_case<L> *)arg;
+    for (long long i = 0; i < c->per_thread; ++i)
+    {
+        c->lock.lock();
+        // 模拟很短的临界区
+        c->counter = c->counter * 31 + i;
+        c->lock.unlock();
+    }
+    return NULL;
+}
+
+template <typename L, typename S>
+struct handoff_case
+{
+    L lock;
+    S queuestat;
+    std::list<long long> queue;
+    long long consumed;
+    long long per_consumer;
+};
+
+template <typename L, typename S>
+static void *handoff_consumer(void *arg)
+{
+    handoff_case<L, S> *c = (handoff_case<L, S> *)arg;
+    for (long long i = 0; i < c->per_consumer; ++i)
+    {
+        c->queuestat.wait();
+        c->lock.lock();
+        c->queue.pop_front();
+        c->consumed++;
+        c->lock.unlock();
+    }
+    return NULL;
+}
+
+template <typename L>
+static double run_mutex(int threads)
+{
+    mutex_case<L> c;
+    c.counter = 0;
+    c.per_thread = g_ops / threads;
+    pthread_t tids[16];
+    double start = now_sec();
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&tids[i], NULL, mutex_worker<L>, &c);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    return c.per_thread * threads / (now_sec() - start);
+}
+
+template <typename L, typename S>
+static double run_handoff(int threads)
+{
+    // 生产者占一个线程，至少一个消费者
+    int consumers = threads > 1 ? threads - 1 : 1;
+    handoff_case<L, S> c;
+    c.consumed = 0;
+    c.per_consumer = g_ops / 4 / consumers;
+    long long total = c.per_consumer * consumers;
+    pthread_t tids[16];
+    double start = now_sec();
+    for (int i = 0; i < consumers; ++i)
+        pthread_create(&tids[i], NULL, handoff_consumer<L, S>, &c);
+    for (long long i = 0; i < total; ++i)
+    {
+        c.lock.lock();
+        c.queue.push_back(i);
+        c.lock.unlock();
+        c.queuestat.post();
+    }
+    for (int i = 0; i < consumers; ++i)
+        pthread_join(tids[i], NULL);
+    return total / (now_sec() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        g_ops = atoll(argv[1]);
+
+    printf("ops per round: %lld\n", g_ops);
+    printf("%8s %16s %16s %16s %16s\n", "threads", "mutex pthread", "mutex futex", "handoff pthread", "handoff futex");
+
+    int thread_counts[] = {1, 2, 4, 8, 16};
+    for (int k = 0; k < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); ++k)
+    {
+        int n = thread_counts[k];
+        double mp = run_mutex<pthread_locker>(n);
+        double mf = run_mutex<locker>(n);
+        double hp = run_handoff<pthread_locker, pthread_sem>(n);
+        double hf = run_handoff<locker, sem>(n);
+        printf("%8d %16.0f %16.0f %16.0f %16.0f\n", n, mp, mf, hp, hf);
+    }
+    printf("(ops/sec)\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*************************************************************
+ *日志吞吐量压测
+ *分别用 1/2/4/8/16 个线程并发写日志，输出每秒写入行数
+ *用法: ./log_bench [每个线程行数] [0同步/1异步/2异步二进制] [日志目录]
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <string>
+#include "../log/log.h"
+
+static long long g_lines_per_thread = 200000;
+static int m_close_log = 0;
+
+static double now_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *producer(void *arg)
+{
+    long id = (long)arg;
+    for (long long i = 0; i < g_lines_per_thread; ++i)
+    {
+        LOG_INFO("bench thread %ld line %lld: %s", id, i, "GET /index.html HTTP/1.1");
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        g_lines_per_thread = atoll(argv[1]);
+    int async = argc > 2 ? atoi(argv[2]) : 1;
+    std::string dir = argc > 3 ? argv[3] : "./bench_log";
+    mkdir(dir.c_str(), 0755);
+
+    std::string file = dir + "/BenchLog";
+    if (!Log::get_instance()->init(file.c_str(), 0, 2000, 800000000, async ? 800 : 0, async == 2))
+    {
+        printf("open log file failed\n");
+        return 1;
+    }
+
+    printf("mode: %s, lines per thread: %lld\n", async == 2 ? "async binary" : (async ? "async" : "sync"), g_lines_per_thread);
+    printf("%8s %14s %14s %14s %10s\n", "threads", "lines", "seconds", "lines/sec", "dropped");
+
+    int thread_counts[] = {1, 2, 4, 8, 16};
+    for (int k = 0; k < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); ++k)
+    {
+        int n = thread_counts[k];
+        pthread_t tids[16];
+        long long dropped_before = Log::get_instance()->get_dropped_lines();
+        double start = now_sec();
+        for (long i = 0; i < n; ++i)
+            pthread_create(&tids[i], NULL, producer, (void *)i);
+        for (int i = 0; i < n; ++i)
+            pthread_join(tids[i], NULL);
+        // 计入把剩余缓冲写入文件的时间
+        Log::get_instance()->flush();
+        double cost = now_sec() - start;
+        long long total = g_lines_per_thread * n;
+        long long dropped = Log::get_instance()->get_dropped_lines() - dropped_before;
+        printf("%8d %14lld %14.3f %14.0f %10lld\n", n, total, cost, total / cost, dropped);
+    }
+    return 0;
+}
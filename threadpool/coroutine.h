@@ -0,0 +1,219 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+#include <type_traits>
+#include "task_executor.h"
+
+/*
+请求处理用的C++20协程工具
+co_task<T>     惰性启动的子协程，被 co_await 时才开始执行，结束后对称转移回调用方
+co_detached    立即启动、不需要等待结果的顶层协程，结束后自动销毁协程帧
+offload_awaiter 把阻塞操作(数据库、磁盘、解压)交给 task_executor 执行，
+               当前线程在等待期间被释放；完成后通过 resumer 决定在哪里恢复协程
+callback_awaiter 等待一个以回调方式通知完成的操作(如批量写入线程)，不占用任何线程
+*/
+
+template <typename T>
+class co_task
+{
+public:
+    // T 需要可默认构造，请求处理中只用到 HTTP_CODE 这样的枚举
+    struct promise_type
+    {
+        T value{};
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        co_task get_return_object()
+        {
+            return co_task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // 子协程结束时直接切回等待它的父协程
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                std::coroutine_handle<> next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    co_task(co_task &&other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+    co_task(const co_task &) = delete;
+    co_task &operator=(const co_task &) = delete;
+    ~co_task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        m_handle.promise().continuation = caller;
+        return m_handle;
+    }
+    T await_resume()
+    {
+        if (m_handle.promise().error)
+            std::rethrow_exception(m_handle.promise().error);
+        return std::move(m_handle.promise().value);
+    }
+
+private:
+    explicit co_task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+struct co_detached
+{
+    struct promise_type
+    {
+        co_detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        // 与同步版本一致，异常不在这里吞掉
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// co_await co_self{} 取得当前协程自身的句柄，不会真正挂起
+// 顶层协程记下自己的句柄，取消时销毁它即可连带销毁所有子协程帧
+struct co_self
+{
+    std::coroutine_handle<> handle;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        handle = h;
+        return false;
+    }
+    std::coroutine_handle<> await_resume() const noexcept { return handle; }
+};
+
+template <typename F>
+class offload_awaiter
+{
+public:
+    typedef decltype(std::declval<F &>()()) result_type;
+    // resumer 在执行器线程上被调用，负责把协程交回合适的线程恢复
+    // 为空时直接在执行器线程上恢复
+    typedef std::function<void(std::coroutine_handle<>)> resumer;
+
+    offload_awaiter(F fn, resumer r) : m_fn(std::move(fn)), m_resumer(std::move(r)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        // resumer 按值捕获：恢复调度之后协程帧(连同本对象)可能立即被销毁
+        resumer r = m_resumer;
+        bool posted = task_executor::get_instance()->post([this, h, r]()
+        {
+            execute();
+            if (r)
+                r(h);
+            else
+                h.resume();
+        });
+        if (!posted)
+        {
+            // 执行器队列已满，退化为在当前线程同步执行，不挂起
+            execute();
+            return false;
+        }
+        return true;
+    }
+
+    result_type await_resume()
+    {
+        if (m_error)
+            std::rethrow_exception(m_error);
+        if constexpr (!std::is_void<result_type>::value)
+            return std::move(m_result);
+    }
+
+private:
+    void execute()
+    {
+        try
+        {
+            if constexpr (std::is_void<result_type>::value)
+                m_fn();
+            else
+                m_result = m_fn();
+        }
+        catch (...)
+        {
+            m_error = std::current_exception();
+        }
+    }
+
+    struct empty_result
+    {
+    };
+    F m_fn;
+    resumer m_resumer;
+    typename std::conditional<std::is_void<result_type>::value, empty_result, result_type>::type m_result{};
+    std::exception_ptr m_error;
+};
+
+// start 收到一个完成回调 done(T)，由执行操作的线程在结束时调用恰好一次
+// done 可能在 start 返回之前就被调用，因此 await_suspend 在调用 start 之后不再访问本对象
+template <typename T>
+class callback_awaiter
+{
+public:
+    typedef std::function<void(T)> completion;
+    typedef std::function<void(completion)> starter;
+    typedef std::function<void(std::coroutine_handle<>)> resumer;
+
+    callback_awaiter(starter start, resumer r) : m_start(std::move(start)), m_resumer(std::move(r)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        resumer r = m_resumer;
+        T *result = &m_result;
+        starter start = std::move(m_start);
+        start([result, h, r](T v)
+        {
+            *result = std::move(v);
+            if (r)
+                r(h);
+            else
+                h.resume();
+        });
+    }
+
+    T await_resume() { return std::move(m_result); }
+
+private:
+    starter m_start;
+    resumer m_resumer;
+    T m_result{};
+};
+
+// 在后台执行 fn，完成后直接在执行器线程上恢复
+template <typename F>
+offload_awaiter<F> co_offload(F fn)
+{
+    return offload_awaiter<F>(std::move(fn), nullptr);
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef TASK_EXECUTOR_H
+#define TASK_EXECUTOR_H
+
+#include <list>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <utility>
+#include <sys/time.h>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "../metrics/flight_recorder.h"
+
+/*
+通用后台任务执行器
+threadpool<T> 只能执行 http_conn 的 process/read_once/write，
+这里的执行器接收任意可调用对象(类型擦除为 std::function)，
+用于持久化、临时文件清理、压缩等不需要阻塞请求线程的工作。
+任务队列有上限，满了以后 post 返回 false，submit 则在调用线程内直接执行。
+*/
+class task_executor
+{
+public:
+    typedef std::function<void()> task;
+
+    // 执行器的运行统计，供 ServerMetrics 输出
+    struct stats
+    {
+        long long submitted;     // 成功入队的任务数
+        long long completed;     // 执行完成的任务数
+        long long rejected;      // 队列满被拒绝的任务数
+        long long failed;        // 执行时抛出异常的任务数
+        int queue_size;          // 当前排队的任务数
+        int thread_number;       // 工作线程数
+        long long total_wait_us; // 入队到出队的累计等待时间
+        long long total_exec_us; // 累计执行时间
+    };
+
+    // C++11以后,使用局部变量懒汉不用加锁
+    static task_executor *get_instance()
+    {
+        static task_executor instance;
+        return &instance;
+    }
+
+    // 创建工作线程，重复调用无效
+    bool init(int thread_number = 2, int max_tasks = 1024)
+    {
+        if (thread_number <= 0 || max_tasks <= 0)
+            return false;
+        m_queuelocker.lock();
+        if (m_started)
+        {
+            m_queuelocker.unlock();
+            return true;
+        }
+        m_max_tasks = max_tasks;
+        m_thread_number = 0;
+        for (int i = 0; i < thread_number; ++i)
+        {
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, worker, this) != 0)
+                break;
+            pthread_detach(tid);
+            ++m_thread_number;
+        }
+        m_started = m_thread_number > 0;
+        m_queuelocker.unlock();
+        return m_started;
+    }
+
+    // 投递一个不关心结果的任务，队列已满或执行器未启动时返回false，由调用方决定如何降级
+    bool post(task t)
+    {
+        m_queuelocker.lock();
+        if (!m_started || (int)m_workqueue.size() >= m_max_tasks)
+        {
+            m_queuelocker.unlock();
+            m_rejected++;
+            return false;
+        }
+        item it;
+        it.fn = std::move(t);
+        it.enqueue_us = now_us();
+        m_workqueue.push_back(std::move(it));
+        m_queuelocker.unlock();
+        m_submitted++;
+        m_queuestat.post();
+        return true;
+    }
+
+    // 投递一个有返回值的任务，通过 future 取结果
+    // 被拒绝时在调用线程内直接执行，保证 future 总是有效
+    template <typename F>
+    std::future<decltype(std::declval<F &>()())> submit(F f)
+    {
+        typedef decltype(std::declval<F &>()()) R;
+        std::shared_ptr<std::packaged_task<R()>> pt = std::make_shared<std::packaged_task<R()>>(std::move(f));
+        std::future<R> fut = pt->get_future();
+        if (!post([pt]() { (*pt)(); }))
+        {
+            (*pt)();
+        }
+        return fut;
+    }
+
+    stats get_stats()
+    {
+        stats s;
+        s.submitted = m_submitted.load();
+        s.completed = m_completed.load();
+        s.rejected = m_rejected.load();
+        s.failed = m_failed.load();
+        s.total_wait_us = m_total_wait_us.load();
+        s.total_exec_us = m_total_exec_us.load();
+        m_queuelocker.lock();
+        s.queue_size = m_workqueue.size();
+        s.thread_number = m_thread_number;
+        m_queuelocker.unlock();
+        return s;
+    }
+
+private:
+    struct item
+    {
+        task fn;
+        long long enqueue_us;
+    };
+
+    task_executor() : m_thread_number(0), m_max_tasks(0), m_started(false),
+                      m_submitted(0), m_completed(0), m_rejected(0), m_failed(0),
+                      m_total_wait_us(0), m_total_exec_us(0) {}
+    task_executor(const task_executor &) = delete;
+    task_executor &operator=(const task_executor &) = delete;
+
+    static long long now_us()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000000LL + tv.tv_usec;
+    }
+
+    static void *worker(void *arg)
+    {
+        task_executor *executor = (task_executor *)arg;
+        flight_recorder::install_alt_stack();
+        executor->run();
+        return executor;
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            m_queuestat.wait();
+            m_queuelocker.lock();
+            if (m_workqueue.empty())
+            {
+                m_queuelocker.unlock();
+                continue;
+            }
+            item it = std::move(m_workqueue.front());
+            m_workqueue.pop_front();
+            m_queuelocker.unlock();
+
+            long long start = now_us();
+            m_total_wait_us += start - it.enqueue_us;
+            try
+            {
+                it.fn();
+            }
+            catch (...)
+            {
+                // 后台任务的异常不能带走工作线程
+                m_failed++;
+            }
+            m_total_exec_us += now_us() - start;
+            m_completed++;
+        }
+    }
+
+private:
+    int m_thread_number;          // 工作线程数
+    int m_max_tasks;              // 队列中允许的最大任务数
+    bool m_started;               // 是否已经创建了工作线程
+    std::list<item> m_workqueue;  // 任务队列
+    locker m_queuelocker;         // 保护任务队列的互斥锁
+    sem m_queuestat;              // 是否有任务需要处理
+
+    std::atomic<long long> m_submitted;
+    std::atomic<long long> m_completed;
+    std::atomic<long long> m_rejected;
+    std::atomic<long long> m_failed;
+    std::atomic<long long> m_total_wait_us;
+    std::atomic<long long> m_total_exec_us;
+};
+
+#endif
@@ -6,7 +6,10 @@
 #include <exception>
 #include <pthread.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "../metrics/latency.h"
+#include "../metrics/runtime_stats.h"
+#include "../metrics/trace.h"
+#include "../metrics/flight_recorder.h"
 
 template <typename T>
 class threadpool
@@ -17,7 +20,7 @@ public:
     max_requests是请求队列中最多允许的、
     等待处理的请求的数量
     */
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    threadpool(int actor_model, int thread_number = 8, int max_request = 10000);
     ~threadpool();
     bool append(T *request, int state);
     bool append_p(T *request);
@@ -26,6 +29,7 @@ private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
     static void *worker(void *arg);
     void run();
+    void handle(T *request);
 
 private:
     int m_thread_number;        //线程池中的线程数
@@ -34,15 +38,15 @@ private:
     std::list<T *> m_workqueue; //请求队列
     locker m_queuelocker;       //保护请求队列的互斥锁
     sem m_queuestat;            //是否有任务需要处理
-    connection_pool *m_connPool;  //数据库
     int m_actor_model;          //模型切换
 };
 //主要初始化线程池，创建工作线程并分配资源，确保线程池具备任务处理的能力
 template <typename T>
-threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool( int actor_model, int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_actor_model(actor_model)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
+    runtime_stats::get_instance()->set_queue_capacity(max_requests);
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
         throw std::exception();
@@ -72,14 +76,18 @@ threadpool<T>::~threadpool()
 template <typename T>
 bool threadpool<T>::append(T *request, int state)
 {
+    request->begin_request();
     m_queuelocker.lock();
     if (m_workqueue.size() >= m_max_requests)
     {
         m_queuelocker.unlock();
+        runtime_stats::get_instance()->queue_rejected();
         return false;
     }
     request->m_state = state;
+    request->m_enqueue_us = latency_stats::now_us();
     m_workqueue.push_back(request);
+    runtime_stats::get_instance()->set_queue_depth(m_workqueue.size());
     m_queuelocker.unlock();
     m_queuestat.post();
     return true;
@@ -87,13 +95,17 @@ bool threadpool<T>::append(T *request, int state)
 template <typename T>
 bool threadpool<T>::append_p(T *request)
 {
+    request->begin_request();
     m_queuelocker.lock();
     if (m_workqueue.size() >= m_max_requests)
     {
         m_queuelocker.unlock();
+        runtime_stats::get_instance()->queue_rejected();
         return false;
     }
+    request->m_enqueue_us = latency_stats::now_us();
     m_workqueue.push_back(request);
+    runtime_stats::get_instance()->set_queue_depth(m_workqueue.size());
     m_queuelocker.unlock();
     m_queuestat.post();
     return true;
@@ -104,6 +116,7 @@ void *threadpool<T>::worker(void *arg)
     //调用时 *arg是this！
     //所以该操作其实是获取threadpool对象地址
     threadpool *pool = (threadpool *)arg;
+    flight_recorder::install_alt_stack();
     pool->run();
     return pool;
 }
@@ -111,6 +124,9 @@ void *threadpool<T>::worker(void *arg)
 template <typename T>
 void threadpool<T>::run()
 {
+    runtime_stats *stats = runtime_stats::get_instance();
+    int slot = stats->register_worker();
+    long long idle_start = latency_stats::now_us();
     while (true)//循环运行，直到线程池停止
     {
         m_queuestat.wait();//等待信号量，确认有任务需要处理
@@ -122,43 +138,60 @@ void threadpool<T>::run()
         }
         T *request = m_workqueue.front();//从队列中取出任务
         m_workqueue.pop_front();
+        stats->set_queue_depth(m_workqueue.size());
         m_queuelocker.unlock();//解锁队列
         if (!request)
             continue;
-        if (1 == m_actor_model)
+        long long start = latency_stats::now_us();
+        latency_stats::get_instance()->record_stage(STAGE_QUEUE, start - request->m_enqueue_us);
+        tracer::get_instance()->record(request->m_trace_id, "queue_wait", request->m_enqueue_us, start);
+        handle(request);
+        long long end = latency_stats::now_us();
+        stats->worker_task(slot, start - idle_start, end - start);
+        idle_start = end;
+    }
+}
+// 处理一个出队的任务：恢复挂起的协程，或按并发模型读写并处理请求
+template <typename T>
+void threadpool<T>::handle(T *request)
+{
+    // 挂起的请求在后台操作完成后被重新放回队列，直接恢复协程，不再读写socket
+    if (request->resumable())
+    {
+        request->resume();
+        return;
+    }
+    if (1 == m_actor_model)
+    {
+        if (0 == request->m_state)
         {
-            if (0 == request->m_state)
+            if (request->read_once())
             {
-                if (request->read_once())
-                {
-                    request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
-                    request->process();
-                }
-                else
-                {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+                request->improv = 1;
+                request->process();
             }
             else
             {
-                if (request->write())
-                {
-                    request->improv = 1;
-                }
-                else
-                {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+                request->improv = 1;
+                request->timer_flag = 1;
             }
         }
         else
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
-            request->process();
+            if (request->write())
+            {
+                request->improv = 1;
+            }
+            else
+            {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
         }
     }
+    else
+    {
+        request->process();
+    }
 }
 #endif
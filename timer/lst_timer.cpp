@@ -245,8 +245,13 @@ void cb_func(client_data *user_data)
     // 删除非活动连接在socket上的注册事件
     epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    // 先注销再关fd，关闭后fd可能立刻被新连接复用
+    conn_registry::get_instance()->on_close(user_data->sockfd, user_data->reg_gen);
     // 关闭文件描述符
     close(user_data->sockfd);
+    // 定时器随后会被释放，置空便于事件循环识别已超时关闭的连接
+    user_data->timer = NULL;
+    flight_recorder::get_instance()->record(FR_TIMER_EXPIRE, user_data->sockfd);
     // 减少连接数
     http_conn::m_user_count--;
 }
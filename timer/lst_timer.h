@@ -34,6 +34,8 @@ struct client_data
     int sockfd;
     // 定时器
     util_timer *timer;
+    // 连接登记表中的接入代数
+    unsigned reg_gen;
 };
 
 class util_timer
@@ -1,5 +1,39 @@
 #include "webserver.h"
 
+#undef LOG_MODULE
+#define LOG_MODULE LOG_MOD_SERVER
+
+namespace
+{
+    // 分块流式压缩日志段：每块独立打包成一个bundle顺序追加到dst，内存占用与文件大小无关
+    // bundle头是定长的并记录了压缩长度，解压时逐块 bundle::unpack 即可
+    bool archive_log(const string &src, const string &dst)
+    {
+        FILE *in = fopen(src.c_str(), "rb");
+        if (!in)
+            return false;
+        FILE *out = fopen(dst.c_str(), "wb");
+        if (!out)
+        {
+            fclose(in);
+            return false;
+        }
+        bool ok = true;
+        string chunk(LOG_ARCHIVE_CHUNK, '\0');
+        string packed;
+        size_t n;
+        while (ok && (n = fread(&chunk[0], 1, chunk.size(), in)) > 0)
+        {
+            string block(chunk, 0, n);
+            ok = bundle::pack(bundle::LZ4F, packed, block) &&
+                 fwrite(packed.data(), 1, packed.size(), out) == packed.size();
+        }
+        ok = ok && !ferror(in);
+        fclose(in);
+        return fclose(out) == 0 && ok;
+    }
+}
+
 WebServer::WebServer()
 {
     // http_conn类对象
@@ -23,6 +57,7 @@ WebServer::~WebServer()
     close(m_listenfd);
     close(m_pipefd[1]);
     close(m_pipefd[0]);
+    close(m_resumefd);
     delete[] users;
     delete[] users_timer;
     delete m_pool;
@@ -82,13 +117,19 @@ void WebServer::log_write()
         // 初始化日志
         if (1 == m_log_write)
             Log::get_instance()->init("./Server_log/ServerLog", m_close_log, 2000, 800000, 800);
+        else if (2 == m_log_write)
+            // 异步二进制日志，用logdecode还原
+            Log::get_instance()->init("./Server_log/ServerLog", m_close_log, 2000, 800000, 800, true);
         else
             Log::get_instance()->init("./Server_log/ServerLog", m_close_log, 2000, 800000, 0);
+
+        // 切分出的旧文件用bundle分块压缩(LZ4F压缩最快，适合日志)，并限制目录总大小
+        Log::get_instance()->set_rotation(LOG_MAX_FILE_BYTES, LOG_MAX_TOTAL_BYTES, archive_log);
     }
 }
 // 初始化数据库连接池
 // 连接池的初始化会调用connection_pool类的init方法
-// 该方法会创建数据库连接，并将连接放入连接池中
+// 该方法先建立最少数量的连接，其余连接在并发需要时再建立，数据库连不上时不退出
 // http_conn类的initmysql_result方法会从连接池中获取连接，并初始化mysql对象
 // 该方法会在http_conn类的构造函数中调用
 // 连接池的作用是为了提高数据库连接的复用率，减少连接的创建和销毁开销
@@ -98,7 +139,7 @@ void WebServer::log_write()
 // 该方法会关闭所有连接，并销毁连接池
 // 连接池的单例模式实现是通过GetInstance方法获取连接池实例
 // 该方法会创建一个静态的connection_pool对象，并返回其地址
-// 连接池的GetConnection方法会从连接池中获取一个连接，并返回其指针
+// 连接池的GetConnection方法会从连接池中获取一个连接，并返回其指针，超时或连不上数据库时返回NULL
 // 连接池的ReleaseConnection方法会将连接放回连接池中
 // 连接池的GetFreeConn方法会返回当前空闲的连接数
 void WebServer::sql_pool()
@@ -106,6 +147,9 @@ void WebServer::sql_pool()
     // 初始化数据库连接池
     m_connPool = connection_pool::GetInstance();
     m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    circuit_breaker::get_instance(DEP_MYSQL)->set_close_log(m_close_log);
+    registration_writer::get_instance()->init(m_connPool);
+    async_mysql::get_instance()->init("localhost", m_user, m_passWord, m_databaseName, 3306, ASYNC_SQL_CONNS, m_close_log);
 
     // 初始化数据库读取表
     users->initmysql_result(m_connPool);
@@ -126,7 +170,10 @@ void WebServer::sql_pool()
 void WebServer::thread_pool()
 {
     // 线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num);
+
+    // 后台执行器，承接持久化、临时文件清理等非关键路径的工作
+    task_executor::get_instance()->init(EXECUTOR_THREAD_NUM, EXECUTOR_MAX_TASKS);
 }
 
 void WebServer::eventListen()
@@ -180,9 +227,20 @@ void WebServer::eventListen()
     utils.setnonblocking(m_pipefd[1]);
     utils.addfd(m_epollfd, m_pipefd[0], false, 0);
 
+    // 后台完成的阻塞操作通过eventfd通知事件循环恢复对应的请求协程
+    m_resumefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(m_resumefd != -1);
+    utils.addfd(m_epollfd, m_resumefd, false, 0);
+    http_conn::m_resumefd = m_resumefd;
+
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    // 崩溃时把飞行记录器中最近的事件写入文件
+    flight_recorder::install_crash_handler(FLIGHT_DUMP_PATH);
+    // 指标历史映射到文件，重启后接着之前的数据记录
+    if (!metrics_history::get_instance()->open(HISTORY_PATH))
+        LOG_ERROR("open metrics history %s failed, errno %d", HISTORY_PATH, errno);
 
     alarm(TIMESLOT);
 
@@ -199,6 +257,7 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].reg_gen = conn_registry::get_instance()->generation(connfd);
     util_timer *timer = new util_timer;
     timer->user_data = &users_timer[connfd];
     timer->cb_func = cb_func;
@@ -216,7 +275,7 @@ void WebServer::adjust_timer(util_timer *timer)
     timer->expire = cur + 3 * TIMESLOT;
     utils.m_timer_lst.adjust_timer(timer);
 
-    LOG_INFO("%s", "adjust timer once");
+    LOG_INFO_RL(10, 50, "%s", "adjust timer once");
 }
 
 void WebServer::deal_timer(util_timer *timer, int sockfd)
@@ -227,7 +286,7 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
         utils.m_timer_lst.del_timer(timer);
     }
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    LOG_INFO_RL(10, 50, "close fd %d", users_timer[sockfd].sockfd);
 }
 
 bool WebServer::dealclientdata()
@@ -239,22 +298,19 @@ bool WebServer::dealclientdata()
         int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
         if (connfd < 0)
         {
-            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            LOG_ERROR_RL(10, 50, "%s:errno is:%d", "accept error", errno);
+            flight_recorder::get_instance()->record(FR_ERROR, m_listenfd, errno, 0, "accept error");
             return false;
         }
-        // 获取客户端 IP 地址
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_address.sin_addr, client_ip, sizeof(client_ip));
-
-        // 将 IP 地址加入到集合中
-        ServerMetrics::get_instance().addConnectedIP(std::string(client_ip));
-
         if (http_conn::m_user_count >= MAX_FD)
         {
             utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
+            flight_recorder::get_instance()->record(FR_ERROR, connfd, http_conn::m_user_count, 0, "server busy");
             return false;
         }
+        // 按fd登记，不加锁也不分配内存
+        conn_registry::get_instance()->on_accept(connfd, client_address);
         timer(connfd, client_address);
     }
 
@@ -265,20 +321,19 @@ bool WebServer::dealclientdata()
             int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
             if (connfd < 0)
             {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                LOG_ERROR_RL(10, 50, "%s:errno is:%d", "accept error", errno);
+                if (errno != EAGAIN)
+                    flight_recorder::get_instance()->record(FR_ERROR, m_listenfd, errno, 0, "accept error");
                 break;
             }
-            // 获取客户端 IP 地址
-            char client_ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &client_address.sin_addr, client_ip, sizeof(client_ip));
-            // 将 IP 地址加入到集合中
-            ServerMetrics::get_instance().addConnectedIP(std::string(client_ip));
             if (http_conn::m_user_count >= MAX_FD)
             {
                 utils.show_error(connfd, "Internal server busy");
                 LOG_ERROR("%s", "Internal server busy");
+                flight_recorder::get_instance()->record(FR_ERROR, connfd, http_conn::m_user_count, 0, "server busy");
                 break;
             }
+            conn_registry::get_instance()->on_accept(connfd, client_address);
             timer(connfd, client_address);
         }
         return false;
@@ -356,7 +411,7 @@ void WebServer::dealwithread(int sockfd)
         // proactor
         if (users[sockfd].read_once())
         {
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO_RL(10, 50, "deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
             // 若监测到读事件，将该事件放入请求队列
             m_pool->append_p(users + sockfd);
@@ -405,7 +460,7 @@ void WebServer::dealwithwrite(int sockfd)
         // proactor
         if (users[sockfd].write())
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO_RL(10, 50, "send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
             if (timer)
             {
@@ -419,18 +474,51 @@ void WebServer::dealwithwrite(int sockfd)
     }
 }
 
+// 把后台操作已完成的请求协程放回线程池继续执行
+// 连接在挂起期间超时关闭或被复用时，直接销毁遗留的协程帧
+void WebServer::dealwithresume()
+{
+    uint64_t count;
+    while (read(m_resumefd, &count, sizeof(count)) > 0)
+        ;
+
+    std::list<http_conn::resume_entry> entries;
+    http_conn::take_resumes(entries);
+    for (auto &entry : entries)
+    {
+        int sockfd = entry.conn - users;
+        if (users_timer[sockfd].timer == NULL || !entry.conn->accept_resume(entry.gen, entry.handle))
+        {
+            entry.root.destroy();
+            continue;
+        }
+        if (!m_pool->append_p(entry.conn))
+        {
+            // 请求队列已满，协程无法继续，直接销毁并关闭连接，避免连接挂起到超时
+            LOG_WARN_RL(10, 50, "resume dropped, queue full, close fd %d", sockfd);
+            flight_recorder::get_instance()->record(FR_ERROR, sockfd, 0, 0, "resume queue full");
+            entry.root.destroy();
+            deal_timer(users_timer[sockfd].timer, sockfd);
+        }
+    }
+}
+
 void WebServer::eventLoop()
 {
     bool timeout = false;
     bool stop_server = false;
+    runtime_stats *stats = runtime_stats::get_instance();
+    long long iter_end = latency_stats::now_us();
 
     while (!stop_server)
     {
         // 等待所监控文件描述符上有事件的产生
         int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        long long woke = latency_stats::now_us();
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
+            flight_recorder::get_instance()->record(FR_ERROR, m_epollfd, errno, 0, "epoll failure");
             break;
         }
 
@@ -450,11 +538,7 @@ void WebServer::eventLoop()
                 // 服务器端关闭连接，移除对应的定时器
                 util_timer *timer = users_timer[sockfd].timer;
                 deal_timer(timer, sockfd);
-                // 从集合中移除断开连接的 IP 地址
-                char client_ip[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, client_ip, sizeof(client_ip));
-                ServerMetrics::get_instance().removeConnectedIP(std::string(client_ip));
-                LOG_INFO("client(%s) disconnected", inet_ntoa(users[sockfd].get_address()->sin_addr));
+                LOG_INFO_RL(10, 50, "client(%s) disconnected", inet_ntoa(users[sockfd].get_address()->sin_addr));
             }
             // 处理信号
             else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
@@ -463,6 +547,11 @@ void WebServer::eventLoop()
                 if (false == flag)
                     LOG_ERROR("%s", "dealclientdata failure");
             }
+            // 处理挂起请求的恢复通知
+            else if ((sockfd == m_resumefd) && (events[i].events & EPOLLIN))
+            {
+                dealwithresume();
+            }
             // 处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
@@ -481,5 +570,8 @@ void WebServer::eventLoop()
 
             timeout = false;
         }
+        long long now = latency_stats::now_us();
+        stats->record_loop(number, woke - iter_end, now - woke);
+        iter_end = now;
     }
 }
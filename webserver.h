@@ -11,14 +11,26 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unordered_set>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
 #include "./metrics/metrics.h"
+#include "./metrics/flight_recorder.h"
+#include "./metrics/runtime_stats.h"
+#include "./metrics/history.h"
 const int MAX_FD = 2048;           // 最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; // 最大事件数
 const int TIMESLOT = 5;             // 最小超时单位
+const int EXECUTOR_THREAD_NUM = 2;  // 后台执行器线程数
+const int EXECUTOR_MAX_TASKS = 1024; // 后台执行器队列上限
+const int ASYNC_SQL_CONNS = 2;      // 非阻塞查询线程使用的数据库连接数
+const long long LOG_MAX_FILE_BYTES = 64LL << 20;   // 单个日志文件超过64MB切分
+const long long LOG_MAX_TOTAL_BYTES = 1LL << 30;   // Server_log目录总大小上限1GB
+const size_t LOG_ARCHIVE_CHUNK = 4 << 20;          // 归档时每次读入并压缩4MB
+const char *const FLIGHT_DUMP_PATH = "./flight_recorder.dump"; // 崩溃时飞行记录器的输出文件
+const char *const HISTORY_PATH = "./metrics_history.dat";      // 指标历史的持久化文件
 
 class WebServer
 {
@@ -43,6 +55,7 @@ public:
     bool dealwithsignal(bool &timeout, bool &stop_server);
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
+    void dealwithresume();
 
 
 
@@ -56,6 +69,7 @@ public:
 
     int m_pipefd[2];
     int m_epollfd;
+    int m_resumefd; // 协程恢复通知
     http_conn *users;
 
     // storage::DataManager *data_; // 数据管理模块